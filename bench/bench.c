@@ -0,0 +1,552 @@
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "account.h"
+#include "arena.h"
+#include "builtin.h"
+#include "complete.h"
+#include "event.h"
+#include "history.h"
+#include "job.h"
+#include "launch.h"
+#include "lexer.h"
+#include "parse.h"
+#include "pathglob.h"
+#include "script.h"
+#include "spawnserver.h"
+#include "vars.h"
+
+/* Microbenchmarks for the shell's own overhead. Every result is
+ * one JSON object on stdout so runs from different versions can
+ * be diffed or loaded into a spreadsheet. "./shell_bench n"
+ * scales every iteration count by n (default 1).
+ */
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+extern char **environ;
+
+/* A typical interactive line with a pipeline, quoting and a
+ * background job.
+ */
+static const char sample_line[] =
+    "grep -rn \"main(\" src include | sort -u | head -n 20 & ls -l /tmp; echo 'done'";
+
+static long scale = 1;
+static int first_result = 1;
+
+/* Print one result. ops is how many operations took seconds. */
+static void report(const char *name, long ops, double seconds) {
+    printf("%s    {\"name\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, "
+            "\"ns_per_op\": %.1f, \"ops_per_sec\": %.1f}",
+            first_result ? "" : ",\n", name, ops, seconds,
+            seconds * 1e9 / ops, ops / seconds);
+    first_result = 0;
+    fflush(stdout);
+}
+
+/* Lexing on its own. The lexer works in place so each
+ * iteration starts from a fresh copy of the line.
+ */
+static void bench_lex() {
+    long n = 200000 * scale;
+    token_list tl = { NULL, 0, 0 };
+    char line[sizeof(sample_line)];
+    const char *error;
+    struct timespec start, end;
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        memcpy(line, sample_line, sizeof(sample_line));
+        lex_line(line, sizeof(sample_line) - 1, &tl, &error);
+    }
+    clock_now(&end);
+    report("lex_line", n, elapsed_seconds(&start, &end));
+    free_token_list(&tl);
+}
+
+/* Lexing and building the jobs, what the main loop does with
+ * every line before launching anything.
+ */
+static void bench_parse() {
+    long n = 200000 * scale;
+    token_list tl = { NULL, 0, 0 };
+    char line[sizeof(sample_line)];
+    const char *error;
+    command_line cl;
+    struct timespec start, end;
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        memcpy(line, sample_line, sizeof(sample_line));
+        lex_line(line, sizeof(sample_line) - 1, &tl, &error);
+        parse_command_line(&tl, &cl);
+        free_command_line(&cl);
+    }
+    clock_now(&end);
+    report("lex_and_parse", n, elapsed_seconds(&start, &end));
+    free_token_list(&tl);
+}
+
+/* Adding to and fetching from a history in a scratch file */
+static void bench_history() {
+    long n = 20000 * scale;
+    char template[] = "/tmp/shell_bench_historyXXXXXX";
+    char command[64];
+    char *tokens[4];
+    struct timespec start, end;
+    int fd = mkstemp(template);
+
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(1);
+    }
+    close(fd);
+    set_var("HISTFILE", template, 1);
+    init_history();
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        snprintf(command, sizeof(command), "make -j%ld target%ld", i % 64, i);
+        add_to_history(command);
+    }
+    clock_now(&end);
+    report("add_to_history", n, elapsed_seconds(&start, &end));
+
+    /* "r 123" */
+    tokens[0] = "r";
+    tokens[1] = command;
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        snprintf(command, sizeof(command), "%ld", i % n + 1);
+        fetch_command(tokens, 2);
+    }
+    clock_now(&end);
+    report("fetch_command_index", n, elapsed_seconds(&start, &end));
+
+    /* "r make -j3" and "r -s target123", the first search builds
+     * the index so it is timed too.
+     */
+    long searches = 2000 * scale;
+    tokens[1] = "make";
+    tokens[2] = command;
+    clock_now(&start);
+    for (long i = 0; i < searches; i++) {
+        snprintf(command, sizeof(command), "-j%ld", i % 64);
+        fetch_command(tokens, 3);
+    }
+    clock_now(&end);
+    report("fetch_command_prefix", searches, elapsed_seconds(&start, &end));
+
+    tokens[1] = "-s";
+    tokens[2] = command;
+    clock_now(&start);
+    for (long i = 0; i < searches; i++) {
+        snprintf(command, sizeof(command), "target%ld", (i * 7919) % n);
+        fetch_command(tokens, 3);
+    }
+    clock_now(&end);
+    report("fetch_command_substring", searches, elapsed_seconds(&start, &end));
+
+    unlink(template);
+}
+
+/* Inserting, looking up and deleting jobs with fake pids. Each
+ * job is a two process pipeline like "a | b".
+ */
+static void bench_job_table() {
+    long n = 10000 * scale;
+    job *jobs = calloc(n, sizeof(job));
+    process *procs = calloc(2 * n, sizeof(process));
+    job_table t;
+    process *p;
+    struct timespec start, end;
+
+    init_job_table(&t);
+    for (long i = 0; i < n; i++) {
+        init_job(&jobs[i]);
+        init_process(&procs[2 * i]);
+        init_process(&procs[2 * i + 1]);
+        procs[2 * i].pid = 2 * i + 100;
+        procs[2 * i + 1].pid = 2 * i + 101;
+        add_process(&jobs[i].first_process, &procs[2 * i]);
+        add_process(&jobs[i].first_process, &procs[2 * i + 1]);
+    }
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++)
+        insert_job(&t, &jobs[i]);
+    clock_now(&end);
+    report("insert_job", n, elapsed_seconds(&start, &end));
+
+    long lookups = 100 * n;
+    clock_now(&start);
+    for (long i = 0; i < lookups; i++)
+        find_job_by_pid(&t, (i * 7919) % (2 * n) + 100, &p);
+    clock_now(&end);
+    report("find_job_by_pid", lookups, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < lookups; i++)
+        find_job(&t, (i * 7919) % n + 1);
+    clock_now(&end);
+    report("find_job", lookups, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++)
+        delete_job(&t, &jobs[(i * 7919) % n]);
+    clock_now(&end);
+    report("delete_job", n, elapsed_seconds(&start, &end));
+
+    free(jobs);
+    free(procs);
+}
+
+/* Start a one process job running argv */
+static void start_job(job *j, process *p, char **argv, int foreground) {
+    init_job(j);
+    init_process(p);
+    p->argv = argv;
+    j->first_process = p;
+    j->foreground = foreground;
+    launch_job(j);
+}
+
+/* Run /bin/true in the foreground over and over with a backend.
+ * The full path keeps it from being run as the builtin.
+ */
+static void bench_spawn_foreground(const char *backend) {
+    long n = 500 * scale;
+    char *argv[] = { "/bin/true", NULL };
+    char name[64];
+    struct timespec start, end;
+    process p;
+    job j;
+
+    set_spawn_backend(backend);
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        start_job(&j, &p, argv, 1);
+        waitpid(p.pid, NULL, 0);
+    }
+    clock_now(&end);
+    snprintf(name, sizeof(name), "spawn_foreground_%s", backend);
+    report(name, n, elapsed_seconds(&start, &end));
+}
+
+/* Start a batch of background /bin/trues, then reap them all */
+static void bench_spawn_background() {
+    long n = 500 * scale;
+    char *argv[] = { "/bin/true", NULL };
+    struct timespec start, end;
+    process p;
+    job j;
+
+    set_spawn_backend("fork");
+    clock_now(&start);
+    for (long i = 0; i < n; i++)
+        start_job(&j, &p, argv, 0);
+    for (long i = 0; i < n; i++)
+        wait(NULL);
+    clock_now(&end);
+    report("spawn_background_fork", n, elapsed_seconds(&start, &end));
+}
+
+/* The job table under real load: 10000 "sleep 1 &" jobs are
+ * started and kept in a table, then reaped as they exit by
+ * looking each pid up in it like the main loop does. The reap
+ * time includes the second the last ones sleep.
+ */
+static void bench_background_jobs() {
+    long n = 10000 * scale, started = 0;
+    char *argv[] = { "/bin/sleep", "1", NULL };
+    job *jobs = calloc(n, sizeof(job));
+    process *procs = calloc(n, sizeof(process));
+    struct timespec start, end;
+    job_table t;
+    process *p;
+    pid_t pid;
+    int status;
+
+    if (jobs == NULL || procs == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    set_spawn_backend("fork");
+    init_job_table(&t);
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        start_job(&jobs[i], &procs[i], argv, 0);
+        if (procs[i].pid <= 0)
+            break; /* Out of processes, launch_job() said so */
+        insert_job(&t, &jobs[i]);
+        started++;
+    }
+    clock_now(&end);
+    report("background_jobs_launch", started, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    while (t.job_count > 0 && (pid = waitpid(-1, &status, 0)) > 0) {
+        job *j = find_job_by_pid(&t, pid, &p);
+        if (j == NULL)
+            continue;
+        p->completed = 1;
+        p->status = status;
+        if (job_is_completed(j))
+            delete_job(&t, j);
+    }
+    clock_now(&end);
+    report("background_jobs_reap", started, elapsed_seconds(&start, &end));
+
+    free(jobs);
+    free(procs);
+}
+
+/* "true" as a builtin, what a script loop of it costs now */
+static void bench_builtin() {
+    long n = 1000000 * scale;
+    char *argv[] = { "true", NULL };
+    builtin_fn fn;
+    struct timespec start, end;
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        fn = find_builtin(argv[0]);
+        run_builtin(fn, argv);
+    }
+    clock_now(&end);
+    report("builtin_true", n, elapsed_seconds(&start, &end));
+}
+
+/* The interpreter only runs builtins here, nothing to launch */
+static void drop_jobs(job **jobs, int job_count) {
+    for (int i = 0; i < job_count; i++)
+        free_job(jobs[i]);
+}
+
+/* A million "true"s from six nested for loops, compiled once,
+ * against lexing and parsing the body again every iteration the
+ * way it went with no control flow in the shell.
+ */
+static void bench_script() {
+    long n = 1000000 * scale;
+    char text[512], line[sizeof(text)], body[] = "true";
+    token_list tl = { NULL, 0, 0 };
+    const char *error;
+    command_line cl;
+    struct timespec start, end;
+    size_t len = 0;
+
+    for (int i = 0; i < 6; i++)
+        len += snprintf(text + len, sizeof(text) - len,
+                "for v%d in 0 1 2 3 4 5 6 7 8 9; do ", i);
+    len += snprintf(text + len, sizeof(text) - len, "true");
+    for (int i = 0; i < 6; i++)
+        len += snprintf(text + len, sizeof(text) - len, "; done");
+    init_interpreter(drop_jobs);
+
+    clock_now(&start);
+    for (long i = 0; i < scale; i++) {
+        memcpy(line, text, len + 1);
+        lex_line(line, len, &tl, &error);
+        program *p = compile_line(&tl);
+        if (p != NULL)
+            run_program(p);
+    }
+    clock_now(&end);
+    report("loop_compiled", n, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        memcpy(line, body, sizeof(body));
+        lex_line(line, sizeof(body) - 1, &tl, &error);
+        parse_command_line(&tl, &cl);
+        char **argv = cl.jobs[0]->first_process->argv;
+        run_builtin(find_builtin(argv[0]), argv);
+        free_command_line(&cl);
+    }
+    clock_now(&end);
+    report("loop_reparsed", n, elapsed_seconds(&start, &end));
+    free_token_list(&tl);
+}
+
+/* Setting an exported variable with a thousand others around,
+ * which only swaps a pointer in the environment, expanding a word
+ * and the environment for a command with an assignment in front.
+ */
+static void bench_variables() {
+    long n = 1000000 * scale;
+    char name[32], value[32], word[] = "$HOME/${BENCH_0}.$1", line[sizeof(word)];
+    char *assignment[] = { "BENCH_1=x" };
+    token_list tl = { NULL, 0, 0 };
+    const char *error;
+    struct timespec start, end;
+    arena *a = new_arena(4096);
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "BENCH_%d", i);
+        set_var(name, "0", 1);
+    }
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        snprintf(value, sizeof(value), "%ld", i);
+        set_var("BENCH_500", value, 0);
+    }
+    clock_now(&end);
+    report("set_var_exported", n, elapsed_seconds(&start, &end));
+
+    memcpy(line, word, sizeof(word));
+    lex_line(line, sizeof(word) - 1, &tl, &error);
+    const token *t = &tl.tokens[0];
+    char *out = malloc(expanded_length(t->start, t->len) + 1);
+    clock_now(&start);
+    for (long i = 0; i < n; i++)
+        expand_into(t->start, t->len, out);
+    clock_now(&end);
+    report("expand_word", n, elapsed_seconds(&start, &end));
+    free(out);
+    free_token_list(&tl);
+
+    long m = 10000 * scale;
+    clock_now(&start);
+    for (long i = 0; i < m; i++) {
+        environment_with(a, assignment, 1);
+        arena_release(a);
+        a = new_arena(4096);
+    }
+    clock_now(&end);
+    report("environment_with", m, elapsed_seconds(&start, &end));
+    arena_release(a);
+
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "BENCH_%d", i);
+        unset_var(name);
+    }
+}
+
+/* "*7.log" in a scratch directory of 100000 files: listing it
+ * again every time, using the cached listing like later words on
+ * the same line do, and glibc's glob().
+ */
+static void bench_glob() {
+    long n = 20 * scale;
+    char dir[] = "/tmp/shell_bench_globXXXXXX";
+    char name[64], pattern[128], marked[128];
+    glob_list list = { 0 };
+    glob_t g;
+    struct timespec start, end;
+    size_t matched = 0;
+
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "%s/file%06d.%s", dir, i, i % 2 ? "log" : "txt");
+        int fd = open(name, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (fd >= 0)
+            close(fd);
+    }
+    snprintf(pattern, sizeof(pattern), "%s/*7.log", dir);
+    snprintf(marked, sizeof(marked), "%s/%c7.log", dir, GLOB_STAR);
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        clear_directory_cache();
+        clear_glob_list(&list);
+        matched += glob_word(marked, strlen(marked), &list);
+    }
+    clock_now(&end);
+    report("glob_uncached", n, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        clear_glob_list(&list);
+        matched += glob_word(marked, strlen(marked), &list);
+    }
+    clock_now(&end);
+    report("glob_cached", n, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        if (glob(pattern, 0, NULL, &g) == 0)
+            matched -= g.gl_pathc;
+        globfree(&g);
+    }
+    clock_now(&end);
+    report("glibc_glob", n, elapsed_seconds(&start, &end));
+    if (matched != n * list.count)
+        fprintf(stderr, "bench_glob: glob_word and glob() disagree\n");
+
+    clear_directory_cache();
+    free_glob_list(&list);
+    for (int i = 0; i < 100000; i++) {
+        snprintf(name, sizeof(name), "%s/file%06d.%s", dir, i, i % 2 ? "log" : "txt");
+        unlink(name);
+    }
+    rmdir(dir);
+}
+
+/* Tab on the first word, once the PATH index is built. The
+ * first call builds it and is timed on its own.
+ */
+static void bench_complete() {
+    long n = 100000 * scale;
+    const char *prefixes[] = { "g", "ls", "py", "x" };
+    completion c;
+    struct timespec start, end;
+
+    clock_now(&start);
+    size_t size = command_index_size();
+    clock_now(&end);
+    report("build_command_index", size ? size : 1, elapsed_seconds(&start, &end));
+
+    clock_now(&start);
+    for (long i = 0; i < n; i++) {
+        const char *prefix = prefixes[i % 4];
+        complete_word(prefix, strlen(prefix), &c);
+        free_completion(&c);
+    }
+    clock_now(&end);
+    report("complete_command", n, elapsed_seconds(&start, &end));
+}
+
+int main(int argc, char **argv) {
+    if (strcmp(argv[0], SPAWN_SERVER_NAME) == 0)
+        run_spawn_server(argv);
+    if (argc > 1)
+        scale = atol(argv[1]) > 0 ? atol(argv[1]) : 1;
+
+    /* Like a script, no job control */
+    shell_is_interactive = 0;
+    shell_pgid = getpgrp();
+    init_events();
+    init_variables(environ, argv[0]);
+
+    printf("{\n  \"version\": \"%s\",\n  \"scale\": %ld,\n  \"benchmarks\": [\n",
+            BENCH_VERSION, scale);
+    bench_lex();
+    bench_parse();
+    bench_history();
+    bench_job_table();
+    bench_builtin();
+    bench_script();
+    bench_variables();
+    bench_glob();
+    bench_complete();
+    bench_spawn_foreground("fork");
+    bench_spawn_foreground("vfork");
+    bench_spawn_foreground("posix_spawn");
+    bench_spawn_foreground("server");
+    bench_spawn_background();
+    bench_background_jobs();
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef _ACCOUNT_H
+#define _ACCOUNT_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "job.h"
+
+/* Resource accounting for jobs. Each process records when it
+ * was spawned, exec'd and reaped along with the rusage wait4()
+ * hands back, so "time" and the job status messages can say how
+ * much a job used without wrapping it in /usr/bin/time.
+ */
+
+/* What a whole job used, added up over its processes */
+typedef struct {
+    double real;        /* first spawn to last exit, seconds */
+    double user;        /* user CPU seconds */
+    double sys;         /* system CPU seconds */
+    long maxrss;        /* largest max RSS of any process, KiB */
+    long nvcsw;         /* voluntary context switches */
+    long nivcsw;        /* involuntary context switches */
+} job_usage;
+
+/* Buckets in the fork to exit latency histogram. Bucket i counts
+ * latencies in [2^i, 2^(i+1)) microseconds.
+ */
+#define LATENCY_BUCKETS 32
+
+/* Monotonic time now. */
+void clock_now(struct timespec *t);
+
+/* Seconds from from to to. */
+double elapsed_seconds(const struct timespec *from, const struct timespec *to);
+
+/* Note that p was reaped with usage: stamps its exit time, keeps
+ * the usage and adds its spawn to exit latency to the histogram.
+ */
+void account_exit(process *p, const struct rusage *usage);
+
+/* Same for a builtin that ran in the shell, before is the
+ * shell's own usage from just before it ran.
+ */
+void account_builtin(process *p, const struct rusage *before);
+
+/* Add up what the job's processes used. */
+void get_job_usage(job *j, job_usage *u);
+
+/* Write "real 1.002s user ..." for u into buf. */
+void format_usage(const job_usage *u, char *buf, size_t size);
+
+/* Print the totals for everything the session ran and the fork
+ * to exit latency histogram.
+ */
+void print_session_usage(FILE *f);
+
+#endif /* _ACCOUNT_H */
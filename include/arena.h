@@ -0,0 +1,46 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/* A chunk of memory handed out by bumping a pointer. */
+typedef struct arena_block {
+    struct arena_block *next; /* older block */
+    size_t size;              /* bytes in data */
+    size_t used;              /* bytes handed out */
+    char data[];
+} arena_block;
+
+/* Bump allocator for everything parsed from one command line.
+ * Nothing in it is freed on its own, the whole arena goes at
+ * once when the last job using it is done. Jobs from the same
+ * line share it, so it is reference counted.
+ */
+typedef struct {
+    arena_block *blocks; /* newest block first */
+    int refs;            /* owners left */
+} arena;
+
+/* Create an arena with room for about size bytes and one
+ * reference. Sizing it right means a single malloc.
+ */
+arena *new_arena(size_t size);
+
+/* Allocate size bytes aligned for any type. */
+void *arena_alloc(arena *a, size_t size);
+
+/* Copy len bytes of s into the arena and NUL terminate it. */
+char *arena_strndup(arena *a, const char *s, size_t len);
+
+/* Take another reference. */
+arena *arena_retain(arena *a);
+
+/* Drop a reference and free everything once none are left. */
+void arena_release(arena *a);
+
+/* Number of malloc() calls arenas have made, for comparing
+ * against how many the old parser made.
+ */
+unsigned long arena_malloc_count();
+
+#endif /* _ARENA_H */
@@ -0,0 +1,39 @@
+#ifndef _BUILTIN_H
+#define _BUILTIN_H
+
+#include "job.h"
+
+/* Commands the shell runs itself instead of starting a
+ * program. On their own in the foreground they run right in
+ * the shell without forking, in a pipeline or with "&" they run
+ * in a forked child like any other command.
+ */
+typedef int (*builtin_fn)(int argc, char **argv);
+
+/* Entry in the builtin table */
+typedef struct {
+    const char *name;
+    builtin_fn fn;
+} builtin;
+
+/* Exit status of the last foreground job. */
+extern int last_status;
+
+/* Give the builtins the jobs "jobs" and "kill %n" work on. */
+void init_builtins(job_table *jobs);
+
+/* The builtin called name or NULL. */
+builtin_fn find_builtin(const char *name);
+
+/* True if the builtin runs in a forked child even on its own.
+ * "cat" can block on its input for as long as it likes and only
+ * a child in the foreground gets the Ctrl-C that stops it.
+ */
+int builtin_forks(builtin_fn fn);
+
+/* Run a builtin with the NULL terminated argv and return its
+ * exit status. Output is left in stdout's buffer.
+ */
+int run_builtin(builtin_fn fn, char **argv);
+
+#endif /* _BUILTIN_H */
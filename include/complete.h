@@ -0,0 +1,40 @@
+#ifndef _COMPLETE_H
+#define _COMPLETE_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/* Tab completion. The first word of a command is completed from
+ * an index of every executable in PATH, kept sorted so the names
+ * starting with a prefix are a binary search away. The index is
+ * built once and then kept up to date from inotify events on the
+ * PATH directories instead of reading them again on every Tab.
+ * Other words are completed from the directory they name, read
+ * with large getdents64() batches.
+ */
+
+/* PATH directories past this many aren't indexed */
+#define MAX_PATH_DIRS 64
+
+/* Bytes of directory entries asked for per getdents64() */
+#define GETDENTS_SIZE 32768
+
+typedef struct {
+    const char **matches;   /* sorted, each replaces the whole word */
+    size_t count;
+    size_t capacity;
+    size_t word_start;      /* where the word starts in the line */
+    size_t display_offset;  /* bytes of the matches not worth listing (the directory) */
+    arena *strings;         /* matches that aren't in the index */
+} completion;
+
+/* Find the completions for the word that ends at cursor. */
+void complete_word(const char *line, size_t cursor, completion *c);
+
+/* Free what complete_word() found. */
+void free_completion(completion *c);
+
+/* Number of executables in the PATH index, building it if needed. */
+size_t command_index_size();
+
+#endif /* _COMPLETE_H */
@@ -0,0 +1,73 @@
+#ifndef _EDITOR_H
+#define _EDITOR_H
+
+#include <stddef.h>
+#include "history.h"
+
+/* Line editor for the terminal. The terminal is put in raw mode
+ * (from the shell_tmodes saved by init_shell()) while a line is
+ * being edited. Input is handled a whole read() at a time and the
+ * screen is brought up to date once per read by rewriting only
+ * what changed since the last update, in one write(). Pastes
+ * arrive as bracketed pastes and are inserted in one go.
+ */
+
+/* A growable byte string */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t capacity;
+} edit_string;
+
+typedef struct {
+    int fd;                 /* terminal */
+    edit_string line;       /* what is being edited */
+    size_t cursor;          /* byte offset in line */
+    edit_string shown;      /* what is on the screen after the prompt */
+    size_t shown_cursor;    /* where the cursor is on the screen, in shown */
+    const char *prompt;     /* printed before the line, for drawing it again */
+    size_t prompt_width;    /* columns taken by the last line of the prompt */
+    int columns;            /* terminal width */
+    char pending[16];       /* start of an escape sequence cut off by read() */
+    size_t pending_len;
+    edit_string ahead;      /* what came after Enter, for the next lines */
+    char pasting;           /* inside a bracketed paste */
+    char raw;               /* terminal is in raw mode */
+    long history_index;     /* entry shown by up/down, -1 for the new line */
+    edit_string saved;      /* new line kept while looking at the history */
+    char searching;         /* in a Ctrl-R reverse search */
+    reverse_search search;
+    edit_string out;        /* escape sequences and text for the next write */
+} line_editor;
+
+/* Edit lines on the terminal fd. */
+void init_line_editor(line_editor *e, int fd);
+
+/* Start a new line. The prompt has just been printed, the cursor
+ * is right after it.
+ */
+void start_line(line_editor *e, const char *prompt);
+
+/* Handle whatever input is ready. Returns 1 when a line has been
+ * entered (it is in *line, NUL terminated, until the next line is
+ * started), 0 if it isn't finished and -1 at end of input.
+ */
+int edit_input(line_editor *e, char **line, size_t *len);
+
+/* True if input typed ahead of the last line is waiting, call
+ * edit_input() without waiting for the terminal.
+ */
+int edit_pending(line_editor *e);
+
+/* Move the cursor below the line so something can be printed,
+ * then redraw_line() once the prompt has been printed again.
+ */
+void suspend_line(line_editor *e);
+
+/* Draw the line again after the prompt was printed again. */
+void redraw_line(line_editor *e);
+
+/* Rows from the last line of the prompt down to the cursor. */
+int cursor_row(line_editor *e);
+
+#endif /* _EDITOR_H */
@@ -0,0 +1,41 @@
+#ifndef _EVENT_H
+#define _EVENT_H
+
+#include <signal.h>
+
+/* Tags for the things that can wake up the main loop.
+ * They are bit flags so one call to wait_for_events()
+ * can report several of them at once.
+ */
+#define EVENT_INPUT 1 /* Input file descriptor is readable */
+#define EVENT_CHILD 2 /* A child changed state (SIGCHLD) */
+#define EVENT_PROMPT 4 /* Prompt segment output or inotify event */
+#define EVENT_SIGNAL 8 /* Interrupted by a signal handler (SIGINT) */
+
+/* Blocks SIGCHLD and sets up the epoll instance and the
+ * signalfd used to find out about children changing state.
+ */
+void init_events();
+
+/* Watch fd and report it with tag when it is readable. */
+int add_event_fd(int fd, int tag);
+
+/* Stop watching fd. */
+void remove_event_fd(int fd, int tag);
+
+/* Sleep until something happens or timeout_ms passes (-1 waits
+ * forever). Returns the tags that are ready, 0 on timeout. If a
+ * signal interrupted the wait it is EVENT_SIGNAL plus the fds
+ * that are always ready.
+ */
+int wait_for_events(int timeout_ms);
+
+/* Restore the signal mask the shell started with. Children
+ * call this before exec since the mask survives exec.
+ */
+void restore_signal_mask();
+
+/* The signal mask the shell started with. */
+const sigset_t *get_saved_signal_mask();
+
+#endif /* _EVENT_H */
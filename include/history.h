@@ -2,28 +2,97 @@
 #define _HISTORY_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
-/* Struct to hold information relating
- * to a command in the history.
+/* The history is an append-only file of records, each one is
+ * this header followed by the command, a NUL and padding up to
+ * HISTORY_ALIGN bytes. Every record is written with a single
+ * O_APPEND write() so shells sharing the file never interleave,
+ * and the checksum catches torn or corrupted records.
  */
 typedef struct {
-    char *command;
-    size_t command_index;
-} history_info;
+    uint32_t magic;     /* HISTORY_MAGIC */
+    uint32_t length;    /* bytes in the command, not counting the NUL */
+    uint32_t checksum;  /* crc32 of the command */
+    uint32_t time;      /* when it was entered, seconds since the epoch */
+} history_record;
 
+#define HISTORY_MAGIC 0x48777363 /* "cswH" */
+#define HISTORY_ALIGN 8
+
+/* Longest command kept, a longer length means the record is
+ * damaged
+ */
+#define HISTORY_MAX_COMMAND (1024 * 1024)
+
+/* File used when HISTFILE isn't set, relative to HOME */
+#define HISTORY_FILE ".cwsh_history"
+
+/* How many commands print_history() shows */
 #define MAX_HISTORY 10
 
+/* Open and map the history file. */
+void init_history();
+
 /* Add a command to the history. */
 void add_to_history(char *command);
 
-/* Print the history. */
+/* Print the last MAX_HISTORY commands. It maps and allocates,
+ * so it isn't safe in a signal handler.
+ */
 void print_history(int status);
 
 /* Get the command at the given index. */
 char *fetch_command(char *tokens[], int token_count);
 
-/* Free the history. */
-void free_history(history_info *hinfo);
+/* Number of commands in the history. */
+size_t history_count();
+
+/* Command at index (0 is the oldest) or NULL if its record is
+ * damaged. It points into the mapped file and is only valid
+ * until the history is added to.
+ */
+const char *history_entry(size_t index, size_t *len);
+
+/* What a history search matches the query against */
+typedef enum {
+    HISTORY_PREFIX,    /* start of the command */
+    HISTORY_SUBSTRING  /* anywhere in the command */
+} history_search_mode;
+
+/* Index of the most recent command older than index before that
+ * matches the query, or -1. Uses an index built on first use.
+ */
+long search_history(const char *query, size_t len, history_search_mode mode, size_t before);
+
+/* State of an incremental reverse search (like Ctrl-R in bash).
+ * Typing keeps the current match while it still matches and
+ * asking for the next match walks further back.
+ */
+typedef struct {
+    char *query;
+    size_t len;
+    size_t capacity;
+    long match;     /* index of the current match, -1 if none */
+    char failed;    /* the query stopped matching anything */
+} reverse_search;
+
+/* Start a search with an empty query. */
+void start_reverse_search(reverse_search *rs);
+
+/* Add bytes to the query. Returns the match or -1. */
+long reverse_search_add(reverse_search *rs, const char *text, size_t len);
+
+/* Remove the last byte of the query. Returns the match or -1. */
+long reverse_search_delete(reverse_search *rs);
+
+/* Move to the next older match. Returns it or -1 (keeping the
+ * current one) if there is none.
+ */
+long reverse_search_next(reverse_search *rs);
+
+/* Free the search state. */
+void end_reverse_search(reverse_search *rs);
 
 #endif /* _HISTORY_H */
@@ -1,19 +1,70 @@
 #ifndef _IO_H
 #define _IO_H
 
+#include <limits.h>
+#include <stddef.h>
+#include <sys/types.h>
+
 #define PROMPT_STRING "sh> "
 
-/* Don't want anything in here for now, but
- * could add some stuff later like username,
- * hostname, etc.
+/* Bytes read from the input at a time. Terminals hand back a line
+ * per read() anyway, scripts get through in big chunks.
  */
+#define READ_SIZE 65536
+
+/* What the prompt segments are worked out from */
 typedef struct {
-    
+    char cwd[PATH_MAX];
+    int last_status;    /* exit status of the last foreground job */
+    int job_count;      /* background and stopped jobs */
 } prompt_info;
 
-/* Could make this more complex, so using a function
- * to get the prompt string.
+/* The prompt for pinfo, see prompt.h. NULL gives the prompt
+ * last built, for redrawing it after printing something.
  */
 char *get_prompt_string(prompt_info *pinfo);
 
+/* Buffered reader that splits input into lines no matter how
+ * the lines arrive, several in one read() or one across many.
+ */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t capacity;
+    size_t start;       /* first byte not handed out yet */
+    size_t scanned;     /* bytes after start known to have no newline */
+    size_t end;         /* bytes in buf */
+    char eof;
+    char seekable;      /* fd is a file we can seek back in */
+    off_t synced;       /* offset we seeked back to, -1 if we didn't */
+} line_reader;
+
+/* Read lines from fd. */
+void init_line_reader(line_reader *r, int fd);
+
+/* Free the reader's buffer. The fd is left open. */
+void free_line_reader(line_reader *r);
+
+/* Get the next line without its newline, NUL terminated. It
+ * lives in the reader's buffer (so it can be modified) until the
+ * next call. Returns 1 if there was a line, 0 at end of input.
+ */
+int read_line(line_reader *r, char **line, size_t *len);
+
+/* True if a whole line is already buffered, so read_line() won't
+ * block and the fd may not become readable again for it.
+ */
+int line_buffered(line_reader *r);
+
+/* Seek the fd back to the first unread byte so commands sharing
+ * it (like "cat" in "shell < script") see the rest of the input
+ * and not wherever our read-ahead got to. Only works on files.
+ */
+void sync_line_reader(line_reader *r);
+
+/* Undo sync_line_reader() after the commands ran. If they read
+ * from the fd we carry on from where they left off.
+ */
+void resume_line_reader(line_reader *r);
+
 #endif /* _IO_H */
@@ -1,19 +1,94 @@
 #ifndef _JOB_H
 #define _JOB_H
 
+#include <sys/resource.h>
+#include <time.h>
 #include <unistd.h>
+#include "arena.h"
+
+struct placement;
+
+/* Kinds of redirection */
+typedef enum {
+  REDIRECT_IN,                /* n<file */
+  REDIRECT_OUT,               /* n>file */
+  REDIRECT_APPEND,            /* n>>file */
+  REDIRECT_DUP                /* n<&m or n>&m */
+} redirect_type;
+
+/* A redirection, applied in the child in the order written */
+typedef struct {
+  redirect_type type;
+  int fd;                     /* fd being redirected */
+  const char *file;           /* file to open, NULL for REDIRECT_DUP */
+  int target;                 /* fd copied for REDIRECT_DUP */
+} redirection;
 
 /* A process is a single process. */
 typedef struct process {
   struct process *next;       /* next process in pipeline */
   char **argv;                /* for exec */
+  const char *path;           /* cached location of argv[0], NULL to search PATH */
+  int (*builtin)(int, char **); /* run this instead of exec if not NULL */
   pid_t pid;                  /* process ID */
+  pid_t pgid;                 /* process group to join, 0 to lead a new one */
+  int infile;                 /* fd to use as stdin, -1 to inherit */
+  int outfile;                /* fd to use as stdout, -1 to inherit */
+  redirection *redirects;     /* applied after infile and outfile */
+  int redirect_count;
+  char **assignments;         /* "name=value" words before the command */
+  int assignment_count;
+  char **envp;                /* environment with them, NULL for the shell's */
+  const struct placement *placement; /* CPUs, nice and limits, NULL for none */
   char completed;             /* true if process has completed */
   char stopped;               /* true if process has stopped */
   int status;                 /* reported status value */
   char foreground;            /* Is process in foreground */
+  struct timespec spawn_time; /* before spawning it, CLOCK_MONOTONIC */
+  struct timespec exec_time;  /* spawn returned (after exec except with fork) */
+  struct timespec exit_time;  /* reaped */
+  struct rusage usage;        /* from wait4() once completed */
 } process;
 
+/* A job is a pipeline of processes sharing a process group. */
+typedef struct job {
+  process *first_process;     /* list of processes in this job */
+  pid_t pgid;                 /* process group ID */
+  int id;                     /* job number for %n, 0 if not in a job table */
+  size_t slot;                /* index in the job table's array */
+  char foreground;            /* Is job in foreground */
+  char timed;                 /* print its usage when done ("time cmd") */
+  struct placement *placement; /* where "place" put it, NULL if nowhere */
+  arena *arena;               /* memory for the job and its processes */
+} job;
+
+/* Maps the pid of a process to it and its job */
+typedef struct {
+  pid_t pid;                  /* 0 if the entry is empty */
+  process *process;
+  job *job;
+} pid_entry;
+
+/* Table of the jobs the shell is keeping track of. Inserting,
+ * finding (by pid or job number) and removing a job are all O(1).
+ * Jobs are kept in a dense array so walking them touches one
+ * contiguous block of memory, ids index a second array and pids
+ * are found with an open addressing hash table.
+ */
+typedef struct {
+  job **jobs;                 /* the jobs, job_count of them */
+  size_t job_count;
+  size_t jobs_capacity;
+  job **by_id;                /* by_id[id - 1], NULL if the id is free */
+  size_t id_capacity;
+  int *free_ids;              /* ids to hand out again, most recent last */
+  size_t free_count;
+  size_t free_capacity;
+  pid_entry *pids;            /* capacity is a power of two */
+  size_t pid_count;
+  size_t pid_capacity;
+} job_table;
+
 /* Init process to default state */
 process *init_process(process *p);
 
@@ -26,9 +101,41 @@ process *remove_process(process **head, pid_t pid);
 /* Find the process with the indicated pid. */
 process *find_process(process *head, pid_t pid);
 
-/* Free the memory associated with a process.
- * But not the pointer to the process itself
+/* Init job to default state */
+job *init_job(job *j);
+
+/* Init an empty job table */
+void init_job_table(job_table *t);
+
+/* Add a launched job to the table and give it a job number.
+ * The job keeps its number until it is removed.
+ */
+job *insert_job(job_table *t, job *j);
+
+/* Remove the job from the table. */
+void delete_job(job_table *t, job *j);
+
+/* Find the job with the job number id (%id). */
+job *find_job(job_table *t, int id);
+
+/* Find the job and process with the indicated pid. */
+job *find_job_by_pid(job_table *t, pid_t pid, process **p);
+
+/* True if every process in the job has completed. */
+int job_is_completed(job *j);
+
+/* True if every process in the job has stopped or completed. */
+int job_is_stopped(job *j);
+
+/* Name used for the job in messages. */
+char *job_name(job *j);
+
+/* Status of the last process in the pipeline. */
+int job_status(job *j);
+
+/* Release the job's hold on the arena it and its processes
+ * were allocated from. The job can't be used afterwards.
  */
-void free_process(process *p);
+void free_job(job *j);
 
 #endif /* _JOB_H */
@@ -0,0 +1,76 @@
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sys/types.h>
+#include <termios.h>
+#include "job.h"
+
+/* Shell state needed to start processes. init_shell()
+ * fills these in.
+ */
+extern pid_t shell_pgid;
+extern struct termios shell_tmodes;
+extern int shell_terminal; /* File descriptor for the terminal */
+extern int shell_is_interactive;
+
+/* Ways of creating a child process. fork() copies the shell's
+ * page tables so it gets slower as the shell grows, the other
+ * two share the shell's memory until the child calls exec.
+ */
+typedef enum {
+    SPAWN_FORK,        /* fork() then exec */
+    SPAWN_VFORK,       /* clone(CLONE_VM | CLONE_VFORK) then exec */
+    SPAWN_POSIX_SPAWN, /* posix_spawnp() */
+    SPAWN_SERVER       /* ask the spawn server (spawnserver.h) */
+} spawn_backend;
+
+/* Select the backend by name ("fork", "vfork", "posix_spawn" or
+ * "server"). Returns -1 if the name is unknown or the spawn
+ * server couldn't be started.
+ */
+int set_spawn_backend(const char *name);
+
+/* Name of the backend in use. */
+const char *get_spawn_backend();
+
+/* Set the capacity in bytes of the pipes connecting processes
+ * in a pipeline with F_SETPIPE_SZ. 0 keeps the kernel default.
+ */
+int set_pipe_size(int size);
+
+/* An fd replaced by a redirection and the copy kept to put it
+ * back, for builtins run in the shell.
+ */
+typedef struct {
+    int copy;   /* -1 if the fd wasn't open */
+    int flags;  /* its FD_CLOEXEC flag */
+} saved_fd;
+
+/* Open p's redirections and put them in place, in order. If
+ * saved isn't NULL (room for p->redirect_count) the fds replaced
+ * are kept there for restore_redirections(). Returns -1 after
+ * printing an error, with everything put back.
+ */
+int apply_redirections(process *p, saved_fd *saved);
+
+/* Put back the fds apply_redirections() replaced. */
+void restore_redirections(process *p, saved_fd *saved);
+
+/* Start p in the process group p->pgid (its own if 0) with the
+ * selected backend and return its pid. Returns -1 if the process
+ * could not be created.
+ */
+pid_t spawn_process(process *p);
+
+/* Executes the process by replacing the current process
+ * with the process to be executed, or runs it if it's a
+ * builtin. Child calls this function.
+ */
+void execute_process(process *p);
+
+/* Start every process in the job connected with pipes and
+ * in a single process group. Returns how many were started.
+ */
+int launch_job(job *j);
+
+#endif /* _LAUNCH_H */
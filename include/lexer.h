@@ -0,0 +1,67 @@
+#ifndef _LEXER_H
+#define _LEXER_H
+
+#include <stddef.h>
+
+/* Kinds of tokens the lexer produces */
+typedef enum {
+    TOKEN_WORD,      /* command name or argument */
+    TOKEN_PIPE,      /* | */
+    TOKEN_AMP,       /* & */
+    TOKEN_SEMI,      /* ; */
+    TOKEN_LESS,      /* < */
+    TOKEN_GREAT,     /* > */
+    TOKEN_DGREAT,    /* >> */
+    TOKEN_LESSAND,   /* <& */
+    TOKEN_GREATAND   /* >& */
+} token_type;
+
+/* A token is a slice of the input line. Quotes and escapes are
+ * removed in place, so a word's bytes are always contiguous in
+ * the line but the line is not NUL terminated between tokens.
+ */
+typedef struct {
+    token_type type;
+    char *start;     /* first byte in the input line */
+    size_t len;      /* bytes in the token */
+    int fd;          /* fd before a redirection (2>), -1 if none */
+    char expand;     /* word has a VAR_MARK */
+    char glob;       /* word has GLOB_ marks */
+} token;
+
+/* Put in place of a $ that starts an expansion ($name, ${name},
+ * $1, $?, ...), so the ones that were quoted or escaped stay
+ * plain $. The word is expanded when it is copied out of the line.
+ */
+#define VAR_MARK '\001'
+
+/* Put in place of unquoted *, ? and [ the same way. The word is
+ * matched against file names when it becomes arguments, anywhere
+ * else it gets its characters back when it is copied out.
+ */
+#define GLOB_STAR '\002'
+#define GLOB_ANY '\003'
+#define GLOB_CLASS '\004'
+
+/* Growable array of tokens. Reuse one between lines so it
+ * stops allocating once it is big enough.
+ */
+typedef struct {
+    token *tokens;
+    size_t count;
+    size_t capacity;
+} token_list;
+
+/* Split len bytes of line into tokens in one pass. The line is
+ * modified (quotes removed). Returns 0 on success or -1 with
+ * a message in *error on bad input like an unclosed quote.
+ */
+int lex_line(char *line, size_t len, token_list *tl, const char **error);
+
+/* True if the token is a word equal to s. */
+int token_is(const token *t, const char *s);
+
+/* Free the memory held by the token list. */
+void free_token_list(token_list *tl);
+
+#endif /* _LEXER_H */
@@ -0,0 +1,42 @@
+#ifndef _NOTIFY_H
+#define _NOTIFY_H
+
+#include <stddef.h>
+#include "job.h"
+
+/* Job status notices are collected here instead of being printed
+ * one at a time. Everything that piles up during one wakeup goes
+ * out in a single write() with at most one prompt redraw, and
+ * batches are at least NOTICE_INTERVAL_MS apart so a burst of
+ * jobs finishing doesn't flood the terminal.
+ */
+
+/* Least time between two batches of notices */
+#define NOTICE_INTERVAL_MS 100
+
+/* Batches with more notices than this are summarized in one line
+ * like "37 jobs finished, 2 failed".
+ */
+#define NOTICE_DETAIL_LIMIT 8
+
+/* Write how a job ended (or that it stopped) into buf, like
+ * "sleep [1234] exited with status 0", with a newline.
+ */
+void format_job_status(job *j, char *buf, size_t size);
+
+/* Queue a notice for a background job that finished or stopped. */
+void queue_job_notice(job *j);
+
+/* Milliseconds until the queued notices are due, 0 if they are
+ * due now and -1 if there are none.
+ */
+int notice_delay();
+
+/* Write the queued notices if they are due, or anyway if force
+ * is set. With a prompt they are written below the prompt already
+ * on the screen and the prompt is drawn again after them. Returns
+ * 1 if anything was written.
+ */
+int flush_notices(int force, const char *prompt);
+
+#endif /* _NOTIFY_H */
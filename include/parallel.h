@@ -0,0 +1,18 @@
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+/* Runs a command once per line of input with a limited number
+ * of copies running at once, like "xargs -P" or GNU parallel.
+ * A new copy starts as soon as one exits, the shell sleeps on
+ * SIGCHLD in between instead of polling.
+ */
+
+/* "parallel [-j jobs] [-a file] command [args]". Each line of
+ * file (stdin without -a) replaces "{}" in the args, or is added
+ * as the last arg if there is no "{}". Prints a summary to stderr
+ * and returns the number of failed commands (at most 101), or
+ * 130 if Ctrl-C stopped it.
+ */
+int run_parallel(int argc, char **argv);
+
+#endif /* _PARALLEL_H */
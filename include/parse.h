@@ -0,0 +1,42 @@
+#ifndef _PARSE_H
+#define _PARSE_H
+
+#include "arena.h"
+#include "job.h"
+#include "lexer.h"
+
+/* The jobs parsed from one command line. They are all allocated
+ * from the arena, each job holds a reference to it.
+ */
+typedef struct {
+    arena *arena;
+    job **jobs;
+    int job_count;
+} command_line;
+
+/* Build jobs from the tokens. "|" connects processes into a
+ * pipeline, "&" ends a background job and ";" ends a foreground
+ * one. Redirections can go anywhere among a command's words,
+ * "name=value" words in front of it are assignments, words are
+ * expanded as they are copied out of the line and patterns among
+ * the arguments become the file names they match. Returns 0 on
+ * success or -1 after printing a syntax error. On success
+ * release_command_line() must be called once the caller is done
+ * with the jobs it didn't keep.
+ */
+int parse_command_line(token_list *tl, command_line *cl);
+
+/* Parse the tokens only to check them, without looking for file
+ * names. Returns -1 after printing a syntax error.
+ */
+int check_command_line(token_list *tl);
+
+/* Drop the command line's own hold on its arena. */
+void release_command_line(command_line *cl);
+
+/* Free every job in the command line and the arena, for
+ * lines that are handled without launching anything.
+ */
+void free_command_line(command_line *cl);
+
+#endif /* _PARSE_H */
@@ -0,0 +1,31 @@
+#ifndef _PATHCACHE_H
+#define _PATHCACHE_H
+
+/* Hash table remembering where commands were found in PATH,
+ * like bash's hash builtin. Saves walking every PATH directory
+ * with failing execve() calls on every launch.
+ */
+
+/* Entry in the command hash table */
+typedef struct {
+    char *name;         /* command name as typed */
+    char *path;         /* absolute path it was found at */
+    unsigned long hits; /* times the entry was used */
+} command_location;
+
+/* Find the absolute path for the command name. Returns NULL if
+ * the name contains a '/' (it is used as is) or wasn't found.
+ * The returned string is owned by the cache.
+ */
+const char *lookup_command(const char *name);
+
+/* Drop a single command from the cache. */
+void forget_command(const char *name);
+
+/* Drop every cached command. */
+void clear_command_cache();
+
+/* Print the cached commands like "hash" does. */
+void print_command_cache();
+
+#endif /* _PATHCACHE_H */
@@ -0,0 +1,48 @@
+#ifndef _PATHGLOB_H
+#define _PATHGLOB_H
+
+#include <stddef.h>
+
+/* Pathname expansion of words with GLOB_ marks from the lexer:
+ * *, ?, [...] and ** on its own for any number of directories.
+ * Each path component of a pattern is compiled once into runs of
+ * byte sets split at the stars, and a name is matched by finding
+ * each run leftmost after the one before, so nothing backtracks.
+ * Directories are read with getdents64() and their listings are
+ * kept for the rest of the command line. A listing is used again
+ * as long as its directory's mtime hasn't changed.
+ */
+
+/* Bytes of directory entries asked for per getdents64() */
+#define GLOB_GETDENTS_SIZE (256 * 1024)
+
+/* Paths that matched, back to back in one buffer */
+typedef struct {
+    char *text;             /* NUL terminated paths */
+    size_t text_len;
+    size_t text_capacity;
+    size_t *offsets;        /* where each path starts in text */
+    size_t count;
+    size_t capacity;
+} glob_list;
+
+/* Path i of a list */
+#define glob_path(l, i) ((l)->text + (l)->offsets[i])
+
+/* Add the paths matching the len bytes at pattern (with its
+ * variables expanded, see expand_pattern()), sorted. Returns how
+ * many were added, 0 if nothing matched or the marks turned out
+ * not to make a pattern (a lone "[").
+ */
+size_t glob_word(const char *pattern, size_t len, glob_list *list);
+
+/* Empty the list, keeping its memory. */
+void clear_glob_list(glob_list *list);
+
+/* Free the memory held by the list. */
+void free_glob_list(glob_list *list);
+
+/* Forget the directory listings, at the start of a command line. */
+void clear_directory_cache();
+
+#endif /* _PATHGLOB_H */
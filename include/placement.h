@@ -0,0 +1,51 @@
+#ifndef _PLACEMENT_H
+#define _PLACEMENT_H
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Where background jobs run. Without a policy they go wherever
+ * the kernel puts them. "place" can pin each new background job
+ * to the next CPU or NUMA node round-robin, or every job to a
+ * fixed set of CPUs, and start them niced or with resource limits.
+ * Foreground jobs are never placed.
+ */
+
+#define MAX_PLACEMENT_RLIMITS 4
+
+/* Most NUMA nodes looked at */
+#define MAX_NUMA_NODES 64
+
+/* What one job gets */
+typedef struct placement {
+    char pinned;                /* cpus is set */
+    cpu_set_t cpus;
+    char reniced;               /* nice is set */
+    int nice;
+    int rlimit_count;
+    struct {
+        int resource;
+        rlim_t value;
+    } rlimits[MAX_PLACEMENT_RLIMITS];
+    char label[96];             /* "cpu 3, nice 10" for status lines */
+} placement;
+
+/* "place [-n nice] [-l name=value] [off|cpu|node|cpu list]".
+ * Without arguments it prints the policy.
+ */
+int run_place(int argc, char **argv);
+
+/* Fill in the placement for the next background job by the
+ * policy, moving round-robin policies on. Returns 0 if there is
+ * no policy.
+ */
+int next_placement(placement *pl);
+
+/* Apply pl to the process pid, 0 for the calling process (a
+ * child before exec). Only uses system calls, so it is safe in a
+ * child sharing the shell's memory.
+ */
+void apply_placement(const placement *pl, pid_t pid);
+
+#endif /* _PLACEMENT_H */
@@ -0,0 +1,70 @@
+#ifndef _PROMPT_H
+#define _PROMPT_H
+
+#include <stddef.h>
+#include "io.h"
+
+/* The prompt is an info line made of segments above the "sh> "
+ * line. Cheap segments (cwd, last status, job count) are worked
+ * out every time. Expensive ones (git) run a command in a child
+ * whose output comes back through the event loop, so the prompt
+ * is drawn right away with the cached value and the info line is
+ * redrawn in place once the fresh value arrives. Cached values
+ * are refreshed when the directory changes, inotify says
+ * something in it or its git directory changed or a foreground
+ * command finished.
+ */
+
+/* Segments shown when CWSH_PROMPT isn't set. CWSH_PROMPT is a
+ * comma separated list of segment names, empty for just "sh> ".
+ */
+#define DEFAULT_PROMPT_SEGMENTS "cwd,git,status,jobs"
+
+/* Longest value a segment can have */
+#define SEGMENT_SIZE 256
+
+/* A kind of segment */
+typedef struct {
+    const char *name;
+    /* Cheap segments write their value for info into buf */
+    void (*render)(const prompt_info *info, char *buf, size_t size);
+    /* Expensive segments run argv with the environment variables
+     * in env set, in the directory the value is for, and turn its
+     * output into the value.
+     */
+    char *const *argv;
+    const char *const *env;
+    void (*parse)(char *output, size_t len, char *buf, size_t size);
+    /* Directory the cached value belongs to, so a cd elsewhere in
+     * the same repository keeps it. NULL if there is nothing to
+     * run for cwd.
+     */
+    const char *(*key)(const char *cwd, char *buf, size_t size);
+} segment_type;
+
+/* Read CWSH_PROMPT and set up inotify. */
+void init_prompt();
+
+/* Build the prompt for info, starting refreshes of stale
+ * expensive segments. NULL gives the last prompt built.
+ */
+char *render_prompt(const prompt_info *info);
+
+/* Work the expensive segments out again with the next prompt.
+ * Called after a foreground command, it may have changed files
+ * deeper in the tree than inotify watches.
+ */
+void mark_prompt_stale();
+
+/* Handle output from segment commands and inotify events.
+ * Returns 1 if the prompt on screen is out of date.
+ */
+int prompt_events();
+
+/* Redraw the info line in place, leaving the cursor (and
+ * anything typed after "sh> ") where it is. rows is how far the
+ * cursor is below the "sh> " line when the input wraps.
+ */
+void redraw_prompt_info(int rows);
+
+#endif /* _PROMPT_H */
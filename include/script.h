@@ -0,0 +1,60 @@
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+#include "job.h"
+#include "lexer.h"
+
+/* Control flow: if/elif/else, while/until, for ... in, { }
+ * groups and functions. Lines using them are compiled once into
+ * a small instruction list, so a loop body is lexed and checked
+ * a single time however often it runs. Plain builtins in a body
+ * run straight from an argv built at compile time, other commands
+ * only go through the parser each time they run. A construct that
+ * isn't finished on one line keeps reading lines, with ";" in
+ * place of each line break.
+ */
+
+/* How deep functions may call each other */
+#define MAX_FUNCTION_DEPTH 1000
+
+typedef struct program program;
+
+/* Give the interpreter the function that runs parsed jobs, the
+ * shell's own launch_jobs().
+ */
+void init_interpreter(void (*launch)(job **jobs, int job_count));
+
+/* True if the tokens have to go through the compiler: a word in
+ * command position is a keyword or defines a function, a command
+ * after the first has variables or patterns to expand, or an
+ * earlier line left a construct open.
+ */
+int needs_compiler(const token_list *tl);
+
+/* True while a construct from earlier lines is still open. */
+int compile_pending();
+
+/* Add a line's tokens to what earlier lines left open and compile
+ * it all. Returns the program once every construct is closed, or
+ * NULL if more lines are needed or after printing a syntax error
+ * (compile_pending() tells which). The tokens are copied.
+ */
+program *compile_line(const token_list *tl);
+
+/* Run a program and free it, unless it defined functions that
+ * still point into it. Sets last_status.
+ */
+void run_program(program *p);
+
+/* True if name is a function. */
+int is_function(const char *name);
+
+/* Run the function argv[0] and set last_status. */
+void call_function(char **argv);
+
+/* Stop running programs at the next command, for Ctrl-C. Safe
+ * in a signal handler.
+ */
+void interrupt_programs();
+
+#endif /* _SCRIPT_H */
@@ -0,0 +1,41 @@
+#ifndef _SPAWNSERVER_H
+#define _SPAWNSERVER_H
+
+#include <sys/types.h>
+#include "job.h"
+
+/* A helper process that starts commands for the shell. It is a
+ * fresh exec of the shell binary, so its address space is a few
+ * pages no matter how big the shell has grown, and it has its
+ * signals set up once instead of per child. The shell sends it
+ * each launch (argv, environment, cwd, redirections, placement)
+ * over a Unix socket with the process's fds passed as SCM_RIGHTS.
+ * It clones the child with CLONE_PARENT, so the child is still
+ * the shell's own child to wait for and control, and answers with
+ * the pid once the child has exec'd.
+ */
+
+/* argv[0] the helper is exec'd with, main() checks for it */
+#define SPAWN_SERVER_NAME "cwsh-spawn-server"
+
+/* Largest request, argv and environment included */
+#define SPAWN_REQUEST_MAX (256 * 1024)
+
+/* Start the helper. Returns -1 if it couldn't be. */
+int start_spawn_server();
+
+/* True while the helper is there to take requests. */
+int spawn_server_running();
+
+/* Have the helper start p. Returns the pid, or -1 if it couldn't
+ * (after saying why). If the helper is gone it is stopped for
+ * good and spawn_server_running() says so.
+ */
+pid_t spawn_with_server(process *p);
+
+/* main() of the helper, argv is what it was exec'd with. Never
+ * returns, it exits once the shell closes the socket.
+ */
+void run_spawn_server(char **argv);
+
+#endif /* _SPAWNSERVER_H */
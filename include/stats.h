@@ -0,0 +1,81 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Counters for what the shell has been doing, for when it feels
+ * slow. Updating one is a plain increment so they are always on.
+ * "shellstats" prints them.
+ */
+typedef struct {
+    unsigned long lines;            /* command lines read */
+    unsigned long parses;           /* lines lexed and parsed */
+    uint64_t parse_ns;              /* time spent lexing and parsing */
+    uint64_t parse_max_ns;
+    unsigned long forks;            /* children created */
+    unsigned long execs;            /* children that exec a program */
+    unsigned long spawn_failures;   /* children that couldn't be created */
+    unsigned long builtins;         /* builtins run in the shell */
+    unsigned long reaped;           /* children waited for */
+    uint64_t reap_ns;               /* spawn to reap, added up */
+    uint64_t reap_max_ns;
+    unsigned long history_adds;
+    unsigned long history_fetches;  /* "r" commands */
+    unsigned long history_searches; /* index searches */
+    unsigned long globs;            /* words expanded as patterns */
+    unsigned long glob_dir_reads;   /* directories listed for them */
+    unsigned long glob_cache_hits;  /* listings used again */
+    unsigned long jobs_inserted;    /* jobs put in the job table */
+    unsigned long jobs_deleted;
+    unsigned long jobs_peak;        /* most jobs in the table at once */
+} shell_stats;
+
+extern shell_stats stats;
+
+#define STAT_INC(counter) (stats.counter++)
+
+/* Add ns to a total and keep the largest single value */
+#define STAT_TIME(counter, ns) do {                 \
+        uint64_t stat_ns_ = (ns);                   \
+        stats.counter##_ns += stat_ns_;             \
+        if (stat_ns_ > stats.counter##_max_ns)      \
+            stats.counter##_max_ns = stat_ns_;      \
+    } while (0)
+
+/* Monotonic time in nanoseconds. */
+uint64_t now_ns();
+
+/* A timespec from clock_now() in nanoseconds. */
+uint64_t timespec_ns(const struct timespec *t);
+
+/* Print every counter. */
+void print_stats(FILE *f);
+
+/* Trace events are written to this fd, -1 when tracing is off */
+extern int trace_fd;
+
+/* Write trace events to path in the Chrome trace event format,
+ * which chrome://tracing, Perfetto and speedscope load. Returns -1
+ * if the file can't be opened.
+ */
+int open_trace(const char *path);
+
+/* Record a phase of a command's life (read, parse, spawn, wait,
+ * report) that ran from start to end. detail is shown with it,
+ * track groups events on one row (0 for the shell itself).
+ * Nothing is done when tracing is off.
+ */
+#define TRACE(name, detail, start, end, track) do {                 \
+        if (trace_fd >= 0)                                          \
+            trace_event((name), (detail), (start), (end), (track)); \
+    } while (0)
+
+void trace_event(const char *name, const char *detail, uint64_t start,
+        uint64_t end, int track);
+
+/* Write out buffered trace events now. */
+void flush_trace();
+
+#endif /* _STATS_H */
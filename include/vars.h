@@ -0,0 +1,82 @@
+#ifndef _VARS_H
+#define _VARS_H
+
+#include <stddef.h>
+#include "arena.h"
+
+/* Shell variables, in an open addressing hash table. Exported
+ * ones are also in the environment array, which is environ itself,
+ * so getenv() and every spawn backend see them with nothing to
+ * build. Each variable is one "name=value" string that goes into
+ * that array as it is. Changing an exported value swaps one
+ * pointer, exporting appends one and unsetting moves the last
+ * entry into the hole. The array is never serialized again from
+ * the table.
+ */
+
+/* Import the environment the shell started with, every variable
+ * exported. name is $0.
+ */
+void init_variables(char **envp, const char *name);
+
+/* The value of name or NULL if it isn't set. Good until the
+ * variable is set again.
+ */
+const char *get_var(const char *name);
+
+/* Set name to value. export 1 exports it, 0 leaves it as it was. */
+void set_var(const char *name, const char *value, int export);
+
+/* Set a "name=value" word, see is_assignment(). */
+void set_assignment(const char *assignment, int export);
+
+/* Export name, creating it empty if it isn't set. */
+void export_var(const char *name);
+
+/* Forget name. */
+void unset_var(const char *name);
+
+/* True if the len bytes at s are "name=..." with a valid name. */
+int is_assignment(const char *s, size_t len);
+
+/* True if s is a valid variable name. */
+int is_name(const char *s);
+
+/* Print every exported variable as "export name='value'", sorted. */
+void print_exports();
+
+/* The environment plus count "name=value" assignments, for a
+ * command run with them in front of it. Allocated from a.
+ */
+char **environment_with(arena *a, char **assignments, int count);
+
+/* Bytes the len bytes at s (a word with marks from the lexer)
+ * take with their expansions done, not counting the NUL. A
+ * variable's value is put in as it is, it isn't split into words.
+ */
+size_t expanded_length(const char *s, size_t len);
+
+/* Write the expanded word to out, which has room for
+ * expanded_length() + 1 bytes, and NUL terminate it. GLOB_ marks
+ * turn back into *, ? and [.
+ */
+char *expand_into(const char *s, size_t len, char *out);
+
+/* expand_into() keeping the GLOB_ marks, for a pattern. */
+char *expand_pattern(const char *s, size_t len, char *out);
+
+/* Expanded copy of the word in the arena. */
+char *arena_expand(arena *a, const char *s, size_t len);
+
+/* $1, $2 and so on */
+typedef struct positional positional;
+
+/* Make the NULL terminated args $1 onwards (they are copied) and
+ * return the old ones for restore_positional().
+ */
+positional *set_positional(char **args);
+
+/* Put back what set_positional() returned. */
+void restore_positional(positional *old);
+
+#endif /* _VARS_H */
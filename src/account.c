@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+#include "account.h"
+#include "stats.h"
+
+/* Fork to exit latencies of every process reaped this session */
+static unsigned long latency_counts[LATENCY_BUCKETS];
+static unsigned long latency_total = 0;
+static double latency_sum = 0;
+
+/* Monotonic time now */
+void clock_now(struct timespec *t) {
+    clock_gettime(CLOCK_MONOTONIC, t);
+}
+
+/* Seconds from from to to */
+double elapsed_seconds(const struct timespec *from, const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+static double timeval_seconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Bucket for a latency, the position of its highest bit */
+static int latency_bucket(double seconds) {
+    unsigned long long us = seconds * 1e6;
+    int bucket = 0;
+    while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/* Stamp p's exit and keep its usage */
+void account_exit(process *p, const struct rusage *usage) {
+    clock_now(&p->exit_time);
+    p->usage = *usage;
+    if (p->spawn_time.tv_sec == 0 && p->spawn_time.tv_nsec == 0)
+        return; /* Never went through spawn_process() */
+    double latency = elapsed_seconds(&p->spawn_time, &p->exit_time);
+    STAT_INC(reaped);
+    STAT_TIME(reap, timespec_ns(&p->exit_time) - timespec_ns(&p->spawn_time));
+    latency_counts[latency_bucket(latency)]++;
+    latency_total++;
+    latency_sum += latency;
+}
+
+/* Stamp a builtin's exit, its usage is what the shell used
+ * while it ran. It isn't a fork so it stays out of the histogram.
+ */
+void account_builtin(process *p, const struct rusage *before) {
+    struct rusage after;
+
+    getrusage(RUSAGE_SELF, &after);
+    clock_now(&p->exit_time);
+    p->exec_time = p->spawn_time;
+    p->usage = after;
+    timersub(&after.ru_utime, &before->ru_utime, &p->usage.ru_utime);
+    timersub(&after.ru_stime, &before->ru_stime, &p->usage.ru_stime);
+    p->usage.ru_nvcsw -= before->ru_nvcsw;
+    p->usage.ru_nivcsw -= before->ru_nivcsw;
+}
+
+/* Add up what the job's processes used. Real time runs from the
+ * first spawn to the last exit since they all run at once.
+ */
+void get_job_usage(job *j, job_usage *u) {
+    const struct timespec *first = NULL, *last = NULL;
+
+    memset(u, 0, sizeof(*u));
+    for (process *p = j->first_process; p; p = p->next) {
+        if (p->exit_time.tv_sec == 0 && p->exit_time.tv_nsec == 0)
+            continue; /* Never started or still running */
+        if (first == NULL || elapsed_seconds(&p->spawn_time, first) > 0)
+            first = &p->spawn_time;
+        if (last == NULL || elapsed_seconds(last, &p->exit_time) > 0)
+            last = &p->exit_time;
+        u->user += timeval_seconds(&p->usage.ru_utime);
+        u->sys += timeval_seconds(&p->usage.ru_stime);
+        if (p->usage.ru_maxrss > u->maxrss)
+            u->maxrss = p->usage.ru_maxrss;
+        u->nvcsw += p->usage.ru_nvcsw;
+        u->nivcsw += p->usage.ru_nivcsw;
+    }
+    if (first != NULL)
+        u->real = elapsed_seconds(first, last);
+}
+
+/* Write u as "real 1.002s user 0.001s sys 0.000s maxrss 1984K ctx 2/0" */
+void format_usage(const job_usage *u, char *buf, size_t size) {
+    snprintf(buf, size, "real %.3fs user %.3fs sys %.3fs maxrss %ldK ctx %ld/%ld",
+            u->real, u->user, u->sys, u->maxrss, u->nvcsw, u->nivcsw);
+}
+
+/* Print the session totals and the latency histogram */
+void print_session_usage(FILE *f) {
+    struct rusage self, children;
+
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+    fprintf(f, "shell     user %.3fs sys %.3fs maxrss %ldK\n",
+            timeval_seconds(&self.ru_utime), timeval_seconds(&self.ru_stime),
+            self.ru_maxrss);
+    fprintf(f, "children  user %.3fs sys %.3fs maxrss %ldK\n",
+            timeval_seconds(&children.ru_utime), timeval_seconds(&children.ru_stime),
+            children.ru_maxrss);
+    if (latency_total == 0)
+        return;
+
+    fprintf(f, "fork to exit latency, %lu processes, mean %.3f ms\n",
+            latency_total, latency_sum / latency_total * 1e3);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (latency_counts[i] == 0)
+            continue;
+        fprintf(f, "  %10llu - %10llu us  %lu\n", i ? 1ULL << i : 0,
+                (1ULL << (i + 1)) - 1, latency_counts[i]);
+    }
+}
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/* Everything handed out is aligned to this */
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+/* Smallest block we bother allocating when the arena runs out */
+#define MIN_BLOCK_SIZE 1024
+
+static unsigned long malloc_count = 0;
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_block *new_block(size_t size) {
+    arena_block *b = malloc(sizeof(arena_block) + size);
+    if (b == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    malloc_count++;
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+/* The arena header lives at the start of the first block so
+ * creating an arena is one malloc.
+ */
+arena *new_arena(size_t size) {
+    arena_block *b = new_block(align_up(sizeof(arena)) + align_up(size));
+    arena *a = (arena *)b->data;
+    b->used = align_up(sizeof(arena));
+    a->blocks = b;
+    a->refs = 1;
+    return a;
+}
+
+/* Allocate size bytes aligned for any type */
+void *arena_alloc(arena *a, size_t size) {
+    arena_block *b = a->blocks;
+    size = align_up(size);
+    if (b->size - b->used < size) {
+        /* Out of room, only happens if the size guess was wrong */
+        b = new_block(size > MIN_BLOCK_SIZE ? size : MIN_BLOCK_SIZE);
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    void *ptr = b->data + b->used;
+    b->used += size;
+    return ptr;
+}
+
+/* Copy len bytes of s into the arena and NUL terminate it */
+char *arena_strndup(arena *a, const char *s, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Take another reference */
+arena *arena_retain(arena *a) {
+    a->refs++;
+    return a;
+}
+
+/* Drop a reference and free everything once none are left.
+ * The block holding the arena header is the oldest one, so it
+ * is freed last.
+ */
+void arena_release(arena *a) {
+    if (--a->refs > 0)
+        return;
+    arena_block *b = a->blocks, *next;
+    while (b) {
+        next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+/* Number of malloc() calls arenas have made */
+unsigned long arena_malloc_count() {
+    return malloc_count;
+}
@@ -0,0 +1,825 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "builtin.h"
+#include "launch.h"
+#include "pathcache.h"
+#include "parallel.h"
+#include "placement.h"
+#include "account.h"
+#include "stats.h"
+#include "vars.h"
+
+int last_status = 0;
+
+/* Jobs for "jobs" and "kill %n" */
+static job_table *jobs = NULL;
+
+/* Give the builtins the job table */
+void init_builtins(job_table *t) {
+    jobs = t;
+}
+
+/* Print an error. Builtin output sits in stdout's buffer until
+ * something else needs the terminal, flush it first so the two
+ * come out in order.
+ */
+static void builtin_error(const char *fmt, ...) {
+    va_list ap;
+
+    fflush(stdout);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+/* Bytes moved per splice(), copy_file_range() or sendfile() */
+#define COPY_CHUNK (1 << 20)
+
+/* Copy in to out until EOF. The kernel moves the data itself
+ * when it can: splice() when either end is a pipe, copy_file_range()
+ * between files (which can share blocks on some filesystems) and
+ * sendfile() from a file to anything else. When none of them
+ * work for the pair it falls back to read() and write().
+ */
+static int copy_fd(int in, int out) {
+    struct stat in_st, out_st;
+    char buf[65536];
+    ssize_t n;
+
+    if (fstat(in, &in_st) < 0 || fstat(out, &out_st) < 0)
+        return -1;
+    if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode)) {
+        while ((n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE)) > 0)
+            ;
+        if (n == 0)
+            return 0;
+        if (errno != EINVAL)
+            return -1;
+    } else if (S_ISREG(in_st.st_mode)) {
+        if (S_ISREG(out_st.st_mode)) {
+            while ((n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0)) > 0)
+                ;
+            if (n == 0)
+                return 0;
+            if (errno != EXDEV && errno != EINVAL && errno != EBADF &&
+                    errno != ENOSYS && errno != EOPNOTSUPP)
+                return -1;
+        }
+        while ((n = sendfile(out, in, NULL, COPY_CHUNK)) > 0)
+            ;
+        if (n == 0)
+            return 0;
+        if (errno != EINVAL && errno != ENOSYS)
+            return -1;
+    }
+    /* Offsets moved with whatever was copied, carry on from there */
+    while ((n = read(in, buf, sizeof(buf))) > 0) {
+        for (ssize_t done = 0; done < n; ) {
+            ssize_t w = write(out, buf + done, n - done);
+            if (w < 0)
+                return -1;
+            done += w;
+        }
+    }
+    return n < 0 ? -1 : 0;
+}
+
+/* "cat [file...]" copies the files (stdin for none or "-") to
+ * stdout without the data passing through the shell when the
+ * kernel allows it.
+ */
+static int builtin_cat(int argc, char **argv) {
+    int status = 0;
+
+    fflush(stdout);
+    for (int i = 1; i < argc || i == 1; i++) {
+        const char *name = i < argc ? argv[i] : "-";
+        int fd = strcmp(name, "-") == 0 ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            builtin_error("cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (copy_fd(fd, STDOUT_FILENO) < 0) {
+            if (errno == EPIPE) {
+                if (fd != STDIN_FILENO)
+                    close(fd);
+                return 1;
+            }
+            builtin_error("cat: %s: %s\n", name, strerror(errno));
+            status = 1;
+        }
+        if (fd != STDIN_FILENO)
+            close(fd);
+    }
+    return status;
+}
+
+/* "cd [dir]" changes directory, to HOME without a dir and to
+ * OLDPWD with "-". PWD and OLDPWD are kept up to date for the
+ * commands we run.
+ */
+static int builtin_cd(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : get_var("HOME");
+    char cwd[PATH_MAX];
+
+    if (dir == NULL) {
+        builtin_error("cd: HOME not set\n");
+        return 1;
+    }
+    if (strcmp(dir, "-") == 0) {
+        dir = get_var("OLDPWD");
+        if (dir == NULL) {
+            builtin_error("cd: OLDPWD not set\n");
+            return 1;
+        }
+        printf("%s\n", dir);
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        cwd[0] = '\0';
+    if (chdir(dir) < 0) {
+        builtin_error("cd: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    if (cwd[0] != '\0')
+        set_var("OLDPWD", cwd, 1);
+    if (getcwd(cwd, sizeof(cwd)) != NULL)
+        set_var("PWD", cwd, 1);
+    return 0;
+}
+
+/* "echo [-n] args" */
+static int builtin_echo(int argc, char **argv) {
+    int i = 1, newline = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        newline = 0;
+        i++;
+    }
+    for (; i < argc; i++) {
+        fputs(argv[i], stdout);
+        if (i + 1 < argc)
+            putchar(' ');
+    }
+    if (newline)
+        putchar('\n');
+    return 0;
+}
+
+/* Print the backslash escape at s (just past the \) and return
+ * how many bytes of s it used. Returns -1 for \c, which means
+ * stop printing.
+ */
+static int print_escape(const char *s) {
+    int c = 0, n = 0;
+
+    switch (*s) {
+    case 'a': putchar('\a'); return 1;
+    case 'b': putchar('\b'); return 1;
+    case 'c': return -1;
+    case 'e': putchar('\033'); return 1;
+    case 'f': putchar('\f'); return 1;
+    case 'n': putchar('\n'); return 1;
+    case 'r': putchar('\r'); return 1;
+    case 't': putchar('\t'); return 1;
+    case 'v': putchar('\v'); return 1;
+    case '\\': putchar('\\'); return 1;
+    case '\0': putchar('\\'); return 0;
+    case '0': case '1': case '2': case '3':
+    case '4': case '5': case '6': case '7':
+        /* \NNN, up to three octal digits (\0NNN works too) */
+        if (*s == '0')
+            s++, n++;
+        for (int i = 0; i < 3 && *s >= '0' && *s <= '7'; i++, n++)
+            c = c * 8 + (*s++ - '0');
+        putchar(c);
+        return n;
+    default:
+        putchar('\\');
+        putchar(*s);
+        return 1;
+    }
+}
+
+/* Number for a printf conversion. 'c takes the value of c like
+ * in C. Sets *ok to 0 if arg isn't a number.
+ */
+static long long printf_number(const char *arg, int *ok) {
+    char *end;
+    long long n;
+
+    if (arg == NULL || arg[0] == '\0')
+        return 0;
+    if (arg[0] == '\'' || arg[0] == '"')
+        return (unsigned char)arg[1];
+    errno = 0;
+    n = strtoll(arg, &end, 0);
+    if (end == arg || *end != '\0' || errno != 0) {
+        builtin_error("printf: %s: invalid number\n", arg);
+        *ok = 0;
+    }
+    return n;
+}
+
+/* Go through the format once, taking arguments from *args as
+ * conversions need them. Returns 1 to stop printing (\c).
+ */
+static int printf_once(const char *fmt, char ***args, int *ok) {
+    char spec[32];
+
+    while (*fmt) {
+        if (*fmt == '\\') {
+            int n = print_escape(fmt + 1);
+            if (n < 0)
+                return 1;
+            fmt += n + 1;
+            continue;
+        }
+        if (*fmt != '%') {
+            putchar(*fmt++);
+            continue;
+        }
+        if (fmt[1] == '%') {
+            putchar('%');
+            fmt += 2;
+            continue;
+        }
+
+        /* Copy flags, width and precision, then add the length
+         * modifier the value needs before the conversion.
+         */
+        size_t len = strspn(fmt + 1, "-+ #0123456789.") + 1;
+        char conv = fmt[len];
+        char *arg = **args;
+        if (conv == '\0' || len + 3 > sizeof(spec)) {
+            builtin_error("printf: %s: invalid format\n", fmt);
+            *ok = 0;
+            return 1;
+        }
+        if (arg != NULL)
+            (*args)++;
+        memcpy(spec, fmt, len);
+        fmt += len + 1;
+
+        switch (conv) {
+        case 's':
+            spec[len] = 's';
+            spec[len + 1] = '\0';
+            printf(spec, arg ? arg : "");
+            break;
+        case 'b':
+            /* Argument with escapes interpreted */
+            for (const char *a = arg ? arg : ""; *a; ) {
+                if (*a != '\\') {
+                    putchar(*a++);
+                    continue;
+                }
+                int n = print_escape(a + 1);
+                if (n < 0)
+                    return 1;
+                a += n + 1;
+            }
+            break;
+        case 'c':
+            if (arg != NULL && arg[0] != '\0') {
+                spec[len] = 'c';
+                spec[len + 1] = '\0';
+                printf(spec, arg[0]);
+            }
+            break;
+        case 'd': case 'i':
+            memcpy(spec + len, "ll", 2);
+            spec[len + 2] = conv;
+            spec[len + 3] = '\0';
+            printf(spec, printf_number(arg, ok));
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            memcpy(spec + len, "ll", 2);
+            spec[len + 2] = conv;
+            spec[len + 3] = '\0';
+            printf(spec, (unsigned long long)printf_number(arg, ok));
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': {
+            char *end;
+            double d = arg ? strtod(arg, &end) : 0;
+            if (arg != NULL && (end == arg || *end != '\0')) {
+                builtin_error("printf: %s: invalid number\n", arg);
+                *ok = 0;
+            }
+            spec[len] = conv;
+            spec[len + 1] = '\0';
+            printf(spec, d);
+            break;
+        }
+        default:
+            builtin_error("printf: %%%c: invalid conversion\n", conv);
+            *ok = 0;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* "printf format [args]". The format is reused until every
+ * argument has been printed like POSIX says.
+ */
+static int builtin_printf(int argc, char **argv) {
+    char **args = argv + 2;
+    int ok = 1;
+
+    if (argc < 2) {
+        builtin_error("printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+    while (1) {
+        char **before = args;
+        if (printf_once(argv[1], &args, &ok) != 0)
+            break;
+        /* Stop once everything is used or the format takes nothing */
+        if (*args == NULL || args == before)
+            break;
+    }
+    return ok ? 0 : 1;
+}
+
+/* State for evaluating a test expression */
+typedef struct {
+    char **argv;
+    int argc;
+    int pos;
+    int error;
+} test_state;
+
+static int test_or(test_state *t);
+
+/* True if op is a unary file or string test */
+static int is_unary_test(const char *op) {
+    return op[0] == '-' && op[1] != '\0' && op[2] == '\0' &&
+        strchr("bcdefghLnprsSuwxz", op[1]) != NULL;
+}
+
+static int test_unary(char op, const char *arg) {
+    struct stat st;
+
+    switch (op) {
+    case 'n': return arg[0] != '\0';
+    case 'z': return arg[0] == '\0';
+    case 'r': return access(arg, R_OK) == 0;
+    case 'w': return access(arg, W_OK) == 0;
+    case 'x': return access(arg, X_OK) == 0;
+    case 'h': case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(arg, &st) < 0)
+        return 0;
+    switch (op) {
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'f': return S_ISREG(st.st_mode);
+    case 'g': return (st.st_mode & S_ISGID) != 0;
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 'u': return (st.st_mode & S_ISUID) != 0;
+    default: return 1; /* -e */
+    }
+}
+
+static long long test_integer(test_state *t, const char *s) {
+    char *end;
+    errno = 0;
+    long long n = strtoll(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0) {
+        builtin_error("test: %s: integer expression expected\n", s);
+        t->error = 1;
+    }
+    return n;
+}
+
+/* Binary operator at argv[pos + 1], or -1 if it isn't one */
+static int test_binary(test_state *t) {
+    const char *a = t->argv[t->pos], *op = t->argv[t->pos + 1], *b = t->argv[t->pos + 2];
+    static const char *const int_ops[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+    int i;
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(a, b) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(a, b) != 0;
+    if (strcmp(op, "<") == 0)
+        return strcmp(a, b) < 0;
+    if (strcmp(op, ">") == 0)
+        return strcmp(a, b) > 0;
+    for (i = 0; i < 6 && strcmp(op, int_ops[i]) != 0; i++)
+        ;
+    if (i == 6)
+        return -1;
+    long long x = test_integer(t, a), y = test_integer(t, b);
+    switch (i) {
+    case 0: return x == y;
+    case 1: return x != y;
+    case 2: return x < y;
+    case 3: return x <= y;
+    case 4: return x > y;
+    default: return x >= y;
+    }
+}
+
+static int test_primary(test_state *t) {
+    int left = t->argc - t->pos;
+    char **argv = t->argv + t->pos;
+
+    if (left <= 0) {
+        builtin_error("test: argument expected\n");
+        t->error = 1;
+        return 0;
+    }
+    if (strcmp(argv[0], "!") == 0 && left >= 2) {
+        t->pos++;
+        return !test_primary(t);
+    }
+    if (left >= 3) {
+        int r = test_binary(t);
+        if (r >= 0) {
+            t->pos += 3;
+            return r;
+        }
+    }
+    if (strcmp(argv[0], "(") == 0 && left >= 2) {
+        t->pos++;
+        int r = test_or(t);
+        if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+            builtin_error("test: ')' expected\n");
+            t->error = 1;
+            return 0;
+        }
+        t->pos++;
+        return r;
+    }
+    if (left >= 2 && is_unary_test(argv[0])) {
+        t->pos += 2;
+        return test_unary(argv[0][1], argv[1]);
+    }
+    /* A lone string is true if it isn't empty */
+    t->pos++;
+    return argv[0][0] != '\0';
+}
+
+static int test_and(test_state *t) {
+    int r = test_primary(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+        t->pos++;
+        r = test_primary(t) && r;
+    }
+    return r;
+}
+
+static int test_or(test_state *t) {
+    int r = test_and(t);
+    while (t->pos < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+        t->pos++;
+        r = test_and(t) || r;
+    }
+    return r;
+}
+
+/* "test expr" and "[ expr ]". Returns 0 if true, 1 if false and
+ * 2 if the expression is bad.
+ */
+static int builtin_test(int argc, char **argv) {
+    test_state t = { argv + 1, argc - 1, 0, 0 };
+
+    if (strcmp(argv[0], "[") == 0) {
+        if (argc < 2 || strcmp(argv[argc - 1], "]") != 0) {
+            builtin_error("[: missing ]\n");
+            return 2;
+        }
+        t.argc--;
+    }
+    if (t.argc == 0)
+        return 1;
+    int r = test_or(&t);
+    if (!t.error && t.pos < t.argc) {
+        builtin_error("test: %s: unexpected argument\n", t.argv[t.pos]);
+        t.error = 1;
+    }
+    return t.error ? 2 : !r;
+}
+
+static int builtin_true(int argc, char **argv) {
+    return 0;
+}
+
+static int builtin_false(int argc, char **argv) {
+    return 1;
+}
+
+/* Signals kill knows by name */
+static const struct {
+    const char *name;
+    int number;
+} signal_names[] = {
+    { "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+    { "ILL", SIGILL }, { "TRAP", SIGTRAP }, { "ABRT", SIGABRT },
+    { "BUS", SIGBUS }, { "FPE", SIGFPE }, { "KILL", SIGKILL },
+    { "USR1", SIGUSR1 }, { "SEGV", SIGSEGV }, { "USR2", SIGUSR2 },
+    { "PIPE", SIGPIPE }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+    { "CHLD", SIGCHLD }, { "CONT", SIGCONT }, { "STOP", SIGSTOP },
+    { "TSTP", SIGTSTP }, { "TTIN", SIGTTIN }, { "TTOU", SIGTTOU },
+    { "URG", SIGURG }, { "XCPU", SIGXCPU }, { "XFSZ", SIGXFSZ },
+    { "VTALRM", SIGVTALRM }, { "PROF", SIGPROF }, { "WINCH", SIGWINCH },
+    { "IO", SIGIO }, { "SYS", SIGSYS },
+};
+#define SIGNAL_NAME_COUNT (sizeof(signal_names) / sizeof(signal_names[0]))
+
+/* Signal number for a name (TERM, SIGTERM) or number, -1 if
+ * there's no such signal.
+ */
+static int parse_signal(const char *s) {
+    char *end;
+    if (*s >= '0' && *s <= '9') {
+        long n = strtol(s, &end, 10);
+        return *end == '\0' && n < NSIG ? (int)n : -1;
+    }
+    if (strncmp(s, "SIG", 3) == 0)
+        s += 3;
+    for (size_t i = 0; i < SIGNAL_NAME_COUNT; i++) {
+        if (strcmp(s, signal_names[i].name) == 0)
+            return signal_names[i].number;
+    }
+    return -1;
+}
+
+/* Send sig to a job. Without job control the job shares our
+ * process group, so each of its processes gets it instead.
+ */
+static int kill_job(job *j, int sig) {
+    if (j->pgid != shell_pgid)
+        return kill(-j->pgid, sig);
+    for (process *p = j->first_process; p; p = p->next) {
+        if (p->pid != 0 && !p->completed && kill(p->pid, sig) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* "kill [-s sig | -sig] pid|%job ..." and "kill -l" */
+static int builtin_kill(int argc, char **argv) {
+    int sig = SIGTERM, i = 1, status = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-l") == 0) {
+        for (size_t n = 0; n < SIGNAL_NAME_COUNT; n++)
+            printf("%2d) SIG%s\n", signal_names[n].number, signal_names[n].name);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        sig = parse_signal(argv[2]);
+        i = 3;
+    } else if (argc > 1 && argv[1][0] == '-' && argv[1][1] != '\0') {
+        sig = parse_signal(argv[1] + 1);
+        i = 2;
+    }
+    if (sig < 0) {
+        builtin_error("kill: %s: invalid signal\n", argv[i - 1]);
+        return 1;
+    }
+    if (i >= argc) {
+        builtin_error("kill: usage: kill [-s sig | -sig] pid | %%job ...\n");
+        return 2;
+    }
+
+    for (; i < argc; i++) {
+        char *end;
+        int r;
+        if (argv[i][0] == '%') {
+            job *j = jobs ? find_job(jobs, atoi(argv[i] + 1)) : NULL;
+            if (j == NULL) {
+                builtin_error("kill: %s: no such job\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            r = kill_job(j, sig);
+        } else {
+            long pid = strtol(argv[i], &end, 10);
+            if (end == argv[i] || *end != '\0') {
+                builtin_error("kill: %s: arguments must be process or job IDs\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            r = kill((pid_t)pid, sig);
+        }
+        if (r < 0) {
+            builtin_error("kill: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* "jobs" lists the jobs in the job table by number */
+static int builtin_jobs(int argc, char **argv) {
+    if (jobs == NULL)
+        return 0;
+    for (size_t id = 1; id <= jobs->id_capacity; id++) {
+        job *j = find_job(jobs, id);
+        if (j == NULL)
+            continue;
+        const char *state = job_is_completed(j) ? "Done" :
+            job_is_stopped(j) ? "Stopped" : "Running";
+        printf("[%zu]  %-8s", id, state);
+        for (process *p = j->first_process; p; p = p->next) {
+            for (char **a = p->argv; *a; a++)
+                printf(" %s", *a);
+            if (p->next)
+                printf(" |");
+        }
+        if (j->placement != NULL)
+            printf("  (%s)", j->placement->label);
+        printf("\n");
+    }
+    return 0;
+}
+
+/* "place ..." sets where background jobs run */
+static int builtin_place(int argc, char **argv) {
+    return run_place(argc, argv);
+}
+
+/* "exit [n]" exits with n or the last job's status */
+static int builtin_exit(int argc, char **argv) {
+    exit(argc > 1 ? atoi(argv[1]) : last_status);
+}
+
+/* "hash" shows the command location cache, "hash -r" clears it
+ * and "hash name..." looks the names up now.
+ */
+static int builtin_hash(int argc, char **argv) {
+    int status = 0;
+
+    if (argc == 1) {
+        print_command_cache();
+    } else if (strcmp(argv[1], "-r") == 0) {
+        clear_command_cache();
+    } else {
+        for (int i = 1; i < argc; i++) {
+            if (lookup_command(argv[i]) == NULL) {
+                printf("hash: %s: not found\n", argv[i]);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
+
+/* "parallel [-j jobs] [-a file] command [args]" */
+static int builtin_parallel(int argc, char **argv) {
+    /* The commands print straight to stdout, ours has to go first */
+    fflush(stdout);
+    return run_parallel(argc, argv);
+}
+
+/* "time" shows what the session ran and how long children took
+ * from fork to exit. "time cmd" is normally handled before the
+ * job starts so whole pipelines are timed, we only get it for
+ * the later commands of a pipeline and time that one command.
+ */
+static int builtin_time(int argc, char **argv) {
+    struct rusage usage;
+    job_usage u;
+    process p;
+    job j;
+    char buf[128];
+    int status;
+
+    if (argc == 1) {
+        print_session_usage(stdout);
+        return 0;
+    }
+    fflush(stdout);
+    init_process(&p);
+    init_job(&j);
+    j.first_process = &p;
+    p.argv = argv + 1;
+    p.foreground = 0;
+    p.pgid = getpgrp();
+    if (spawn_process(&p) < 0)
+        return 127;
+    while (wait4(p.pid, &status, 0, &usage) < 0) {
+        if (errno != EINTR) {
+            builtin_error("time: wait4: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    account_exit(&p, &usage);
+    get_job_usage(&j, &u);
+    format_usage(&u, buf, sizeof(buf));
+    builtin_error("%s\n", buf);
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
+}
+
+/* "export [name[=value]...]" exports the names, setting the ones
+ * with a value first. On its own it lists what is exported.
+ */
+static int builtin_export(int argc, char **argv) {
+    int status = 0;
+
+    if (argc == 1) {
+        print_exports();
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        if (is_assignment(argv[i], strlen(argv[i]))) {
+            set_assignment(argv[i], 1);
+        } else if (is_name(argv[i])) {
+            export_var(argv[i]);
+        } else {
+            builtin_error("export: %s: not a valid name\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* "unset name..." */
+static int builtin_unset(int argc, char **argv) {
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (is_name(argv[i])) {
+            unset_var(argv[i]);
+        } else {
+            builtin_error("unset: %s: not a valid name\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/* "shellstats" prints the shell's counters and writes out the
+ * trace so far, the shell carries on as usual.
+ */
+static int builtin_shellstats(int argc, char **argv) {
+    print_stats(stdout);
+    flush_trace();
+    return 0;
+}
+
+/* Sorted by name for bsearch() */
+static const builtin builtins[] = {
+    { "[", builtin_test },
+    { "cat", builtin_cat },
+    { "cd", builtin_cd },
+    { "echo", builtin_echo },
+    { "exit", builtin_exit },
+    { "export", builtin_export },
+    { "false", builtin_false },
+    { "hash", builtin_hash },
+    { "jobs", builtin_jobs },
+    { "kill", builtin_kill },
+    { "parallel", builtin_parallel },
+    { "place", builtin_place },
+    { "printf", builtin_printf },
+    { "shellstats", builtin_shellstats },
+    { "test", builtin_test },
+    { "time", builtin_time },
+    { "true", builtin_true },
+    { "unset", builtin_unset },
+};
+#define BUILTIN_COUNT (sizeof(builtins) / sizeof(builtins[0]))
+
+static int compare_builtin(const void *name, const void *b) {
+    return strcmp(name, ((const builtin *)b)->name);
+}
+
+/* The builtin called name or NULL */
+builtin_fn find_builtin(const char *name) {
+    const builtin *b = bsearch(name, builtins, BUILTIN_COUNT,
+            sizeof(builtin), compare_builtin);
+    return b ? b->fn : NULL;
+}
+
+/* True if the builtin has to run in a child */
+int builtin_forks(builtin_fn fn) {
+    return fn == builtin_cat;
+}
+
+/* Run a builtin and return its exit status */
+int run_builtin(builtin_fn fn, char **argv) {
+    int argc = 0;
+    while (argv[argc] != NULL)
+        argc++;
+    return fn(argc, argv);
+}
@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "complete.h"
+
+/* What getdents64() fills its buffer with */
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64;
+
+/* An executable in the index and the PATH directories it is in,
+ * one bit per directory, so it only goes away once it is gone
+ * from all of them.
+ */
+typedef struct {
+    char *name;
+    uint64_t dirs;
+} command_name;
+
+static command_name *names = NULL;
+static size_t name_count = 0;
+static size_t name_capacity = 0;
+
+/* PATH the index was built from and its directories */
+static char *indexed_path_var = NULL;
+static char *path_dirs[MAX_PATH_DIRS];
+static int path_watches[MAX_PATH_DIRS];
+static int path_dir_count = 0;
+
+/* Events are only read when completing, nothing wakes the shell
+ * up when a PATH directory changes.
+ */
+static int inotify_fd = -1;
+
+/* Call fn for every entry in the directory at path, reading the
+ * entries GETDENTS_SIZE bytes at a time. Returns -1 if it can't
+ * be opened.
+ */
+static int scan_directory(const char *path,
+        void (*fn)(int dirfd, const char *name, unsigned char type, void *data),
+        void *data) {
+    static char *buf = NULL;
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    long n;
+
+    if (fd < 0)
+        return -1;
+    if (buf == NULL && (buf = malloc(GETDENTS_SIZE)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    while ((n = syscall(SYS_getdents64, fd, buf, GETDENTS_SIZE)) > 0) {
+        for (long off = 0; off < n; ) {
+            linux_dirent64 *d = (linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0)
+                fn(fd, d->d_name, d->d_type, data);
+        }
+    }
+    close(fd);
+    return 0;
+}
+
+/* A regular file with an execute bit, following symlinks */
+static int is_executable_at(int dirfd, const char *name, unsigned char type) {
+    struct stat st;
+
+    if (type == DT_DIR)
+        return 0;
+    return fstatat(dirfd, name, &st, 0) == 0 && S_ISREG(st.st_mode) &&
+        (st.st_mode & 0111) != 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const command_name *)a)->name, ((const command_name *)b)->name);
+}
+
+/* First name in the index not less than name */
+static size_t lower_bound(const char *name, size_t len) {
+    size_t lo = 0, hi = name_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(names[mid].name, name, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void reserve_names(size_t count) {
+    if (count <= name_capacity)
+        return;
+    name_capacity = name_capacity ? name_capacity * 2 : 1024;
+    if (name_capacity < count)
+        name_capacity = count;
+    names = realloc(names, name_capacity * sizeof(command_name));
+    if (names == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+/* Add name found in PATH directory dir, keeping the index sorted */
+static void add_name(const char *name, int dir) {
+    size_t len = strlen(name) + 1;
+    size_t i = lower_bound(name, len);
+
+    if (i < name_count && strcmp(names[i].name, name) == 0) {
+        names[i].dirs |= 1ULL << dir;
+        return;
+    }
+    reserve_names(name_count + 1);
+    memmove(names + i + 1, names + i, (name_count - i) * sizeof(command_name));
+    if ((names[i].name = strdup(name)) == NULL) {
+        perror("strdup");
+        exit(1);
+    }
+    names[i].dirs = 1ULL << dir;
+    name_count++;
+}
+
+/* name is no longer an executable in PATH directory dir */
+static void remove_name(const char *name, int dir) {
+    size_t len = strlen(name) + 1;
+    size_t i = lower_bound(name, len);
+
+    if (i == name_count || strcmp(names[i].name, name) != 0)
+        return;
+    names[i].dirs &= ~(1ULL << dir);
+    if (names[i].dirs != 0)
+        return;
+    free(names[i].name);
+    name_count--;
+    memmove(names + i, names + i + 1, (name_count - i) * sizeof(command_name));
+}
+
+/* Building the index appends everything, it is sorted once after */
+static void index_entry(int dirfd, const char *name, unsigned char type, void *data) {
+    int dir = *(int *)data;
+
+    if (!is_executable_at(dirfd, name, type))
+        return;
+    reserve_names(name_count + 1);
+    if ((names[name_count].name = strdup(name)) == NULL) {
+        perror("strdup");
+        exit(1);
+    }
+    names[name_count].dirs = 1ULL << dir;
+    name_count++;
+}
+
+static void clear_index() {
+    for (size_t i = 0; i < name_count; i++)
+        free(names[i].name);
+    name_count = 0;
+    for (int i = 0; i < path_dir_count; i++)
+        free(path_dirs[i]);
+    path_dir_count = 0;
+    free(indexed_path_var);
+    indexed_path_var = NULL;
+    /* Closing it drops every watch */
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+}
+
+/* Read every PATH directory and start watching them. Only
+ * absolute directories are indexed, like the command cache.
+ */
+static void build_index(const char *path_var) {
+    uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB |
+        IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    const char *dir = path_var;
+
+    clear_index();
+    if ((indexed_path_var = strdup(path_var)) == NULL) {
+        perror("strdup");
+        exit(1);
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    while (path_dir_count < MAX_PATH_DIRS) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+        if (dir_len > 0 && dir[0] == '/') {
+            int i = path_dir_count++;
+            if ((path_dirs[i] = strndup(dir, dir_len)) == NULL) {
+                perror("strndup");
+                exit(1);
+            }
+            path_watches[i] = inotify_fd >= 0 ?
+                inotify_add_watch(inotify_fd, path_dirs[i], mask) : -1;
+            scan_directory(path_dirs[i], index_entry, &i);
+        }
+        if (end == NULL)
+            break;
+        dir = end + 1;
+    }
+
+    /* The same name in several directories becomes one entry */
+    qsort(names, name_count, sizeof(command_name), compare_names);
+    size_t kept = 0;
+    for (size_t i = 0; i < name_count; i++) {
+        if (kept > 0 && strcmp(names[kept - 1].name, names[i].name) == 0) {
+            names[kept - 1].dirs |= names[i].dirs;
+            free(names[i].name);
+        } else {
+            names[kept++] = names[i];
+        }
+    }
+    name_count = kept;
+}
+
+/* Apply the inotify events that came in since the last Tab.
+ * Returns -1 if the index can't be trusted and has to be built
+ * again (a directory went away or events were lost).
+ */
+static int apply_path_events() {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[PATH_MAX];
+    ssize_t n;
+
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF))
+                return -1;
+            if (ev->len == 0)
+                continue;
+            /* A directory in PATH twice (or under two names) has
+             * one watch, the event is for each of its entries
+             */
+            for (int dir = 0; dir < path_dir_count; dir++) {
+                if (path_watches[dir] != ev->wd)
+                    continue;
+                if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    remove_name(ev->name, dir);
+                    continue;
+                }
+                /* Created, moved in or chmod'ed, check what it is now */
+                snprintf(path, sizeof(path), "%s/%s", path_dirs[dir], ev->name);
+                if (is_executable_at(AT_FDCWD, path, DT_UNKNOWN))
+                    add_name(ev->name, dir);
+                else
+                    remove_name(ev->name, dir);
+            }
+        }
+    }
+    return 0;
+}
+
+/* Make the index match PATH as it is now */
+static void update_index() {
+    const char *path_var = getenv("PATH");
+
+    if (path_var == NULL)
+        path_var = "";
+    if (indexed_path_var == NULL || strcmp(indexed_path_var, path_var) != 0 ||
+            inotify_fd < 0 || apply_path_events() < 0)
+        build_index(path_var);
+}
+
+/* Number of executables in the PATH index */
+size_t command_index_size() {
+    update_index();
+    return name_count;
+}
+
+static void add_match(completion *c, const char *match) {
+    if (c->count == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 64;
+        c->matches = realloc(c->matches, c->capacity * sizeof(char *));
+        if (c->matches == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    c->matches[c->count++] = match;
+}
+
+/* The names in the index starting with the prefix are all next
+ * to each other.
+ */
+static void complete_command(const char *prefix, size_t len, completion *c) {
+    update_index();
+    for (size_t i = lower_bound(prefix, len);
+            i < name_count && strncmp(names[i].name, prefix, len) == 0; i++)
+        add_match(c, names[i].name);
+}
+
+/* What complete_file() is looking for in a directory */
+typedef struct {
+    completion *c;
+    const char *word;   /* the whole word, directory included */
+    size_t dir_len;     /* bytes of word that are the directory */
+    const char *prefix; /* start of the name being completed */
+    size_t prefix_len;
+} file_search;
+
+static void match_file(int dirfd, const char *name, unsigned char type, void *data) {
+    file_search *s = data;
+    struct stat st;
+
+    if (strncmp(name, s->prefix, s->prefix_len) != 0)
+        return;
+    /* Hidden files only if asked for */
+    if (name[0] == '.' && s->prefix_len == 0)
+        return;
+    if (type == DT_UNKNOWN || type == DT_LNK)
+        type = fstatat(dirfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+
+    size_t name_len = strlen(name);
+    char *match = arena_alloc(s->c->strings, s->dir_len + name_len + 2);
+    memcpy(match, s->word, s->dir_len);
+    memcpy(match + s->dir_len, name, name_len);
+    strcpy(match + s->dir_len + name_len, type == DT_DIR ? "/" : "");
+    add_match(s->c, match);
+}
+
+static int compare_matches(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Names in the directory part of the word starting with the
+ * rest of it. Directories get a / on the end.
+ */
+static void complete_file(const char *word, size_t len, completion *c) {
+    char dir[PATH_MAX];
+    const char *slash = memrchr(word, '/', len);
+    file_search s = { c, word, 0, word, len };
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        s.dir_len = slash - word + 1;
+        s.prefix = slash + 1;
+        s.prefix_len = len - s.dir_len;
+        snprintf(dir, sizeof(dir), "%.*s", (int)s.dir_len, word);
+    }
+    c->display_offset = s.dir_len;
+    c->strings = new_arena(4096);
+    scan_directory(dir, match_file, &s);
+    qsort(c->matches, c->count, sizeof(char *), compare_matches);
+}
+
+/* Characters that end a word for completion */
+static int is_separator(char ch) {
+    return ch == ' ' || ch == '\t' || ch == ';' || ch == '&' || ch == '|' ||
+        ch == '<' || ch == '>';
+}
+
+/* Find the completions for the word that ends at cursor */
+void complete_word(const char *line, size_t cursor, completion *c) {
+    size_t start = cursor, before;
+
+    memset(c, 0, sizeof(*c));
+    while (start > 0 && !is_separator(line[start - 1]))
+        start--;
+    c->word_start = start;
+    before = start;
+    while (before > 0 && (line[before - 1] == ' ' || line[before - 1] == '\t'))
+        before--;
+
+    /* First word of a command, unless it is a path */
+    if ((before == 0 || line[before - 1] == ';' || line[before - 1] == '&' ||
+                line[before - 1] == '|') &&
+            memchr(line + start, '/', cursor - start) == NULL)
+        complete_command(line + start, cursor - start, c);
+    else
+        complete_file(line + start, cursor - start, c);
+}
+
+/* Free what complete_word() found */
+void free_completion(completion *c) {
+    free(c->matches);
+    if (c->strings != NULL)
+        arena_release(c->strings);
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,650 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "complete.h"
+#include "editor.h"
+#include "history.h"
+#include "io.h"
+#include "launch.h"
+
+/* Bytes read from the terminal at a time. A paste comes in as
+ * big reads instead of a syscall per character.
+ */
+#define EDIT_READ_SIZE 65536
+
+#define PASTE_START "\033[200~"
+#define PASTE_END "\033[201~"
+
+#define CTRL_KEY(c) ((c) & 0x1f)
+
+/* Completions listed at most, the rest are just counted */
+#define COMPLETION_LIST_LIMIT 200
+
+static void reserve(edit_string *s, size_t len) {
+    if (len <= s->capacity)
+        return;
+    s->capacity = s->capacity ? s->capacity : 128;
+    while (s->capacity < len)
+        s->capacity *= 2;
+    s->data = realloc(s->data, s->capacity);
+    if (s->data == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+static void insert(edit_string *s, size_t at, const char *text, size_t len) {
+    reserve(s, s->len + len + 1);
+    memmove(s->data + at + len, s->data + at, s->len - at);
+    memcpy(s->data + at, text, len);
+    s->len += len;
+}
+
+static void append(edit_string *s, const char *text, size_t len) {
+    insert(s, s->len, text, len);
+}
+
+static void erase(edit_string *s, size_t at, size_t len) {
+    memmove(s->data + at, s->data + at + len, s->len - at - len);
+    s->len -= len;
+}
+
+static void set(edit_string *s, const char *text, size_t len) {
+    s->len = 0;
+    append(s, text, len);
+}
+
+/* UTF-8 continuation bytes don't take a column of their own */
+static int is_continuation(char c) {
+    return ((unsigned char)c & 0xc0) == 0x80;
+}
+
+static size_t columns(const char *s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++)
+        n += !is_continuation(s[i]);
+    return n;
+}
+
+static size_t prev_char(const char *s, size_t i) {
+    while (i > 0 && is_continuation(s[--i]))
+        ;
+    return i;
+}
+
+static size_t next_char(const char *s, size_t len, size_t i) {
+    while (i < len && is_continuation(s[++i]))
+        ;
+    return i;
+}
+
+/* Edit lines on the terminal fd */
+void init_line_editor(line_editor *e, int fd) {
+    memset(e, 0, sizeof(*e));
+    e->fd = fd;
+    e->history_index = -1;
+    start_reverse_search(&e->search);
+}
+
+static void flush_output(line_editor *e) {
+    size_t done = 0;
+    while (done < e->out.len) {
+        ssize_t n = write(e->fd, e->out.data + done, e->out.len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    e->out.len = 0;
+}
+
+static void output(line_editor *e, const char *text) {
+    append(&e->out, text, strlen(text));
+}
+
+/* Move the cursor from column from to column to, both counted
+ * from the start of the prompt's last line so they can wrap.
+ */
+static void move_cursor(line_editor *e, size_t from, size_t to) {
+    char seq[32];
+    long rows = (long)((e->prompt_width + to) / e->columns) -
+        (long)((e->prompt_width + from) / e->columns);
+    size_t column = (e->prompt_width + to) % e->columns;
+
+    if (rows < 0) {
+        snprintf(seq, sizeof(seq), "\033[%ldA", -rows);
+        output(e, seq);
+    } else if (rows > 0) {
+        snprintf(seq, sizeof(seq), "\033[%ldB", rows);
+        output(e, seq);
+    }
+    if ((e->prompt_width + from) % e->columns != column) {
+        output(e, "\r");
+        if (column > 0) {
+            snprintf(seq, sizeof(seq), "\033[%zuC", column);
+            output(e, seq);
+        }
+    }
+}
+
+/* What should be on the screen and where the cursor goes in it */
+static void build_view(line_editor *e, edit_string *view, size_t *cursor) {
+    if (!e->searching) {
+        set(view, e->line.data ? e->line.data : "", e->line.len);
+        *cursor = e->cursor;
+        return;
+    }
+    const char *match = NULL;
+    size_t match_len = 0;
+    if (e->search.match >= 0)
+        match = history_entry(e->search.match, &match_len);
+    const char *label = e->search.failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`";
+    set(view, label, strlen(label));
+    append(view, e->search.query ? e->search.query : "", e->search.len);
+    append(view, "': ", 3);
+    *cursor = view->len;
+    if (match != NULL)
+        append(view, match, match_len);
+}
+
+/* Bring the screen up to date. Only the part after the first
+ * byte that differs from what is shown gets written, then the
+ * cursor is put in place, all in one write().
+ */
+static void refresh(line_editor *e) {
+    static edit_string view;
+    size_t view_cursor, d = 0;
+
+    build_view(e, &view, &view_cursor);
+    size_t common = view.len < e->shown.len ? view.len : e->shown.len;
+    while (d < common && view.data[d] == e->shown.data[d])
+        d++;
+    while (d > 0 && d < view.len && is_continuation(view.data[d]))
+        d--;
+
+    size_t at = columns(e->shown.data, e->shown_cursor);
+    if (d < view.len || d < e->shown.len) {
+        move_cursor(e, at, columns(view.data, d));
+        append(&e->out, view.data + d, view.len - d);
+        at = columns(view.data, view.len);
+        /* Terminals hold the cursor on the last column after
+         * filling a row, get it onto the next row ourselves.
+         */
+        if (view.len > d && at > 0 && (e->prompt_width + at) % e->columns == 0)
+            output(e, "\r\n");
+        if (view.len < e->shown.len)
+            output(e, "\033[J");
+    }
+    move_cursor(e, at, columns(view.data, view_cursor));
+    set(&e->shown, view.data, view.len);
+    e->shown_cursor = view_cursor;
+    flush_output(e);
+}
+
+static void enter_raw_mode(line_editor *e) {
+    struct termios raw = shell_tmodes;
+
+    /* Keep ISIG so Ctrl-C still gets to the shell's handler */
+    raw.c_iflag &= ~(ICRNL | INLCR | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(e->fd, TCSADRAIN, &raw);
+    output(e, "\033[?2004h"); /* Bracketed paste on */
+    e->raw = 1;
+}
+
+static void leave_raw_mode(line_editor *e) {
+    if (!e->raw)
+        return;
+    output(e, "\033[?2004l");
+    flush_output(e);
+    tcsetattr(e->fd, TCSADRAIN, &shell_tmodes);
+    e->raw = 0;
+}
+
+/* Start a new line after the prompt */
+void start_line(line_editor *e, const char *prompt) {
+    struct winsize ws;
+    const char *last = strrchr(prompt, '\n');
+
+    e->prompt = prompt;
+    e->prompt_width = columns(last ? last + 1 : prompt, strlen(last ? last + 1 : prompt));
+    e->columns = ioctl(e->fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+    e->line.len = 0;
+    e->cursor = 0;
+    e->shown.len = 0;
+    e->shown_cursor = 0;
+    e->pending_len = 0;
+    e->pasting = 0;
+    e->history_index = -1;
+    e->searching = 0;
+    enter_raw_mode(e);
+    flush_output(e);
+}
+
+/* Put entry index of the history in the line */
+static void show_history(line_editor *e, long index) {
+    size_t len;
+    const char *command = history_entry(index, &len);
+    if (command == NULL)
+        return;
+    if (e->history_index < 0)
+        set(&e->saved, e->line.data ? e->line.data : "", e->line.len);
+    e->history_index = index;
+    set(&e->line, command, len);
+    e->cursor = len;
+}
+
+static void history_up(line_editor *e) {
+    long index = e->history_index < 0 ? (long)history_count() : e->history_index;
+    /* Skip damaged records */
+    while (--index >= 0 && history_entry(index, NULL) == NULL)
+        ;
+    if (index >= 0)
+        show_history(e, index);
+}
+
+static void history_down(line_editor *e) {
+    if (e->history_index < 0)
+        return;
+    long index = e->history_index;
+    while (++index < (long)history_count() && history_entry(index, NULL) == NULL)
+        ;
+    if (index < (long)history_count()) {
+        show_history(e, index);
+    } else {
+        set(&e->line, e->saved.data ? e->saved.data : "", e->saved.len);
+        e->cursor = e->line.len;
+        e->history_index = -1;
+    }
+}
+
+/* Leave the reverse search, keeping the match in the line */
+static void accept_search(line_editor *e) {
+    size_t len;
+    const char *match = e->search.match >= 0 ? history_entry(e->search.match, &len) : NULL;
+    if (match != NULL) {
+        set(&e->line, match, len);
+        e->cursor = len;
+    }
+    e->searching = 0;
+    end_reverse_search(&e->search);
+}
+
+/* Insert pasted text up to the first line break. Returns how
+ * much was inserted, len if there was no line break.
+ */
+static size_t insert_paste(line_editor *e, const char *text, size_t len) {
+    size_t n = 0;
+    while (n < len && text[n] != '\n' && text[n] != '\r')
+        n++;
+    insert(&e->line, e->cursor, text, n);
+    e->cursor += n;
+    return n;
+}
+
+/* Length of the escape sequence at s, 0 if it is cut off */
+static size_t escape_length(const char *s, size_t len) {
+    if (len < 2)
+        return 0;
+    if (s[1] == 'O')
+        return len >= 3 ? 3 : 0;
+    if (s[1] != '[')
+        return 2; /* Alt+key, ignored */
+    for (size_t i = 2; i < len; i++) {
+        if (s[i] >= 0x40 && s[i] <= 0x7e)
+            return i + 1;
+    }
+    return 0;
+}
+
+/* Act on the escape sequence seq */
+static void handle_escape(line_editor *e, const char *seq, size_t len) {
+    char final = seq[len - 1];
+    if (len == 6 && memcmp(seq, PASTE_START, 6) == 0) {
+        e->pasting = 1;
+        return;
+    }
+    if (e->searching)
+        accept_search(e);
+    if (final == '~' && len == 4) {
+        switch (seq[2]) {
+        case '3': final = 'X'; break; /* Delete */
+        case '1': case '7': final = 'H'; break;
+        case '4': case '8': final = 'F'; break;
+        }
+    }
+    switch (final) {
+    case 'A': history_up(e); break;
+    case 'B': history_down(e); break;
+    case 'C':
+        e->cursor = next_char(e->line.data, e->line.len, e->cursor);
+        break;
+    case 'D':
+        e->cursor = prev_char(e->line.data, e->cursor);
+        break;
+    case 'H': e->cursor = 0; break;
+    case 'F': e->cursor = e->line.len; break;
+    case 'X':
+        if (e->cursor < e->line.len)
+            erase(&e->line, e->cursor, next_char(e->line.data, e->line.len, e->cursor) - e->cursor);
+        break;
+    }
+}
+
+/* Keys typed during a reverse search. Returns 0 if the key should
+ * be handled as usual once the search is left.
+ */
+static int handle_search_key(line_editor *e, char c) {
+    switch (c) {
+    case CTRL_KEY('R'):
+        reverse_search_next(&e->search);
+        return 1;
+    case CTRL_KEY('H'):
+    case 127:
+        reverse_search_delete(&e->search);
+        return 1;
+    case CTRL_KEY('G'):
+        /* Give up, back to the line as it was */
+        e->searching = 0;
+        end_reverse_search(&e->search);
+        return 1;
+    default:
+        if ((unsigned char)c >= 0x20 && c != 127) {
+            reverse_search_add(&e->search, &c, 1);
+            return 1;
+        }
+        accept_search(e);
+        return 0;
+    }
+}
+
+/* Print the completions in columns below the line, then the
+ * prompt again for the line to be drawn after.
+ */
+static void list_completions(line_editor *e, const completion *c) {
+    size_t width = 0, shown = c->count < COMPLETION_LIST_LIMIT ? c->count : COMPLETION_LIST_LIMIT;
+    char more[64];
+
+    for (size_t i = 0; i < shown; i++) {
+        size_t w = columns(c->matches[i] + c->display_offset,
+                strlen(c->matches[i] + c->display_offset));
+        if (w > width)
+            width = w;
+    }
+    width += 2;
+    size_t per_row = e->columns / width ? e->columns / width : 1;
+    size_t rows = (shown + per_row - 1) / per_row;
+
+    suspend_line(e);
+    output(e, "\r\n");
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t i = row; i < shown; i += rows) {
+            const char *name = c->matches[i] + c->display_offset;
+            output(e, name);
+            if (i + rows < shown) {
+                for (size_t w = columns(name, strlen(name)); w < width; w++)
+                    output(e, " ");
+            }
+        }
+        output(e, "\r\n");
+    }
+    if (shown < c->count) {
+        snprintf(more, sizeof(more), "(%zu more)\r\n", c->count - shown);
+        output(e, more);
+    }
+    output(e, e->prompt);
+    e->shown.len = 0;
+    e->shown_cursor = 0;
+}
+
+/* Complete the word before the cursor. A single match is put in
+ * with a space after it, several are put in as far as they agree
+ * and listed if that adds nothing.
+ */
+static void complete(line_editor *e) {
+    completion c;
+    size_t common;
+
+    reserve(&e->line, e->line.len + 1);
+    e->line.data[e->line.len] = '\0';
+    complete_word(e->line.data, e->cursor, &c);
+    if (c.count == 0) {
+        output(e, "\a");
+        free_completion(&c);
+        return;
+    }
+    common = strlen(c.matches[0]);
+    for (size_t i = 1; i < c.count; i++) {
+        size_t n = 0;
+        while (n < common && c.matches[i][n] == c.matches[0][n])
+            n++;
+        common = n;
+    }
+    while (common > 0 && is_continuation(c.matches[0][common]))
+        common--;
+
+    size_t word_len = e->cursor - c.word_start;
+    if (c.count == 1 || common > word_len) {
+        erase(&e->line, c.word_start, word_len);
+        insert(&e->line, c.word_start, c.matches[0], common);
+        e->cursor = c.word_start + common;
+        if (c.count == 1 && c.matches[0][common - 1] != '/') {
+            insert(&e->line, e->cursor, " ", 1);
+            e->cursor++;
+        }
+    } else {
+        list_completions(e, &c);
+    }
+    free_completion(&c);
+}
+
+/* Act on a control key. Returns 1 when the line is done, -1 for
+ * end of input and 0 otherwise.
+ */
+static int handle_control(line_editor *e, char c) {
+    size_t start;
+
+    if (e->searching && handle_search_key(e, c))
+        return 0;
+    switch (c) {
+    case '\r':
+    case '\n':
+        return 1;
+    case '\t': complete(e); break;
+    case CTRL_KEY('A'): e->cursor = 0; break;
+    case CTRL_KEY('E'): e->cursor = e->line.len; break;
+    case CTRL_KEY('B'): e->cursor = prev_char(e->line.data, e->cursor); break;
+    case CTRL_KEY('F'): e->cursor = next_char(e->line.data, e->line.len, e->cursor); break;
+    case CTRL_KEY('D'):
+        if (e->line.len == 0)
+            return -1;
+        if (e->cursor < e->line.len)
+            erase(&e->line, e->cursor, next_char(e->line.data, e->line.len, e->cursor) - e->cursor);
+        break;
+    case CTRL_KEY('H'):
+    case 127:
+        if (e->cursor > 0) {
+            start = prev_char(e->line.data, e->cursor);
+            erase(&e->line, start, e->cursor - start);
+            e->cursor = start;
+        }
+        break;
+    case CTRL_KEY('K'): e->line.len = e->cursor; break;
+    case CTRL_KEY('U'):
+        erase(&e->line, 0, e->cursor);
+        e->cursor = 0;
+        break;
+    case CTRL_KEY('W'):
+        start = e->cursor;
+        while (start > 0 && e->line.data[start - 1] == ' ')
+            start--;
+        while (start > 0 && e->line.data[start - 1] != ' ')
+            start--;
+        erase(&e->line, start, e->cursor - start);
+        e->cursor = start;
+        break;
+    case CTRL_KEY('L'):
+        /* Clear the screen and draw everything again at the top */
+        output(e, "\033[H\033[2J");
+        output(e, e->prompt);
+        e->shown.len = 0;
+        e->shown_cursor = 0;
+        break;
+    case CTRL_KEY('R'):
+        e->searching = 1;
+        start_reverse_search(&e->search);
+        break;
+    }
+    return 0;
+}
+
+/* Handle the bytes in buf. Returns like edit_input(). */
+static int handle_input(line_editor *e, const char *buf, size_t len) {
+    size_t i = 0;
+
+    while (i < len) {
+        if (e->pasting) {
+            const char *end = memmem(buf + i, len - i, PASTE_END, 6);
+            size_t keep = 0;
+            if (end == NULL) {
+                /* The end marker may be cut off, keep a possible start of it */
+                for (keep = 5; keep > 0; keep--) {
+                    if (keep <= len - i && memcmp(buf + len - keep, PASTE_END, keep) == 0)
+                        break;
+                }
+                end = buf + len - keep;
+            }
+            size_t n = insert_paste(e, buf + i, end - (buf + i));
+            if (buf + i + n < end) {
+                /* A line break ends the line like Enter, the rest of
+                 * the paste waits its turn as a paste of its own
+                 */
+                insert(&e->ahead, e->ahead.len, PASTE_START, 6);
+                insert(&e->ahead, e->ahead.len, buf + i + n + 1, len - (i + n + 1));
+                e->pasting = 0;
+                return 1;
+            }
+            if (keep > 0 || end == buf + len) {
+                memcpy(e->pending, buf + len - keep, keep);
+                e->pending_len = keep;
+                return 0;
+            }
+            e->pasting = 0;
+            i = end - buf + 6;
+            continue;
+        }
+        if (buf[i] == '\033') {
+            size_t n = escape_length(buf + i, len - i);
+            if (n == 0) {
+                /* Rest of it comes with the next read */
+                e->pending_len = len - i < sizeof(e->pending) ? len - i : 0;
+                memcpy(e->pending, buf + i, e->pending_len);
+                return 0;
+            }
+            handle_escape(e, buf + i, n);
+            i += n;
+            continue;
+        }
+        if ((unsigned char)buf[i] < 0x20 || buf[i] == 127) {
+            int done = handle_control(e, buf[i++]);
+            if (done > 0) {
+                /* Lines typed or pasted ahead wait their turn */
+                insert(&e->ahead, e->ahead.len, buf + i, len - i);
+            }
+            if (done != 0)
+                return done;
+            continue;
+        }
+        /* A run of ordinary characters goes in at once */
+        size_t start = i;
+        while (i < len && (unsigned char)buf[i] >= 0x20 && buf[i] != 127 && buf[i] != '\033')
+            i++;
+        if (e->searching) {
+            reverse_search_add(&e->search, buf + start, i - start);
+        } else {
+            insert(&e->line, e->cursor, buf + start, i - start);
+            e->cursor += i - start;
+        }
+    }
+    return 0;
+}
+
+/* True if input typed ahead is waiting */
+int edit_pending(line_editor *e) {
+    return e->ahead.len > 0;
+}
+
+/* Handle whatever input is ready, what was typed ahead first */
+int edit_input(line_editor *e, char **line, size_t *len) {
+    char buf[EDIT_READ_SIZE + sizeof(e->pending)];
+    size_t have = e->pending_len;
+    ssize_t n;
+    int done;
+
+    if (e->ahead.len > 0) {
+        /* Handling it can queue what comes after the next Enter */
+        edit_string ahead = e->ahead;
+        memset(&e->ahead, 0, sizeof(edit_string));
+        done = handle_input(e, ahead.data, ahead.len);
+        free(ahead.data);
+    } else {
+        memcpy(buf, e->pending, have);
+        e->pending_len = 0;
+        n = read(e->fd, buf + have, EDIT_READ_SIZE);
+        if (n < 0) {
+            if (errno == EINTR)
+                return 0;
+            perror("read");
+            exit(1);
+        }
+        if (n == 0) {
+            leave_raw_mode(e);
+            return -1;
+        }
+        done = handle_input(e, buf, have + n);
+    }
+    if (done > 0 && e->searching)
+        accept_search(e);
+    if (done > 0)
+        e->cursor = e->line.len;
+    refresh(e);
+    if (done == 0)
+        return 0;
+    output(e, "\r\n");
+    leave_raw_mode(e);
+    if (done < 0)
+        return -1;
+    reserve(&e->line, e->line.len + 1);
+    e->line.data[e->line.len] = '\0';
+    *line = e->line.data;
+    *len = e->line.len;
+    return 1;
+}
+
+/* Move the cursor to the end of the line */
+void suspend_line(line_editor *e) {
+    move_cursor(e, columns(e->shown.data, e->shown_cursor),
+            columns(e->shown.data, e->shown.len));
+    e->shown_cursor = e->shown.len;
+    flush_output(e);
+}
+
+/* Draw the line again after a fresh prompt */
+void redraw_line(line_editor *e) {
+    e->shown.len = 0;
+    e->shown_cursor = 0;
+    refresh(e);
+}
+
+/* Rows from the prompt's last line down to the cursor */
+int cursor_row(line_editor *e) {
+    return (e->prompt_width + columns(e->shown.data, e->shown_cursor)) / e->columns;
+}
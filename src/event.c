@@ -0,0 +1,114 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include "event.h"
+
+#define MAX_EVENTS 16
+
+static int epoll_fd = -1;
+static int child_fd = -1; /* signalfd for SIGCHLD */
+
+/* epoll refuses regular files (EPERM), but reading them never
+ * blocks, so tags for those fds are just always ready.
+ */
+static int always_ready = 0;
+
+/* Signal mask before we blocked SIGCHLD */
+static sigset_t saved_mask;
+
+/* Block SIGCHLD so it is only delivered through the signalfd.
+ * This means we never run code from a signal handler while the
+ * process list is being modified, which is why the old loop
+ * polled with select() instead of handling SIGCHLD.
+ */
+void init_events() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, &saved_mask) < 0) {
+        perror("sigprocmask");
+        exit(1);
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    child_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (child_fd < 0) {
+        perror("signalfd");
+        exit(1);
+    }
+    if (add_event_fd(child_fd, EVENT_CHILD) < 0) {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+/* Watch fd and report it with tag when it is readable */
+int add_event_fd(int fd, int tag) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u32 = tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        if (errno == EPERM) {
+            always_ready |= tag;
+            return 0;
+        }
+        return -1;
+    }
+    return 0;
+}
+
+/* Stop watching fd */
+void remove_event_fd(int fd, int tag) {
+    always_ready &= ~tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Read everything queued on the signalfd. We don't care about
+ * the individual siginfo structs since the caller drains all
+ * children with waitpid(-1) anyway (signals can be merged).
+ */
+static void drain_child_fd() {
+    struct signalfd_siginfo info[8];
+    while (read(child_fd, info, sizeof(info)) > 0)
+        ;
+}
+
+/* Sleep until something happens */
+int wait_for_events(int timeout_ms) {
+    struct epoll_event events[MAX_EVENTS];
+    int ready = 0;
+
+    if (always_ready)
+        timeout_ms = 0;
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno == EINTR) /* Interrupted by signal (SIGINT asks for the history) */
+            return always_ready | EVENT_SIGNAL;
+        perror("epoll_wait");
+        exit(1);
+    }
+    for (int i = 0; i < n; i++) {
+        ready |= events[i].data.u32;
+    }
+    if (ready & EVENT_CHILD)
+        drain_child_fd();
+    return ready | always_ready;
+}
+
+/* Restore the signal mask the shell started with */
+void restore_signal_mask() {
+    sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+}
+
+/* The signal mask the shell started with */
+const sigset_t *get_saved_signal_mask() {
+    return &saved_mask;
+}
@@ -1,22 +1,71 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "io.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include "history.h"
+#include "stats.h"
 
-/* Index of the next command to be inserted
- * into the history array. Needs to be modded
- * by MAX_HISTORY to keep it in the range.
+/* History file and our read-only view of it. The map is grown
+ * with mremap() whenever the file gets bigger, either from our
+ * own appends or from another shell's.
  */
-static size_t next_command_index = 0;
+static int history_fd = -1;
+static char *history_map = NULL;
+static size_t map_size = 0;
 
-/* Array of pointers to history_info structs.
- * This is a circular array, so we need to
- * keep track of the next index to insert
- * a command into.
+/* Offset index: record i starts at offsets[i] * HISTORY_ALIGN.
+ * Storing offsets in HISTORY_ALIGN units keeps the index at 4
+ * bytes per command for files up to 32 GiB, and it is a single
+ * array instead of an allocation per command.
  */
-static history_info *history[MAX_HISTORY];
+static uint32_t *offsets = NULL;
+static size_t entry_count = 0;
+static size_t offsets_capacity = 0;
 
+/* How far into the file the index goes */
+static size_t scanned_size = 0;
+
+/* Times the file was found truncated and indexed from the start */
+static unsigned long truncations = 0;
+
+static uint32_t crc_table[256];
+
+/* Search index. Every command gets a 64 bit bloom filter of its
+ * trigrams, and every block of 64 commands gets a much bigger
+ * one (4096 bits) of all their trigrams. A substring search
+ * checks a few bits per block to skip whole blocks, then the
+ * per command filters, and only reads the text of commands that
+ * passed both. The prefix table maps the first 1, 2 and 3 bytes
+ * of a command to the (ascending) list of commands starting
+ * with them, which answers short prefix searches exactly.
+ */
+#define PREFIX_KEY_LENGTH 3
+#define BLOCK_SHIFT 6
+#define BLOCK_SIZE (1 << BLOCK_SHIFT)
+#define BLOCK_BITS 4096
+#define BLOCK_WORDS (BLOCK_BITS / 64)
+#define MAX_QUERY_TRIGRAMS 16
+
+typedef struct {
+    uint32_t key;      /* length << 24 | up to 3 bytes */
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *ids;     /* command indexes, oldest first */
+} prefix_list;
+
+static uint64_t *signatures = NULL;
+static size_t signatures_capacity = 0;
+static uint64_t *block_signatures = NULL; /* BLOCK_WORDS per block */
+static size_t indexed_count = 0;
+static unsigned long indexed_truncations = 0; /* truncations it was built after */
+static prefix_list *prefix_table = NULL;
+static size_t prefix_capacity = 0;
+static size_t prefix_used = 0;
 
 /* Used to make printing history look nice */
 static int get_digit_count(size_t num) {
@@ -28,120 +77,566 @@ static int get_digit_count(size_t num) {
     return count;
 }
 
-static int get_command_index(char *tokens[], int token_count);
+static void init_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32(const char *data, size_t len) {
+    uint32_t c = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; i++)
+        c = crc_table[(c ^ (unsigned char)data[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFF;
+}
+
+static size_t record_size(uint32_t length) {
+    return (sizeof(history_record) + length + 1 + HISTORY_ALIGN - 1) & ~(size_t)(HISTORY_ALIGN - 1);
+}
+
+static void add_offset(size_t offset) {
+    if (entry_count == offsets_capacity) {
+        offsets_capacity = offsets_capacity ? offsets_capacity * 2 : 1024;
+        offsets = realloc(offsets, offsets_capacity * sizeof(uint32_t));
+        if (offsets == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    offsets[entry_count++] = offset / HISTORY_ALIGN;
+}
+
+/* Map any part of the file added since we last looked and add
+ * its records to the index. Only the fixed size headers are
+ * read, so this hops over the file instead of reading it all.
+ * The command's NUL has to be where the length says, and a
+ * record is followed by another one or the end of the file. If
+ * it isn't the length may be damaged and the command's checksum
+ * decides. A damaged record is skipped by looking for the next
+ * magic.
+ */
+static void refresh_history() {
+    struct stat st;
+
+    if (history_fd < 0 || fstat(history_fd, &st) < 0)
+        return;
+    size_t size = st.st_size;
+    if (size == map_size)
+        return;
+    if (size < scanned_size) {
+        /* Someone truncated it, start over */
+        entry_count = 0;
+        scanned_size = 0;
+        truncations++;
+    }
+    if (size == 0) {
+        if (history_map != NULL)
+            munmap(history_map, map_size);
+        history_map = NULL;
+        map_size = 0;
+        return;
+    }
+
+    char *map;
+    if (history_map == NULL)
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+    else
+        map = mremap(history_map, map_size, size, MREMAP_MAYMOVE);
+    if (map == MAP_FAILED) {
+        perror("mmap history");
+        return;
+    }
+    history_map = map;
+    map_size = size;
+
+    size_t offset = scanned_size;
+    while (offset + sizeof(history_record) <= size) {
+        history_record *r = (history_record *)(history_map + offset);
+        if (r->magic != HISTORY_MAGIC) {
+            /* Damaged, look for the next record */
+            offset += HISTORY_ALIGN;
+            continue;
+        }
+        size_t rsize = record_size(r->length);
+        const char *command = (const char *)(r + 1);
+        size_t next = offset + rsize;
+        if (r->length > HISTORY_MAX_COMMAND) {
+            offset += HISTORY_ALIGN;
+            continue;
+        }
+        if (next > size) {
+            /* Still being written, unless a NUL shows the command
+             * already ended and the length is wrong
+             */
+            size_t shown = size - offset - sizeof(history_record);
+            if (memchr(command, '\0', shown) == NULL)
+                break;
+            offset += HISTORY_ALIGN;
+            continue;
+        }
+        if (command[r->length] != '\0' || (next + sizeof(uint32_t) <= size &&
+                    *(uint32_t *)(history_map + next) != HISTORY_MAGIC &&
+                    r->checksum != crc32(command, r->length))) {
+            offset += HISTORY_ALIGN;
+            continue;
+        }
+        add_offset(offset);
+        offset += rsize;
+    }
+    scanned_size = offset;
+}
 
-/* Add a command to the history */
+/* Open the file named by HISTFILE or ~/.cwsh_history. If we
+ * can't, history is kept in an anonymous memory file so the
+ * rest of the code doesn't care.
+ */
+void init_history() {
+    const char *file = getenv("HISTFILE");
+    char *path = NULL;
+
+    init_crc_table();
+    if (file == NULL) {
+        const char *home = getenv("HOME");
+        if (home != NULL) {
+            path = malloc(strlen(home) + strlen(HISTORY_FILE) + 2);
+            if (path == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+            sprintf(path, "%s/%s", home, HISTORY_FILE);
+            file = path;
+        }
+    }
+    if (file != NULL)
+        history_fd = open(file, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (history_fd < 0)
+        history_fd = memfd_create("history", MFD_CLOEXEC);
+    free(path);
+    refresh_history();
+}
+
+/* Add a command to the history. The record goes out in one
+ * write() so it lands in one piece even with other shells
+ * appending at the same time.
+ */
 void add_to_history(char *command) {
-    size_t insert_index = next_command_index % MAX_HISTORY;
-    /* Since revolving array, free the old command being pushed out */
-    if (history[insert_index] != NULL) {
-        free_history(history[insert_index]);
-        history[insert_index] = NULL;
+    size_t len = strlen(command);
+    STAT_INC(history_adds);
+    /* Trailing newline isn't part of the command */
+    while (len > 0 && (command[len - 1] == '\n' || command[len - 1] == ' '))
+        len--;
+    if (len == 0 || len > HISTORY_MAX_COMMAND || history_fd < 0)
+        return;
+
+    size_t rsize = record_size(len);
+    char *buf = calloc(1, rsize);
+    if (buf == NULL) {
+        perror("calloc");
+        exit(1);
     }
-    history[insert_index] = malloc(sizeof(history_info));
-    history[insert_index]->command = malloc(sizeof(char) * (strlen(command) + 1));
-    strcpy(history[insert_index]->command, command);
-    history[insert_index]->command_index = next_command_index;
-    next_command_index++;
+    history_record *r = (history_record *)buf;
+    r->magic = HISTORY_MAGIC;
+    r->length = len;
+    r->checksum = crc32(command, len);
+    r->time = time(NULL);
+    memcpy(buf + sizeof(history_record), command, len);
+    if (write(history_fd, buf, rsize) != (ssize_t)rsize)
+        perror("write history");
+    free(buf);
+    refresh_history();
+}
+
+/* Number of commands in the history */
+size_t history_count() {
+    return entry_count;
 }
 
-/* Print the history */
+/* Command at index or NULL if its record is damaged */
+const char *history_entry(size_t index, size_t *len) {
+    if (index >= entry_count)
+        return NULL;
+    history_record *r = (history_record *)(history_map + (size_t)offsets[index] * HISTORY_ALIGN);
+    const char *command = (const char *)(r + 1);
+    /* Checked lazily so opening a huge history stays cheap */
+    if (r->checksum != crc32(command, r->length))
+        return NULL;
+    if (len != NULL)
+        *len = r->length;
+    return command;
+}
+
+/* Print the history. The caller draws the prompt again. */
 void print_history(int status) {
     printf("\nCommand History:\n");
-    int i;
-    if (next_command_index < MAX_HISTORY) {
-        i = 0;
-    } else {
-        i = next_command_index - MAX_HISTORY;
-    }
-    for (int cnt = 0; cnt < MAX_HISTORY; cnt++, i++) {
-        i = i % MAX_HISTORY;
-        if (history[i] != NULL && history[i]->command != NULL) {
-            printf("[%lu]", history[i]->command_index + 1);
-            int digit_count = get_digit_count(history[i]->command_index + 1);
-            /* Print spaces to make the history look nice */
-            for (int j = 0; j < 3 - digit_count; j++) {
-                printf(" ");
-            }
-            printf(" %s", history[i]->command);
+    refresh_history();
+    size_t i = entry_count < MAX_HISTORY ? 0 : entry_count - MAX_HISTORY;
+    for (; i < entry_count; i++) {
+        const char *command = history_entry(i, NULL);
+        if (command == NULL)
+            continue;
+        printf("[%lu]", i + 1);
+        int digit_count = get_digit_count(i + 1);
+        /* Print spaces to make the history look nice */
+        for (int j = 0; j < 3 - digit_count; j++) {
+            printf(" ");
         }
+        printf(" %s\n", command);
     }
-    /* reprint prompt */
-    printf("%s", get_prompt_string(NULL));
 }
 
-/* Fetch a command from the history */
+/* Join the words after "r" back into one string */
+static char *join_tokens(char *tokens[], int token_count, size_t *len) {
+    size_t total = 0;
+    for (int i = 0; i < token_count; i++)
+        total += strlen(tokens[i]) + 1;
+    char *joined = malloc(total + 1), *w = joined;
+    if (joined == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    for (int i = 0; i < token_count; i++) {
+        size_t l = strlen(tokens[i]);
+        memcpy(w, tokens[i], l);
+        w += l;
+        *w++ = ' ';
+    }
+    if (w > joined)
+        w--;
+    *w = '\0';
+    *len = w - joined;
+    return joined;
+}
+
+/* Fetch a command from the history. "r" is the last command,
+ * "r 14" is command 14, "r -s text" is the last command with
+ * text in it and "r text" the last one starting with text.
+ */
 char *fetch_command(char *tokens[], int token_count) {
-    int command_index = -1;
+    long command_index = -1;
+    STAT_INC(history_fetches);
+    refresh_history();
     if (token_count < 2) {
-        /* grab most recent command, -2 here because we already entered
-         * r x into history
-         */
-        command_index = next_command_index - 2;
+        /* grab most recent command, "r" itself is never added */
+        command_index = (long)entry_count - 1;
+    } else if (token_count == 2 && strspn(tokens[1], "0123456789") == strlen(tokens[1])) {
+        command_index = atol(tokens[1]) - 1;
+        if (command_index < 0 || (size_t)command_index >= entry_count)
+            command_index = -1;
     } else {
-        command_index = get_command_index(tokens, token_count);
-        if (command_index == -1) {
-            /* no match found */
-            fprintf(stderr, "No match found for ");
-            for (int i = 1; i < token_count; i++) {
-                fprintf(stderr, "%s ", tokens[i]);
-            }
-            fprintf(stderr, "\n");
-            next_command_index--; /* overwrite r x in history */
-            free_history(history[next_command_index % MAX_HISTORY]);
-            history[next_command_index % MAX_HISTORY] = NULL;
-            return NULL;
+        int substring = strcmp(tokens[1], "-s") == 0 && token_count > 2;
+        int skip = substring ? 2 : 1;
+        size_t len;
+        char *query = join_tokens(tokens + skip, token_count - skip, &len);
+        command_index = search_history(query, len,
+                substring ? HISTORY_SUBSTRING : HISTORY_PREFIX, entry_count);
+        free(query);
+    }
+    if (command_index < 0) {
+        /* no match found */
+        fprintf(stderr, "No match found for ");
+        for (int i = 1; i < token_count; i++) {
+            fprintf(stderr, "%s ", tokens[i]);
+        }
+        fprintf(stderr, "\n");
+        return NULL;
+    }
+    return (char *)history_entry(command_index, NULL);
+}
+
+/* Record i without checking its checksum */
+static const char *raw_entry(size_t index, size_t *len) {
+    history_record *r = (history_record *)(history_map + (size_t)offsets[index] * HISTORY_ALIGN);
+    *len = r->length;
+    return (const char *)(r + 1);
+}
+
+static uint64_t trigram_hash(const char *t) {
+    uint64_t g = ((uint64_t)(unsigned char)t[0] << 16) |
+        ((uint64_t)(unsigned char)t[1] << 8) | (unsigned char)t[2];
+    return g * 0x9E3779B97F4A7C15ULL;
+}
+
+/* Bit for a trigram in a command's signature */
+static uint64_t trigram_bit(uint64_t hash) {
+    return 1ULL << (hash >> 58);
+}
+
+/* Bit number for a trigram in a block's signature */
+static size_t trigram_block_bit(uint64_t hash) {
+    return (hash >> 20) & (BLOCK_BITS - 1);
+}
+
+/* Bloom filter of every trigram in the text. If a command
+ * contains a query, the command's signature has every bit of the
+ * query's signature set, so most commands are ruled out with one
+ * AND without looking at their text.
+ */
+static uint64_t text_signature(const char *text, size_t len) {
+    uint64_t sig = 0;
+    for (size_t i = 0; i + 3 <= len; i++)
+        sig |= trigram_bit(trigram_hash(text + i));
+    return sig;
+}
+
+static uint32_t prefix_key(const char *text, size_t len) {
+    uint32_t key = (uint32_t)len << 24;
+    for (size_t i = 0; i < len; i++)
+        key |= (uint32_t)(unsigned char)text[i] << (16 - 8 * i);
+    return key;
+}
+
+/* Find the list for key or the empty slot it goes in */
+static prefix_list *find_prefix_list(uint32_t key) {
+    size_t mask = prefix_capacity - 1;
+    size_t i = (key * 2654435761U) & mask;
+    while (prefix_table[i].ids != NULL && prefix_table[i].key != key)
+        i = (i + 1) & mask;
+    return &prefix_table[i];
+}
+
+static void grow_prefix_table() {
+    prefix_list *old = prefix_table;
+    size_t old_capacity = prefix_capacity;
+
+    prefix_capacity = prefix_capacity ? prefix_capacity * 2 : 1024;
+    prefix_table = calloc(prefix_capacity, sizeof(prefix_list));
+    if (prefix_table == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].ids != NULL)
+            *find_prefix_list(old[i].key) = old[i];
+    }
+    free(old);
+}
+
+static void add_to_prefix_list(uint32_t key, uint32_t index) {
+    if ((prefix_used + 1) * 4 > prefix_capacity * 3)
+        grow_prefix_table();
+    prefix_list *l = find_prefix_list(key);
+    if (l->ids == NULL) {
+        l->key = key;
+        prefix_used++;
+    }
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? l->capacity * 2 : 4;
+        l->ids = realloc(l->ids, l->capacity * sizeof(uint32_t));
+        if (l->ids == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    l->ids[l->count++] = index;
+}
+
+/* Forget every command in the search index, keeping the memory
+ * of the signatures.
+ */
+static void clear_search_index() {
+    for (size_t i = 0; i < prefix_capacity; i++)
+        free(prefix_table[i].ids);
+    if (prefix_table != NULL)
+        memset(prefix_table, 0, prefix_capacity * sizeof(prefix_list));
+    prefix_used = 0;
+    if (signatures != NULL) {
+        memset(signatures, 0, signatures_capacity * sizeof(uint64_t));
+        memset(block_signatures, 0,
+                (signatures_capacity >> BLOCK_SHIFT) * BLOCK_WORDS * sizeof(uint64_t));
+    }
+    indexed_count = 0;
+}
+
+/* Add every command the index doesn't cover yet. Nothing is
+ * built until the first search, so a shell that never searches
+ * doesn't pay for it.
+ */
+static void update_search_index() {
+    refresh_history();
+    if (indexed_truncations != truncations) {
+        /* The file was truncated, the commands are different ones */
+        clear_search_index();
+        indexed_truncations = truncations;
+    }
+    if (indexed_count == entry_count)
+        return;
+    if (signatures_capacity < entry_count) {
+        size_t old_blocks = signatures_capacity >> BLOCK_SHIFT;
+        signatures_capacity = (offsets_capacity + BLOCK_SIZE - 1) & ~(size_t)(BLOCK_SIZE - 1);
+        size_t blocks = signatures_capacity >> BLOCK_SHIFT;
+        signatures = realloc(signatures, signatures_capacity * sizeof(uint64_t));
+        block_signatures = realloc(block_signatures, blocks * BLOCK_WORDS * sizeof(uint64_t));
+        if (signatures == NULL || block_signatures == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        memset(block_signatures + old_blocks * BLOCK_WORDS, 0,
+                (blocks - old_blocks) * BLOCK_WORDS * sizeof(uint64_t));
+    }
+    for (; indexed_count < entry_count; indexed_count++) {
+        size_t len;
+        const char *text = raw_entry(indexed_count, &len);
+        uint64_t *block = block_signatures + (indexed_count >> BLOCK_SHIFT) * BLOCK_WORDS;
+        uint64_t sig = 0;
+        for (size_t i = 0; i + 3 <= len; i++) {
+            uint64_t hash = trigram_hash(text + i);
+            size_t bit = trigram_block_bit(hash);
+            sig |= trigram_bit(hash);
+            block[bit / 64] |= 1ULL << (bit % 64);
         }
+        signatures[indexed_count] = sig;
+        for (size_t k = 1; k <= PREFIX_KEY_LENGTH && k <= len; k++)
+            add_to_prefix_list(prefix_key(text, k), indexed_count);
     }
-    command_index = command_index % MAX_HISTORY;
-    next_command_index--; /* overwrite r x in history */
-    return history[command_index]->command;
-}
-
-/* Free allocated memory for and in the history_info struct */
-void free_history(history_info *hinfo) {
-    if (hinfo->command != NULL) {
-        free(hinfo->command);
-    }
-    free(hinfo);
-}
-
-static int get_command_index(char *tokens[], int token_count) {
-    int command_index = -1;
-    int total_token_len = 0;
-    fprintf(stderr, "token_count: %d\n", token_count);
-    for (int i = 1; i < token_count; i++) {
-        fprintf(stderr, "token: %s\n", tokens[i]);
-        total_token_len += strlen(tokens[i]) + 1;
-    }
-    int start = next_command_index % MAX_HISTORY;
-    for (int i = 0; i < MAX_HISTORY; i++) {
-        int index = (start + i) % MAX_HISTORY;
-        if (history[index] == NULL) continue;
-        if (history[index]->command == NULL) continue;
-
-        int command_len = strlen(history[index]->command);
-        if (command_len < total_token_len) continue;
-        /* Compare strings */
-        int cascade_len = 0;
-        for (int j = 1; j < token_count; j++) {
-            int token_len = strlen(tokens[j]);
-            for (int k = 0; k < token_len; k++) {
-                if (tokens[j][k] == '\0')
-                    goto getout;
-                if (history[index]->command[k + cascade_len] != tokens[j][k])
-                    goto getout;
-                if (k == strlen(tokens[j]) - 1 && history[index]->command[k + cascade_len] == tokens[j][k]) {
-                    /* found a match */
-                    if (j == token_count - 1) command_index = history[index]->command_index;
-                    break;
-                }
+}
+
+/* Check a candidate really matches and isn't damaged */
+static int entry_matches(size_t index, const char *query, size_t len, history_search_mode mode) {
+    size_t text_len;
+    const char *text = raw_entry(index, &text_len);
+    if (text_len < len)
+        return 0;
+    if (mode == HISTORY_PREFIX) {
+        if (memcmp(text, query, len) != 0)
+            return 0;
+    } else if (memmem(text, text_len, query, len) == NULL) {
+        return 0;
+    }
+    return history_entry(index, NULL) != NULL;
+}
+
+/* Walk back from before through blocks whose signature has
+ * every query trigram, checking the commands in them.
+ */
+static long scan_blocks(const char *query, size_t len, history_search_mode mode, size_t before) {
+    size_t bits[MAX_QUERY_TRIGRAMS];
+    size_t bit_count = 0;
+    uint64_t qsig = 0;
+
+    /* A handful of trigrams spread over the query is plenty.
+     * Go from the end since that is usually the part that tells
+     * commands apart ("git commit -m ...").
+     */
+    if (len >= 3) {
+        size_t trigrams = len - 2;
+        size_t step = (trigrams + MAX_QUERY_TRIGRAMS - 1) / MAX_QUERY_TRIGRAMS;
+        for (size_t i = trigrams; i-- > 0 && bit_count < MAX_QUERY_TRIGRAMS; ) {
+            if ((trigrams - 1 - i) % step != 0)
+                continue;
+            bits[bit_count++] = trigram_block_bit(trigram_hash(query + i));
+        }
+        qsig = text_signature(query, len);
+    }
+
+    size_t i = before;
+    while (i > 0) {
+        size_t block_start = (i - 1) & ~(size_t)(BLOCK_SIZE - 1);
+        const uint64_t *block = block_signatures + (block_start >> BLOCK_SHIFT) * BLOCK_WORDS;
+        size_t b;
+        for (b = 0; b < bit_count; b++) {
+            if (!(block[bits[b] / 64] & (1ULL << (bits[b] % 64))))
+                break;
+        }
+        if (b == bit_count) {
+            for (; i > block_start; i--) {
+                if ((signatures[i - 1] & qsig) == qsig &&
+                        entry_matches(i - 1, query, len, mode))
+                    return i - 1;
             }
-            cascade_len += token_len + 1;
         }
-getout:
-        if (command_index != -1) break;
+        i = block_start;
+    }
+    return -1;
+}
+
+/* Most recent command before index before matching the query */
+long search_history(const char *query, size_t len, history_search_mode mode, size_t before) {
+    STAT_INC(history_searches);
+    update_search_index();
+    if (before > entry_count)
+        before = entry_count;
+    if (len == 0)
+        return before > 0 ? (long)before - 1 : -1;
+    if (mode == HISTORY_SUBSTRING || len > PREFIX_KEY_LENGTH)
+        return scan_blocks(query, len, mode, before);
+
+    /* Short prefix, the list is exactly the commands we want */
+    prefix_list *l = find_prefix_list(prefix_key(query, len));
+    if (l->ids == NULL)
+        return -1;
+    /* ids are in order, find where before falls */
+    size_t lo = 0, hi = l->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (l->ids[mid] < before)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    fprintf(stderr, "command_index: %d\n", command_index);
-    return command_index;
+    while (lo-- > 0) {
+        if (history_entry(l->ids[lo], NULL) != NULL)
+            return l->ids[lo];
+    }
+    return -1;
+}
+
+/* Start an incremental reverse search with an empty query */
+void start_reverse_search(reverse_search *rs) {
+    rs->query = NULL;
+    rs->len = 0;
+    rs->capacity = 0;
+    rs->match = -1;
+    rs->failed = 0;
+}
+
+/* Type more of the query. The current match is kept if it still
+ * matches since anything newer already failed the shorter query.
+ */
+long reverse_search_add(reverse_search *rs, const char *text, size_t len) {
+    if (rs->len + len + 1 > rs->capacity) {
+        char *query = realloc(rs->query, (rs->len + len + 1) * 2);
+        if (query == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+        rs->query = query;
+        rs->capacity = (rs->len + len + 1) * 2;
+    }
+    memcpy(rs->query + rs->len, text, len);
+    rs->len += len;
+    rs->query[rs->len] = '\0';
+    if (rs->failed)
+        return -1;
+    size_t before = rs->match >= 0 ? (size_t)rs->match + 1 : history_count();
+    rs->match = search_history(rs->query, rs->len, HISTORY_SUBSTRING, before);
+    rs->failed = rs->match < 0;
+    return rs->match;
+}
+
+/* Remove the last byte of the query and search again */
+long reverse_search_delete(reverse_search *rs) {
+    if (rs->len > 0)
+        rs->query[--rs->len] = '\0';
+    rs->match = search_history(rs->query, rs->len, HISTORY_SUBSTRING, history_count());
+    rs->failed = rs->match < 0;
+    return rs->match;
+}
+
+/* Go to the next older match */
+long reverse_search_next(reverse_search *rs) {
+    if (rs->match < 0)
+        return -1;
+    long older = search_history(rs->query, rs->len, HISTORY_SUBSTRING, rs->match);
+    if (older >= 0)
+        rs->match = older;
+    return older;
+}
+
+/* Free the search state */
+void end_reverse_search(reverse_search *rs) {
+    free(rs->query);
+    start_reverse_search(rs);
 }
@@ -1,8 +1,126 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "io.h"
+#include "prompt.h"
 
-/* Wrapped in function in case I want to change it later
- * to something more complex
- */
+/* The prompt for pinfo, built from segments */
 char *get_prompt_string(prompt_info *pinfo) {
-    return PROMPT_STRING;
+    return render_prompt(pinfo);
+}
+
+/* Read lines from fd */
+void init_line_reader(line_reader *r, int fd) {
+    r->fd = fd;
+    r->buf = NULL;
+    r->capacity = 0;
+    r->start = r->scanned = r->end = 0;
+    r->eof = 0;
+    r->seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+    r->synced = -1;
+}
+
+/* Free the reader's buffer */
+void free_line_reader(line_reader *r) {
+    free(r->buf);
+    r->buf = NULL;
+    r->capacity = 0;
+    r->start = r->scanned = r->end = 0;
+}
+
+/* Make room for another read(), keeping the unread bytes */
+static void make_room(line_reader *r) {
+    if (r->start > 0) {
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+    }
+    /* One extra byte for the NUL after the last line */
+    if (r->capacity - r->end < READ_SIZE + 1) {
+        r->capacity = r->capacity ? r->capacity * 2 : READ_SIZE * 2;
+        r->buf = realloc(r->buf, r->capacity);
+        if (r->buf == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+}
+
+/* Get the next line. Each byte is looked at once by memchr()
+ * however many reads a long line takes.
+ */
+int read_line(line_reader *r, char **line, size_t *len) {
+    char *nl;
+    ssize_t n;
+
+    while (1) {
+        size_t from = r->start + r->scanned;
+        nl = r->end > from ? memchr(r->buf + from, '\n', r->end - from) : NULL;
+        if (nl != NULL) {
+            *line = r->buf + r->start;
+            *len = nl - *line;
+            *nl = '\0';
+            r->start = nl + 1 - r->buf;
+            r->scanned = 0;
+            return 1;
+        }
+        r->scanned = r->end - r->start;
+        if (r->eof) {
+            if (r->start == r->end)
+                return 0;
+            /* Last line without a newline */
+            *line = r->buf + r->start;
+            *len = r->end - r->start;
+            r->buf[r->end] = '\0';
+            r->start = r->end;
+            r->scanned = 0;
+            return 1;
+        }
+
+        make_room(r);
+        n = read(r->fd, r->buf + r->end, r->capacity - r->end - 1);
+        if (n < 0) {
+            if (errno == EINTR) /* Interrupted by signal, restart read */
+                continue;
+            perror("read");
+            exit(1);
+        }
+        if (n == 0)
+            r->eof = 1;
+        r->end += n;
+    }
+}
+
+/* True if a whole line is already buffered */
+int line_buffered(line_reader *r) {
+    size_t from = r->start + r->scanned;
+    if (r->end > from && memchr(r->buf + from, '\n', r->end - from) != NULL)
+        return 1;
+    return r->eof && r->start < r->end;
+}
+
+/* Seek back to the first unread byte */
+void sync_line_reader(line_reader *r) {
+    if (!r->seekable || r->start == r->end)
+        return;
+    r->synced = lseek(r->fd, -(off_t)(r->end - r->start), SEEK_CUR);
+}
+
+/* Undo sync_line_reader(). Two lseek()s instead of reading the
+ * buffer again when nothing else touched the fd, which is almost
+ * always.
+ */
+void resume_line_reader(line_reader *r) {
+    if (r->synced < 0)
+        return;
+    if (lseek(r->fd, 0, SEEK_CUR) == r->synced) {
+        lseek(r->fd, r->end - r->start, SEEK_CUR);
+    } else {
+        /* Someone read some of it, what's buffered is stale */
+        r->start = r->scanned = r->end = 0;
+        r->eof = 0;
+    }
+    r->synced = -1;
 }
@@ -1,15 +1,34 @@
 #include "job.h"
+#include "stats.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Init process to default state */
 process *init_process(process *p) {
     p->argv = NULL;
+    p->path = NULL;
+    p->builtin = NULL;
+    p->pid = 0;
+    p->pgid = 0;
+    p->infile = -1;
+    p->outfile = -1;
+    p->redirects = NULL;
+    p->redirect_count = 0;
+    p->assignments = NULL;
+    p->assignment_count = 0;
+    p->envp = NULL;
+    p->placement = NULL;
     p->next = NULL;
     p->completed = 0;
     p->stopped = 0;
     p->status = 0;
     p->foreground = 1;
+    memset(&p->spawn_time, 0, sizeof(p->spawn_time));
+    memset(&p->exec_time, 0, sizeof(p->exec_time));
+    memset(&p->exit_time, 0, sizeof(p->exit_time));
+    memset(&p->usage, 0, sizeof(p->usage));
     return p;
 }
 
@@ -52,13 +71,223 @@ process *find_process(process *head, pid_t pid) {
     return NULL;
 }
 
-/* Free the memory associated with a process.
- * But not the pointer to the process itself
+/* Init job to default state */
+job *init_job(job *j) {
+    j->first_process = NULL;
+    j->id = 0;
+    j->slot = 0;
+    j->pgid = 0;
+    j->foreground = 1;
+    j->timed = 0;
+    j->placement = NULL;
+    j->arena = NULL;
+    return j;
+}
+
+/* Init an empty job table */
+void init_job_table(job_table *t) {
+    t->jobs = NULL;
+    t->job_count = 0;
+    t->jobs_capacity = 0;
+    t->by_id = NULL;
+    t->id_capacity = 0;
+    t->free_ids = NULL;
+    t->free_count = 0;
+    t->free_capacity = 0;
+    t->pids = NULL;
+    t->pid_count = 0;
+    t->pid_capacity = 0;
+}
+
+static void *grow_array(void *array, size_t *capacity, size_t size) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    array = realloc(array, *capacity * size);
+    if (array == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    return array;
+}
+
+static size_t pid_slot(pid_t pid, size_t capacity) {
+    return ((uint32_t)pid * 2654435761U) & (capacity - 1);
+}
+
+/* Find the entry for pid or the empty entry it would go in */
+static pid_entry *find_pid_entry(job_table *t, pid_t pid) {
+    size_t mask = t->pid_capacity - 1;
+    size_t i = pid_slot(pid, t->pid_capacity);
+    while (t->pids[i].pid != 0 && t->pids[i].pid != pid)
+        i = (i + 1) & mask;
+    return &t->pids[i];
+}
+
+static void grow_pids(job_table *t) {
+    pid_entry *old = t->pids;
+    size_t old_capacity = t->pid_capacity;
+
+    t->pid_capacity = old_capacity ? old_capacity * 2 : 64;
+    t->pids = calloc(t->pid_capacity, sizeof(pid_entry));
+    if (t->pids == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].pid != 0)
+            *find_pid_entry(t, old[i].pid) = old[i];
+    }
+    free(old);
+}
+
+/* Remove pid, shifting later entries of its probe run back so
+ * no tombstones are needed. A reaped pid can be reused by a newer
+ * job before its own job is done, so leave it if it moved on.
  */
-void free_process(process *p) {
-    if (p->argv == NULL)
+static void delete_pid(job_table *t, pid_t pid, job *j) {
+    size_t mask = t->pid_capacity - 1;
+    pid_entry *e = find_pid_entry(t, pid);
+    if (e->pid == 0 || e->job != j)
         return;
-    for (int i = 0; p->argv[i] != NULL; i++)
-        free(p->argv[i]);
-    free(p->argv);
+    size_t hole = e - t->pids, k = hole;
+    t->pids[hole].pid = 0;
+    t->pid_count--;
+    while (1) {
+        k = (k + 1) & mask;
+        if (t->pids[k].pid == 0)
+            return;
+        /* Move it into the hole unless its home is in (hole, k] */
+        size_t home = pid_slot(t->pids[k].pid, t->pid_capacity);
+        if ((k > hole && (home <= hole || home > k)) ||
+                (k < hole && (home <= hole && home > k))) {
+            t->pids[hole] = t->pids[k];
+            t->pids[k].pid = 0;
+            hole = k;
+        }
+    }
+}
+
+/* Add a launched job to the table and give it a job number */
+job *insert_job(job_table *t, job *j) {
+    process *p;
+
+    if (t->job_count == t->jobs_capacity)
+        t->jobs = grow_array(t->jobs, &t->jobs_capacity, sizeof(job *));
+    j->slot = t->job_count;
+    t->jobs[t->job_count++] = j;
+    STAT_INC(jobs_inserted);
+    if (t->job_count > stats.jobs_peak)
+        stats.jobs_peak = t->job_count;
+
+    /* Reuse a freed number if there is one */
+    if (t->free_count > 0) {
+        j->id = t->free_ids[--t->free_count];
+    } else {
+        if ((size_t)t->job_count > t->id_capacity) {
+            size_t old_capacity = t->id_capacity;
+            t->by_id = grow_array(t->by_id, &t->id_capacity, sizeof(job *));
+            /* Ids past the highest one handed out must read as free */
+            memset(t->by_id + old_capacity, 0,
+                    (t->id_capacity - old_capacity) * sizeof(job *));
+        }
+        j->id = t->job_count;
+    }
+    t->by_id[j->id - 1] = j;
+
+    for (p = j->first_process; p; p = p->next) {
+        if (p->pid == 0)
+            continue; /* Never started */
+        if ((t->pid_count + 1) * 4 > t->pid_capacity * 3)
+            grow_pids(t);
+        pid_entry *e = find_pid_entry(t, p->pid);
+        if (e->pid == 0)
+            t->pid_count++;
+        e->pid = p->pid;
+        e->process = p;
+        e->job = j;
+    }
+    return j;
+}
+
+/* Remove the job from the table. The last job moves into its
+ * place in the array.
+ */
+void delete_job(job_table *t, job *j) {
+    process *p;
+
+    for (p = j->first_process; p; p = p->next) {
+        if (p->pid != 0)
+            delete_pid(t, p->pid, j);
+    }
+    STAT_INC(jobs_deleted);
+    job *last = t->jobs[--t->job_count];
+    t->jobs[j->slot] = last;
+    last->slot = j->slot;
+
+    t->by_id[j->id - 1] = NULL;
+    if (t->job_count == 0) {
+        /* Start numbering from 1 again like other shells */
+        t->free_count = 0;
+    } else {
+        if (t->free_count == t->free_capacity)
+            t->free_ids = grow_array(t->free_ids, &t->free_capacity, sizeof(int));
+        t->free_ids[t->free_count++] = j->id;
+    }
+    j->id = 0;
+}
+
+/* Find the job with the job number id */
+job *find_job(job_table *t, int id) {
+    if (id < 1 || (size_t)id > t->id_capacity)
+        return NULL;
+    return t->by_id[id - 1];
+}
+
+/* Find the job and process with the indicated pid */
+job *find_job_by_pid(job_table *t, pid_t pid, process **p) {
+    if (t->pid_capacity == 0)
+        return NULL;
+    pid_entry *e = find_pid_entry(t, pid);
+    if (e->pid == 0)
+        return NULL;
+    *p = e->process;
+    return e->job;
+}
+
+/* True if every process in the job has completed. */
+int job_is_completed(job *j) {
+    process *p;
+    for (p = j->first_process; p; p = p->next)
+        if (!p->completed)
+            return 0;
+    return 1;
+}
+
+/* True if every process in the job has stopped or completed. */
+int job_is_stopped(job *j) {
+    process *p;
+    for (p = j->first_process; p; p = p->next)
+        if (!p->completed && !p->stopped)
+            return 0;
+    return 1;
+}
+
+/* Name used for the job in messages. */
+char *job_name(job *j) {
+    return j->first_process->argv[0];
+}
+
+/* Status of the last process in the pipeline, like other shells. */
+int job_status(job *j) {
+    process *p;
+    for (p = j->first_process; p->next; p = p->next)
+        ;
+    return p->status;
+}
+
+/* Release the job's hold on the arena it and its processes
+ * were allocated from. Everything from the command line goes
+ * away in one go once the last job from it is released.
+ */
+void free_job(job *j) {
+    arena_release(j->arena);
 }
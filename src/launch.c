@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "launch.h"
+#include "event.h"
+#include "pathcache.h"
+#include "builtin.h"
+#include "account.h"
+#include "stats.h"
+#include "placement.h"
+#include "spawnserver.h"
+#include "vars.h"
+
+pid_t shell_pgid;
+struct termios shell_tmodes;
+int shell_terminal;
+int shell_is_interactive;
+
+extern char **environ;
+
+static spawn_backend backend = SPAWN_FORK;
+
+/* Capacity to give pipes between processes, 0 keeps the default */
+static int pipe_size = 0;
+
+/* Stack the vfork child runs on until it calls exec. The parent
+ * is suspended during that time so one stack is enough.
+ */
+#define CHILD_STACK_SIZE (256 * 1024)
+static char *child_stack = NULL;
+
+/* Signals the shell changes and children need set back to default */
+static const int job_control_signals[] = {
+    SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD
+};
+#define JOB_CONTROL_SIGNAL_COUNT \
+    (sizeof(job_control_signals) / sizeof(job_control_signals[0]))
+
+/* Select the backend by name */
+int set_spawn_backend(const char *name) {
+    if (strcmp(name, "fork") == 0) {
+        backend = SPAWN_FORK;
+    } else if (strcmp(name, "vfork") == 0) {
+        backend = SPAWN_VFORK;
+    } else if (strcmp(name, "posix_spawn") == 0) {
+        backend = SPAWN_POSIX_SPAWN;
+    } else if (strcmp(name, "server") == 0) {
+        if (start_spawn_server() < 0)
+            return -1;
+        backend = SPAWN_SERVER;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+/* Name of the backend in use */
+const char *get_spawn_backend() {
+    switch (backend) {
+    case SPAWN_VFORK:
+        return "vfork";
+    case SPAWN_POSIX_SPAWN:
+        return "posix_spawn";
+    case SPAWN_SERVER:
+        return "server";
+    default:
+        return "fork";
+    }
+}
+
+/* Set the capacity of pipes in pipelines */
+int set_pipe_size(int size) {
+    if (size < 0)
+        return -1;
+    pipe_size = size;
+    return 0;
+}
+
+/* Open the file redirection r names, or give the fd it copies */
+static int redirect_source(const redirection *r) {
+    switch (r->type) {
+    case REDIRECT_IN:
+        return open(r->file, O_RDONLY | O_CLOEXEC);
+    case REDIRECT_OUT:
+        return open(r->file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    case REDIRECT_APPEND:
+        return open(r->file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+    default:
+        return r->target;
+    }
+}
+
+/* Put back the first count fds that were replaced, last first */
+static void restore_fds(process *p, saved_fd *saved, int count) {
+    while (count-- > 0) {
+        int fd = p->redirects[count].fd;
+        if (saved[count].copy < 0) {
+            close(fd);
+            continue;
+        }
+        dup3(saved[count].copy, fd, saved[count].flags & FD_CLOEXEC ? O_CLOEXEC : 0);
+        close(saved[count].copy);
+    }
+}
+
+/* Open p's redirections and put them in place. This runs in
+ * children that may share the shell's memory, so errors are
+ * written straight to stderr instead of going through stdio.
+ */
+int apply_redirections(process *p, saved_fd *saved) {
+    char message[512];
+
+    for (int i = 0; i < p->redirect_count; i++) {
+        const redirection *r = &p->redirects[i];
+        if (saved != NULL) {
+            saved[i].flags = fcntl(r->fd, F_GETFD);
+            saved[i].copy = saved[i].flags < 0 ? -1 : fcntl(r->fd, F_DUPFD_CLOEXEC, 10);
+        }
+        int fd = redirect_source(r);
+        if (fd < 0 || (fd != r->fd && dup2(fd, r->fd) < 0)) {
+            int len;
+            if (r->file != NULL)
+                len = snprintf(message, sizeof(message), "%s: %s\n", r->file, strerror(errno));
+            else
+                len = snprintf(message, sizeof(message), "%d: %s\n", r->target, strerror(errno));
+            write(STDERR_FILENO, message, len);
+            if (fd >= 0 && r->file != NULL)
+                close(fd);
+            if (saved != NULL)
+                restore_fds(p, saved, i + 1);
+            return -1;
+        }
+        if (r->file == NULL)
+            continue;
+        if (fd != r->fd)
+            close(fd);
+        else
+            fcntl(fd, F_SETFD, 0); /* Opened right where it goes, keep it across exec */
+    }
+    return 0;
+}
+
+/* Put back the fds apply_redirections() replaced */
+void restore_redirections(process *p, saved_fd *saved) {
+    restore_fds(p, saved, p->redirect_count);
+}
+
+/* Executes the process by replacing the current process
+ * with the process to be executed. Child calls this function.
+ * This may run on the shell's memory (vfork backend), so it
+ * must not touch stdio buffers or call exit().
+ */
+void execute_process(process *p) {
+    pid_t pgid = p->pgid ? p->pgid : getpid();
+
+    /* Put ourselves in the job's process group. The parent does
+     * this too, whoever runs first wins the race.
+     */
+    setpgid(0, pgid);
+
+    /* If shell isn't in foreground, then we can't
+     * set the process as foreground.
+     */
+    if (shell_is_interactive) {
+        if (p->foreground) {
+            /* Set this process group as the foreground process group for the terminal. */
+            tcsetpgrp(shell_terminal, pgid);
+        }
+
+        /* Children inherit the signal handlers of parent which
+         * was ignore, so we need to set them back to default
+         */
+        for (size_t i = 0; i < JOB_CONTROL_SIGNAL_COUNT; i++)
+            signal(job_control_signals[i], SIG_DFL);
+    }
+    /* The shell blocks SIGCHLD and blocked signals survive exec */
+    restore_signal_mask();
+    if (p->placement != NULL)
+        apply_placement(p->placement, 0);
+
+    /* Hook up the pipes. Every pipe fd is close-on-exec and dup2()
+     * clears that flag on the copy, so we don't need to close the
+     * originals or the ends meant for other processes.
+     */
+    if (p->infile >= 0)
+        dup2(p->infile, STDIN_FILENO);
+    if (p->outfile >= 0)
+        dup2(p->outfile, STDOUT_FILENO);
+    /* Then the redirections, so "cmd > file | ..." writes to file */
+    if (apply_redirections(p, NULL) < 0)
+        _exit(1);
+
+    if (p->builtin != NULL) {
+        /* Always a real fork, so stdio and environ are ours to use */
+        if (p->envp != NULL)
+            environ = p->envp;
+        int status = run_builtin(p->builtin, p->argv);
+        fflush(stdout);
+        _exit(status);
+    }
+    char **envp = p->envp != NULL ? p->envp : environ;
+    if (p->path != NULL) {
+        /* The shell already knows where the command is */
+        execve(p->path, p->argv, envp);
+        /* Removed since we looked it up, fall back to searching */
+    }
+    execvpe(p->argv[0], p->argv, envp); /* execvpe will search PATH for the command. */
+    perror("execvp");
+    _exit(1);
+}
+
+/* Entry point of the clone()'d child */
+static int vfork_child(void *arg) {
+    execute_process((process *)arg);
+    return 1;
+}
+
+/* clone(CLONE_VM | CLONE_VFORK) runs the child on our memory
+ * and suspends us until it calls exec, so no page tables are
+ * copied. All signals are blocked around the clone so none of
+ * the shell's handlers can run in the child while it still
+ * shares our memory, execute_process() restores the mask.
+ */
+static pid_t spawn_vfork(process *p) {
+    sigset_t all, old;
+    pid_t pid;
+
+    if (child_stack == NULL) {
+        child_stack = mmap(NULL, CHILD_STACK_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+        if (child_stack == MAP_FAILED) {
+            child_stack = NULL;
+            return -1;
+        }
+    }
+    sigfillset(&all);
+    sigprocmask(SIG_SETMASK, &all, &old);
+    pid = clone(vfork_child, child_stack + CHILD_STACK_SIZE,
+            CLONE_VM | CLONE_VFORK | SIGCHLD, p);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0)
+        perror("clone");
+    return pid;
+}
+
+/* posix_spawnp() can do everything execute_process() does
+ * through spawn attributes, including handing the terminal
+ * to a foreground child. Everything but the placement, which
+ * is applied to the child right after it exec'd.
+ */
+static pid_t spawn_posix(process *p) {
+    posix_spawnattr_t attr;
+    posix_spawn_file_actions_t actions;
+    sigset_t defaults;
+    short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK;
+    pid_t pid;
+    int err;
+
+    posix_spawnattr_init(&attr);
+    posix_spawn_file_actions_init(&actions);
+    posix_spawnattr_setpgroup(&attr, p->pgid);
+    if (p->infile >= 0)
+        posix_spawn_file_actions_adddup2(&actions, p->infile, STDIN_FILENO);
+    if (p->outfile >= 0)
+        posix_spawn_file_actions_adddup2(&actions, p->outfile, STDOUT_FILENO);
+    for (int i = 0; i < p->redirect_count; i++) {
+        const redirection *r = &p->redirects[i];
+        int oflag = r->type == REDIRECT_IN ? O_RDONLY :
+            O_WRONLY | O_CREAT | (r->type == REDIRECT_APPEND ? O_APPEND : O_TRUNC);
+        if (r->type == REDIRECT_DUP)
+            posix_spawn_file_actions_adddup2(&actions, r->target, r->fd);
+        else
+            posix_spawn_file_actions_addopen(&actions, r->fd, r->file, oflag, 0666);
+    }
+    posix_spawnattr_setsigmask(&attr, get_saved_signal_mask());
+    if (shell_is_interactive) {
+        sigemptyset(&defaults);
+        for (size_t i = 0; i < JOB_CONTROL_SIGNAL_COUNT; i++)
+            sigaddset(&defaults, job_control_signals[i]);
+        posix_spawnattr_setsigdefault(&attr, &defaults);
+        flags |= POSIX_SPAWN_SETSIGDEF;
+        if (p->foreground)
+            posix_spawn_file_actions_addtcsetpgrp_np(&actions, shell_terminal);
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    char **envp = p->envp != NULL ? p->envp : environ;
+    if (p->path != NULL)
+        err = posix_spawn(&pid, p->path, &actions, &attr, p->argv, envp);
+    else
+        err = posix_spawnp(&pid, p->argv[0], &actions, &attr, p->argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0) {
+        /* Unlike exec failing in a forked child, we find out here */
+        errno = err;
+        fprintf(stderr, "%s: %s\n", p->argv[0], strerror(err));
+        return -1;
+    }
+    if (p->placement != NULL)
+        apply_placement(p->placement, pid);
+    return pid;
+}
+
+/* Start p in its own process group using the selected backend.
+ * Errors are reported here so callers can just skip p.
+ */
+pid_t spawn_process(process *p) {
+    pid_t pid;
+    spawn_backend how = backend;
+
+    clock_now(&p->spawn_time);
+    p->builtin = find_builtin(p->argv[0]);
+    if (p->builtin != NULL) {
+        /* Builtins in a pipeline or in the background run in a
+         * forked copy of the shell, there's nothing to exec.
+         */
+        how = SPAWN_FORK;
+    } else {
+        p->path = lookup_command(p->argv[0]);
+    }
+    if (how == SPAWN_SERVER) {
+        pid = spawn_with_server(p);
+        if (pid < 0 && !spawn_server_running()) {
+            /* Lost the helper, start this one ourselves */
+            backend = how = SPAWN_FORK;
+        }
+    }
+    switch (how) {
+    case SPAWN_SERVER:
+        break;
+    case SPAWN_VFORK:
+        pid = spawn_vfork(p);
+        break;
+    case SPAWN_POSIX_SPAWN:
+        pid = spawn_posix(p);
+        break;
+    default:
+        pid = fork();
+        if (pid == 0) {
+            /* Child */
+            execute_process(p);
+        } else if (pid < 0) {
+            perror("fork");
+        }
+        break;
+    }
+    if (pid > 0) {
+        /* vfork and posix_spawn only return once the child exec'd */
+        clock_now(&p->exec_time);
+        STAT_INC(forks);
+        if (p->builtin == NULL)
+            STAT_INC(execs);
+        p->pid = pid;
+        /* Put the child in the job's process group. Fails harmlessly
+         * once the child has already called exec.
+         */
+        setpgid(pid, p->pgid ? p->pgid : pid);
+    } else {
+        STAT_INC(spawn_failures);
+    }
+    return pid;
+}
+
+/* Start every process in the job. They all run at the same
+ * time in one process group led by the first process, each
+ * connected to the next with a pipe. Without job control they
+ * join the shell's process group instead.
+ */
+int launch_job(job *j) {
+    int pipefd[2], infile = -1, started = 0;
+    process *p;
+
+    if (!shell_is_interactive)
+        j->pgid = shell_pgid;
+
+    for (p = j->first_process; p; p = p->next) {
+        p->foreground = j->foreground;
+        p->pgid = j->pgid;
+        p->placement = j->placement;
+        if (p->assignment_count > 0)
+            p->envp = environment_with(j->arena, p->assignments, p->assignment_count);
+        p->infile = infile;
+        p->outfile = -1;
+        if (p->next) {
+            if (pipe2(pipefd, O_CLOEXEC) < 0) {
+                perror("pipe");
+                /* Don't leave the earlier processes blocked on a pipe
+                 * that will never get its other end.
+                 */
+                if (infile >= 0)
+                    close(infile);
+                for (; p; p = p->next) {
+                    p->completed = 1;
+                    p->status = 1 << 8;
+                }
+                break;
+            }
+            /* Bigger pipes mean fewer context switches between
+             * processes passing lots of data.
+             */
+            if (pipe_size > 0 && fcntl(pipefd[1], F_SETPIPE_SZ, pipe_size) < 0)
+                perror("F_SETPIPE_SZ");
+            p->outfile = pipefd[1];
+        }
+
+        if (spawn_process(p) < 0) {
+            /* Report it like the shell couldn't find the command */
+            p->completed = 1;
+            p->status = 127 << 8;
+        } else {
+            started++;
+            if (j->pgid == 0)
+                j->pgid = p->pid;
+        }
+
+        /* The children have their own copies now */
+        if (p->infile >= 0)
+            close(p->infile);
+        if (p->outfile >= 0)
+            close(p->outfile);
+        infile = p->next ? pipefd[0] : -1;
+    }
+    return started;
+}
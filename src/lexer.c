@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "lexer.h"
+
+#define INITIAL_TOKENS 32
+
+/* Bytes that end a run of plain word characters. Anything
+ * below a space is in here too so the SIMD scan can catch
+ * blanks with a single compare, the slow path then treats the
+ * other control characters as plain.
+ */
+static const unsigned char special[256] = {
+    [0x00 ... 0x20] = 1,
+    ['\''] = 1, ['"'] = 1, ['\\'] = 1,
+    ['&'] = 1, ['|'] = 1, [';'] = 1, ['<'] = 1, ['>'] = 1,
+    ['$'] = 1, ['*'] = 1, ['?'] = 1, ['['] = 1,
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/* Find the first special byte in [p, end). Most of a command
+ * line is plain word characters, so this checks 16 bytes at a
+ * time with SSE2 (8 at a time without it) before falling back
+ * to the table for the tail.
+ */
+static char *scan_plain(char *p, char *end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i squote = _mm_set1_epi8('\'');
+    const __m128i dquote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i amp = _mm_set1_epi8('&');
+    const __m128i pipe = _mm_set1_epi8('|');
+    const __m128i semi = _mm_set1_epi8(';');
+    const __m128i less = _mm_set1_epi8('<');
+    const __m128i great = _mm_set1_epi8('>');
+    const __m128i dollar = _mm_set1_epi8('$');
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i question = _mm_set1_epi8('?');
+    const __m128i bracket = _mm_set1_epi8('[');
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        /* max(v, ' ') == ' ' means v <= ' ' (unsigned) */
+        __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, space), space);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, squote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, dquote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bslash));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, amp));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, pipe));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, semi));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, less));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, great));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, dollar));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, star));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, question));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, bracket));
+        int mask = _mm_movemask_epi8(m);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* Word at a time: a byte of x is zero iff the matching bit
+     * of (x - 0x01..) & ~x & 0x80.. is set, the lowest set bit is
+     * always exact.
+     */
+    const unsigned long long ones = 0x0101010101010101ULL;
+    const unsigned long long highs = 0x8080808080808080ULL;
+    static const char stops[] = "\t\n '\"\\&|;<>$*?[";
+
+    while (end - p >= 8) {
+        unsigned long long v, hits = 0;
+        memcpy(&v, p, 8);
+        /* Bytes with the high bit clear and below 0x21 */
+        hits |= (v - ones * 0x21) & ~v & highs;
+        for (const char *s = stops + 3; *s; s++) {
+            unsigned long long x = v ^ (ones * (unsigned char)*s);
+            hits |= (x - ones) & ~x & highs;
+        }
+        if (hits != 0)
+            return p + (__builtin_ctzll(hits) >> 3);
+        p += 8;
+    }
+#endif
+    while (p < end && !special[(unsigned char)*p])
+        p++;
+    return p;
+}
+
+static void push_token(token_list *tl, token_type type, char *start, size_t len, int fd) {
+    if (tl->count == tl->capacity) {
+        tl->capacity = tl->capacity ? tl->capacity * 2 : INITIAL_TOKENS;
+        tl->tokens = realloc(tl->tokens, tl->capacity * sizeof(token));
+        if (tl->tokens == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    token *t = &tl->tokens[tl->count++];
+    t->type = type;
+    t->start = start;
+    t->len = len;
+    t->fd = fd;
+    t->expand = 0;
+    t->glob = 0;
+}
+
+/* Lex the operator at p and return how many bytes it used */
+static size_t lex_operator(char *p, char *end, token_list *tl, int fd) {
+    char next = p + 1 < end ? p[1] : '\0';
+    switch (*p) {
+    case '|':
+        push_token(tl, TOKEN_PIPE, p, 1, fd);
+        return 1;
+    case '&':
+        push_token(tl, TOKEN_AMP, p, 1, fd);
+        return 1;
+    case ';':
+        push_token(tl, TOKEN_SEMI, p, 1, fd);
+        return 1;
+    case '<':
+        if (next == '&') {
+            push_token(tl, TOKEN_LESSAND, p, 2, fd);
+            return 2;
+        }
+        push_token(tl, TOKEN_LESS, p, 1, fd);
+        return 1;
+    default: /* '>' */
+        if (next == '>') {
+            push_token(tl, TOKEN_DGREAT, p, 2, fd);
+            return 2;
+        } else if (next == '&') {
+            push_token(tl, TOKEN_GREATAND, p, 2, fd);
+            return 2;
+        }
+        push_token(tl, TOKEN_GREAT, p, 1, fd);
+        return 1;
+    }
+}
+
+/* True if a $ right before p starts an expansion */
+static int starts_parameter(const char *p, const char *end) {
+    if (p >= end)
+        return 0;
+    char c = *p;
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+        (c >= '0' && c <= '9') || c == '{' || c == '?' || c == '$' ||
+        c == '#' || c == '@' || c == '*';
+}
+
+static int is_operator(char c) {
+    return c == '|' || c == '&' || c == ';' || c == '<' || c == '>';
+}
+
+/* Split the line into tokens in one pass. Words are unquoted in
+ * place: w trails p and plain runs are moved back over removed
+ * quote characters, so nothing is copied out of the line.
+ */
+int lex_line(char *line, size_t len, token_list *tl, const char **error) {
+    char *p = line, *end = line + len;
+
+    tl->count = 0;
+    while (1) {
+        while (p < end && is_blank(*p))
+            p++;
+        if (p >= end)
+            break;
+        if (*p == '#') {
+            /* Comment runs to the end of the line */
+            while (p < end && *p != '\n')
+                p++;
+            continue;
+        }
+        if (is_operator(*p)) {
+            p += lex_operator(p, end, tl, -1);
+            continue;
+        }
+
+        char *start = p, *w = p;
+        int quoted = 0, expand = 0, glob = 0;
+        while (p < end) {
+            char *q = scan_plain(p, end);
+            if (w != p)
+                memmove(w, p, q - p);
+            w += q - p;
+            p = q;
+            if (p >= end)
+                break;
+
+            char c = *p;
+            if (c == '\\') {
+                quoted = 1;
+                if (p + 1 >= end) {
+                    p++;
+                } else if (p[1] == '\n') {
+                    /* Line continuation */
+                    p += 2;
+                } else {
+                    *w++ = p[1];
+                    p += 2;
+                }
+            } else if (c == '\'') {
+                /* Everything up to the next ' is literal */
+                char *close = memchr(p + 1, '\'', end - p - 1);
+                if (close == NULL) {
+                    *error = "unterminated '";
+                    return -1;
+                }
+                memmove(w, p + 1, close - p - 1);
+                w += close - p - 1;
+                p = close + 1;
+                quoted = 1;
+            } else if (c == '"') {
+                /* Backslash only escapes a few characters in "" */
+                p++;
+                while (1) {
+                    if (p >= end) {
+                        *error = "unterminated \"";
+                        return -1;
+                    }
+                    if (*p == '"') {
+                        p++;
+                        break;
+                    }
+                    if (*p == '\\' && p + 1 < end && strchr("\"\\$`\n", p[1])) {
+                        if (p[1] != '\n')
+                            *w++ = p[1];
+                        p += 2;
+                        continue;
+                    }
+                    if (*p == '$' && starts_parameter(p + 1, end)) {
+                        *w++ = VAR_MARK;
+                        p++;
+                        expand = 1;
+                        continue;
+                    }
+                    *w++ = *p++;
+                }
+                quoted = 1;
+            } else if (c == '$') {
+                /* Marked unless it's a plain $ like in "a$" */
+                if (starts_parameter(p + 1, end)) {
+                    *w++ = VAR_MARK;
+                    expand = 1;
+                    /* $? and $* aren't patterns */
+                    if (p[1] == '?' || p[1] == '*')
+                        *w++ = *++p;
+                } else {
+                    *w++ = '$';
+                }
+                p++;
+            } else if (c == '*' || c == '?' || c == '[') {
+                *w++ = c == '*' ? GLOB_STAR : c == '?' ? GLOB_ANY : GLOB_CLASS;
+                glob = 1;
+                p++;
+            } else if (is_blank(c) || is_operator(c)) {
+                break;
+            } else {
+                /* Control character the scan stopped on, it's plain */
+                *w++ = *p++;
+            }
+        }
+
+        /* Digits right before < or > are the fd to redirect (2>&1) */
+        if (!quoted && p < end && (*p == '<' || *p == '>') && w - start <= 4) {
+            char *d = start;
+            while (d < w && *d >= '0' && *d <= '9')
+                d++;
+            if (d == w && w > start) {
+                int fd = 0;
+                for (d = start; d < w; d++)
+                    fd = fd * 10 + (*d - '0');
+                p += lex_operator(p, end, tl, fd);
+                continue;
+            }
+        }
+        push_token(tl, TOKEN_WORD, start, w - start, -1);
+        tl->tokens[tl->count - 1].expand = expand;
+        tl->tokens[tl->count - 1].glob = glob;
+    }
+    return 0;
+}
+
+/* True if the token is a word equal to s */
+int token_is(const token *t, const char *s) {
+    size_t len = strlen(s);
+    return t->type == TOKEN_WORD && t->len == len && memcmp(t->start, s, len) == 0;
+}
+
+/* Free the memory held by the token list */
+void free_token_list(token_list *tl) {
+    free(tl->tokens);
+    tl->tokens = NULL;
+    tl->count = tl->capacity = 0;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "notify.h"
+#include "account.h"
+#include "stats.h"
+#include "placement.h"
+
+/* Notices waiting to be written, one line each */
+static char *pending = NULL;
+static size_t pending_len = 0;
+static size_t pending_capacity = 0;
+static int pending_count = 0;
+
+/* What the pending notices were about, for the summary */
+static int finished = 0, failed = 0, stopped = 0;
+
+/* When the last batch went out */
+static uint64_t last_flush = 0;
+
+/* Write how a job ended (or that it stopped). Background jobs
+ * also say what they used.
+ */
+void format_job_status(job *j, char *buf, size_t size) {
+    int status = job_status(j);
+    const char *name = job_name(j);
+    job_usage u;
+    char usage[256];
+    size_t len = 0;
+
+    if (!job_is_completed(j)) {
+        snprintf(buf, size, "%s [%d] suspended. Send SIGCONT to continue job\n", name, j->pgid);
+    } else if (j->foreground) {
+        WIFEXITED(status) ?
+            snprintf(buf, size, "%s exited with status %d\n", name, WEXITSTATUS(status)) :
+            snprintf(buf, size, "%s exited abnormally\n", name);
+    } else {
+        get_job_usage(j, &u);
+        if (j->placement != NULL)
+            len = snprintf(usage, sizeof(usage), "on %s, ", j->placement->label);
+        format_usage(&u, usage + len, sizeof(usage) - len);
+        WIFEXITED(status) ?
+            snprintf(buf, size, "%s [%d] exited with status %d (%s)\n", name, j->pgid,
+                    WEXITSTATUS(status), usage) :
+            snprintf(buf, size, "%s [%d] exited abnormally (%s)\n", name, j->pgid, usage);
+    }
+}
+
+static void append(const char *s, size_t len) {
+    if (pending_len + len > pending_capacity) {
+        pending_capacity = pending_capacity ? pending_capacity * 2 : 4096;
+        if (pending_capacity < pending_len + len)
+            pending_capacity = pending_len + len;
+        pending = realloc(pending, pending_capacity);
+        if (pending == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(pending + pending_len, s, len);
+    pending_len += len;
+}
+
+/* Queue a notice. It is formatted now since the job is usually
+ * freed right after.
+ */
+void queue_job_notice(job *j) {
+    char line[512];
+    int status = job_status(j);
+
+    if (!job_is_completed(j))
+        stopped++;
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        finished++;
+    else
+        failed++;
+    pending_count++;
+    /* Past the limit only the counts are used */
+    if (pending_count <= NOTICE_DETAIL_LIMIT) {
+        format_job_status(j, line, sizeof(line));
+        append(line, strlen(line));
+    }
+}
+
+/* Milliseconds until the queued notices are due */
+int notice_delay() {
+    if (pending_count == 0)
+        return -1;
+    uint64_t since = (now_ns() - last_flush) / 1000000;
+    return since >= NOTICE_INTERVAL_MS ? 0 : NOTICE_INTERVAL_MS - since;
+}
+
+/* Replace the detailed lines with one line of counts */
+static void summarize() {
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%d jobs finished", finished + failed);
+    if (failed > 0)
+        n += snprintf(line + n, sizeof(line) - n, ", %d failed", failed);
+    if (stopped > 0)
+        n += snprintf(line + n, sizeof(line) - n, ", %d stopped", stopped);
+    line[n++] = '\n';
+    pending_len = 0;
+    append(line, n);
+}
+
+/* Write the queued notices in one go */
+int flush_notices(int force, const char *prompt) {
+    int delay = notice_delay();
+    if (delay < 0 || (delay > 0 && !force))
+        return 0;
+
+    if (pending_count > NOTICE_DETAIL_LIMIT)
+        summarize();
+    if (prompt != NULL) {
+        /* Move off the prompt line first, then draw it again */
+        append("\n", 1);
+        memmove(pending + 1, pending, pending_len - 1);
+        pending[0] = '\n';
+        append(prompt, strlen(prompt));
+    }
+    /* Anything printf()'d has to come out first */
+    fflush(stdout);
+    size_t done = 0;
+    while (done < pending_len) {
+        ssize_t n = write(STDOUT_FILENO, pending + done, pending_len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    pending_len = 0;
+    pending_count = finished = failed = stopped = 0;
+    last_flush = now_ns();
+    return 1;
+}
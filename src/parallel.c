@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "parallel.h"
+#include "io.h"
+#include "job.h"
+#include "launch.h"
+#include "placement.h"
+
+/* A running copy of the command */
+typedef struct {
+    pid_t pid;          /* 0 if the slot is free */
+} worker;
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Copy of arg with every "{}" replaced by item */
+static char *substitute(const char *arg, const char *item, size_t item_len) {
+    size_t count = 0, len = strlen(arg);
+    for (const char *s = arg; (s = strstr(s, "{}")) != NULL; s += 2)
+        count++;
+    char *out = malloc(len + count * item_len + 1);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    char *w = out;
+    for (const char *s = arg, *brace; ; s = brace + 2) {
+        brace = strstr(s, "{}");
+        if (brace == NULL) {
+            strcpy(w, s);
+            break;
+        }
+        memcpy(w, s, brace - s);
+        w += brace - s;
+        memcpy(w, item, item_len);
+        w += item_len;
+    }
+    return out;
+}
+
+/* Start the command for one item. Returns its pid or -1. */
+static pid_t start_item(char **template, int count, int has_braces,
+        char *item, size_t item_len, int null_fd) {
+    char *argv[count + 2];
+    placement pl;
+    process p;
+    pid_t pid;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        argv[i] = has_braces && strstr(template[i], "{}") ?
+            substitute(template[i], item, item_len) : template[i];
+    }
+    if (!has_braces)
+        argv[i++] = item;
+    argv[i] = NULL;
+
+    /* Each copy gets its own process group like a background
+     * job, none of them is handed the terminal. Reading it would
+     * stop them, so stdin is /dev/null.
+     */
+    init_process(&p);
+    p.argv = argv;
+    p.infile = null_fd;
+    p.foreground = 0;
+    p.pgid = shell_is_interactive ? 0 : shell_pgid;
+    if (next_placement(&pl))
+        p.placement = &pl;
+    pid = spawn_process(&p);
+
+    for (i = 0; i < count; i++) {
+        if (argv[i] != template[i])
+            free(argv[i]);
+    }
+    return pid;
+}
+
+/* Sleep until a child exits or Ctrl-C. Both are blocked (the
+ * shell reads SIGCHLD from a signalfd in the main loop) so we can
+ * just wait for one to be pending. Returns which it was.
+ */
+static int wait_for_signal(const sigset_t *set) {
+    int sig;
+    while ((sig = sigwaitinfo(set, NULL)) < 0 && errno == EINTR)
+        ;
+    return sig;
+}
+
+/* Send sig to every running worker, and to whatever it started
+ * when it has its own process group.
+ */
+static void signal_workers(worker *workers, int slots, int sig) {
+    for (int i = 0; i < slots; i++) {
+        if (workers[i].pid != 0)
+            kill(shell_is_interactive ? -workers[i].pid : workers[i].pid, sig);
+    }
+}
+
+/* Reap whichever workers exited. Only our own pids are waited
+ * for, background jobs are left for the main loop. A worker that
+ * stopped can't be continued by anyone, it is killed and counts
+ * as failed.
+ */
+static int reap_workers(worker *workers, int slots, int *running, int *failed) {
+    int status, freed = -1;
+    for (int i = 0; i < slots; i++) {
+        pid_t pid = workers[i].pid;
+        if (pid == 0)
+            continue;
+        if (waitpid(pid, &status, WNOHANG | WUNTRACED) != pid)
+            continue;
+        if (WIFSTOPPED(status)) {
+            kill(shell_is_interactive ? -pid : pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            (*failed)++;
+        workers[i].pid = 0;
+        (*running)--;
+        freed = i;
+    }
+    return freed;
+}
+
+/* "parallel [-j jobs] [-a file] command [args]" */
+int run_parallel(int argc, char **argv) {
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *file = NULL;
+    int i = 1, fd = STDIN_FILENO, null_fd, has_braces = 0;
+    int running = 0, started = 0, failed = 0, stopping = 0;
+    struct timespec start;
+    sigset_t waited, old_mask;
+    line_reader items;
+    char *item;
+    size_t item_len;
+
+    /* Options take their value as the next argument or stuck on (-j4) */
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        char opt = argv[i][1];
+        char *value = argv[i][2] != '\0' ? argv[i] + 2 : argv[i + 1];
+        if ((opt != 'j' && opt != 'a') || value == NULL)
+            break;
+        if (value == argv[i + 1])
+            i++;
+        if (opt == 'j')
+            slots = atol(value);
+        else
+            file = value;
+    }
+    if (i >= argc || slots < 1) {
+        fprintf(stderr, "parallel: usage: parallel [-j jobs] [-a file] command [args]\n");
+        return 2;
+    }
+    for (int k = i; k < argc; k++) {
+        if (strstr(argv[k], "{}") != NULL)
+            has_braces = 1;
+    }
+    if (file != NULL && (fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+        fprintf(stderr, "parallel: %s: %s\n", file, strerror(errno));
+        return 2;
+    }
+    if ((null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0) {
+        perror("open");
+        exit(1);
+    }
+
+    /* SIGCHLD is already blocked in the shell, but not when we run
+     * in a forked child for a pipeline or "&". The workers aren't in
+     * the terminal's process group so Ctrl-C only reaches us, it's
+     * taken here instead of by the shell's handler.
+     */
+    sigemptyset(&waited);
+    sigaddset(&waited, SIGCHLD);
+    sigaddset(&waited, SIGINT);
+    sigprocmask(SIG_BLOCK, &waited, &old_mask);
+
+    worker workers[slots];
+    memset(workers, 0, sizeof(workers));
+    init_line_reader(&items, fd);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Keep every slot busy, start the next item as soon as a
+     * slot frees up. Ctrl-C stops starting them and interrupts the
+     * running ones, a second one kills them.
+     */
+    int slot = 0;
+    while (!stopping && read_line(&items, &item, &item_len)) {
+        if (item_len == 0)
+            continue;
+        while (running == slots && !stopping) {
+            if (wait_for_signal(&waited) == SIGINT) {
+                signal_workers(workers, slots, SIGINT);
+                stopping = 1;
+            }
+            slot = reap_workers(workers, slots, &running, &failed);
+        }
+        if (stopping)
+            break;
+        while (workers[slot].pid != 0)
+            slot = (slot + 1) % slots;
+        pid_t pid = start_item(argv + i, argc - i, has_braces, item,
+                item_len, null_fd);
+        started++;
+        if (pid < 0) {
+            failed++;
+            continue;
+        }
+        workers[slot].pid = pid;
+        running++;
+    }
+    while (running > 0) {
+        if (wait_for_signal(&waited) == SIGINT) {
+            signal_workers(workers, slots, stopping ? SIGKILL : SIGINT);
+            stopping = 1;
+        }
+        reap_workers(workers, slots, &running, &failed);
+    }
+    free_line_reader(&items);
+    close(null_fd);
+    if (fd != STDIN_FILENO)
+        close(fd);
+
+    /* We may have taken the SIGCHLD of a background job too,
+     * make it pending again so the main loop reaps them.
+     */
+    raise(SIGCHLD);
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+    double elapsed = seconds_since(&start);
+    fprintf(stderr, "parallel: %d jobs, %d failed, %.3f s, %.1f jobs/s\n",
+            started, failed, elapsed, elapsed > 0 ? started / elapsed : 0.0);
+    if (stopping)
+        return 128 + SIGINT;
+    return failed > 101 ? 101 : failed;
+}
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parse.h"
+#include "pathglob.h"
+#include "vars.h"
+
+/* File names the patterns on the line being parsed matched, and
+ * how many went to each pattern word in order.
+ */
+static glob_list globbed;
+static size_t *glob_counts = NULL;
+static size_t glob_count_capacity = 0;
+
+/* Bytes of arena needed to parse the tokens. Every token can
+ * be at most one process and job, and each process needs one
+ * more argv slot than its arguments for the NULL.
+ */
+static size_t parse_arena_size(token_list *tl, size_t extra_words) {
+    size_t count = tl->count;
+    size_t size = (2 * count + 1) * sizeof(char *);
+    size += count * sizeof(redirection) + sizeof(max_align_t);
+    size += count * sizeof(char *) + sizeof(max_align_t);
+    size += count * (sizeof(job) + sizeof(process) + 2 * sizeof(max_align_t));
+    size += count * sizeof(job *) + sizeof(max_align_t);
+    for (size_t i = 0; i < count; i++)
+        size += tl->tokens[i].len + sizeof(max_align_t);
+    /* Matched file names, each an argv slot too */
+    size += globbed.text_len + extra_words * (sizeof(char *) + sizeof(max_align_t));
+    return size;
+}
+
+/* Match one pattern word against the file names */
+static size_t glob_token(const token *t) {
+    if (!t->expand)
+        return glob_word(t->start, t->len, &globbed);
+    char *pattern = malloc(expanded_length(t->start, t->len) + 1);
+    if (pattern == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    expand_pattern(t->start, t->len, pattern);
+    size_t matched = glob_word(pattern, strlen(pattern), &globbed);
+    free(pattern);
+    return matched;
+}
+
+/* Expand every pattern that will be an argument, before anything
+ * is allocated so the arena can be sized for the names. Returns
+ * how many names there are.
+ */
+static size_t glob_arguments(token_list *tl, int match) {
+    size_t patterns = 0, names = 0;
+    int argc = 0;
+
+    clear_glob_list(&globbed);
+    for (size_t i = 0; i < tl->count; i++) {
+        token *t = &tl->tokens[i];
+        switch (t->type) {
+        case TOKEN_WORD:
+            if (argc == 0 && is_assignment(t->start, t->len))
+                break;
+            argc++;
+            if (!t->glob)
+                break;
+            if (patterns == glob_count_capacity) {
+                glob_count_capacity = glob_count_capacity ? glob_count_capacity * 2 : 16;
+                glob_counts = realloc(glob_counts, glob_count_capacity * sizeof(size_t));
+                if (glob_counts == NULL) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            names += glob_counts[patterns++] = match ? glob_token(t) : 0;
+            break;
+        case TOKEN_PIPE:
+        case TOKEN_AMP:
+        case TOKEN_SEMI:
+            argc = 0;
+            break;
+        default:
+            /* Redirection targets are used as they are */
+            i++;
+            break;
+        }
+    }
+    return names;
+}
+
+/* Free jobs that were parsed but never used and the arena */
+static int discard_jobs(command_line *cl, job *j) {
+    if (j != NULL)
+        free_job(j);
+    for (int i = 0; i < cl->job_count; i++)
+        free_job(cl->jobs[i]);
+    arena_release(cl->arena);
+    cl->arena = NULL;
+    cl->job_count = 0;
+    return -1;
+}
+
+static int parse_error(command_line *cl, job *j, const token *t) {
+    if (t != NULL)
+        printf("Syntax error near %.*s\n", (int)t->len, t->start);
+    else
+        printf("Syntax error near end of line\n");
+    return discard_jobs(cl, j);
+}
+
+/* Copy a word out of the line, expanding its variables on the way */
+static char *copy_word(arena *a, const token *t) {
+    if (t->expand || t->glob)
+        return arena_expand(a, t->start, t->len);
+    return arena_strndup(a, t->start, t->len);
+}
+
+/* "name=value" on its own can't be part of a pipeline or run in
+ * the background, there'd be nothing to run.
+ */
+static int bad_command(const job *j, const process *p, int argc, token_type end) {
+    if (p == NULL)
+        return 1;
+    if (argc > 0)
+        return 0;
+    return p->assignment_count == 0 || j->first_process != p || end != TOKEN_SEMI;
+}
+
+/* Fill in r from the redirection operator t and the word w
+ * after it. Returns -1 if w isn't a valid target.
+ */
+static int parse_redirection(arena *a, const token *t, const token *w, redirection *r) {
+    int input = t->type == TOKEN_LESS || t->type == TOKEN_LESSAND;
+
+    r->fd = t->fd >= 0 ? t->fd : !input;
+    r->file = NULL;
+    r->target = -1;
+    switch (t->type) {
+    case TOKEN_LESS:
+        r->type = REDIRECT_IN;
+        break;
+    case TOKEN_GREAT:
+        r->type = REDIRECT_OUT;
+        break;
+    case TOKEN_DGREAT:
+        r->type = REDIRECT_APPEND;
+        break;
+    default:
+        /* 2>&1, the word has to be an fd */
+        r->type = REDIRECT_DUP;
+        if (w->len == 0 || w->len > 4)
+            return -1;
+        r->target = 0;
+        for (size_t i = 0; i < w->len; i++) {
+            if (w->start[i] < '0' || w->start[i] > '9')
+                return -1;
+            r->target = r->target * 10 + w->start[i] - '0';
+        }
+        return 0;
+    }
+    r->file = copy_word(a, w);
+    return 0;
+}
+
+/* Build jobs from the tokens. Everything is allocated from one
+ * arena per command line so parsing costs a single malloc() and
+ * background jobs free it all at once when they are reaped.
+ */
+static int parse_tokens(token_list *tl, command_line *cl, int match) {
+    size_t names = glob_arguments(tl, match), pattern = 0, name = 0;
+    arena *a = new_arena(parse_arena_size(tl, names));
+    job *j = NULL;
+    process *p = NULL;
+    /* argv arrays are carved out of this one in order */
+    char **argv_slots = arena_alloc(a, sizeof(char *) * (2 * tl->count + names + 1));
+    /* and so are the redirections and assignments */
+    redirection *redirect_slots = arena_alloc(a, sizeof(redirection) * (tl->count + 1));
+    char **assignment_slots = arena_alloc(a, sizeof(char *) * (tl->count + 1));
+    int argc = 0;
+
+    cl->arena = a;
+    cl->jobs = arena_alloc(a, sizeof(job *) * (tl->count + 1));
+    cl->job_count = 0;
+
+    for (size_t i = 0; i < tl->count; i++) {
+        token *t = &tl->tokens[i];
+
+        if (t->type == TOKEN_WORD || (t->type != TOKEN_PIPE &&
+                    t->type != TOKEN_AMP && t->type != TOKEN_SEMI)) {
+            /* Words and redirections both start a process */
+            if (j == NULL) {
+                j = arena_alloc(a, sizeof(job));
+                init_job(j);
+                j->arena = arena_retain(a);
+            }
+            if (p == NULL) {
+                p = arena_alloc(a, sizeof(process));
+                init_process(p);
+                p->argv = argv_slots;
+                p->redirects = redirect_slots;
+                p->assignments = assignment_slots;
+                argc = 0;
+                add_process(&j->first_process, p);
+            }
+        }
+
+        switch (t->type) {
+        case TOKEN_WORD:
+            /* Tokens point into the input line, which is reused for
+             * the next line, so copy it.
+             */
+            if (argc == 0 && is_assignment(t->start, t->len)) {
+                p->assignments[p->assignment_count++] = copy_word(a, t);
+            } else if (t->glob && glob_counts[pattern] > 0) {
+                /* The names it matched, or the word itself if none */
+                for (size_t k = 0; k < glob_counts[pattern]; k++, name++) {
+                    const char *path = glob_path(&globbed, name);
+                    p->argv[argc++] = arena_strndup(a, path, strlen(path));
+                }
+                pattern++;
+            } else {
+                pattern += t->glob;
+                p->argv[argc++] = copy_word(a, t);
+            }
+            break;
+        case TOKEN_PIPE:
+        case TOKEN_AMP:
+        case TOKEN_SEMI:
+            if (bad_command(j, p, argc, t->type)) {
+                /* Operator without a command before it */
+                return parse_error(cl, j, t);
+            }
+            p->argv[argc] = NULL;
+            argv_slots += argc + 1;
+            redirect_slots += p->redirect_count;
+            assignment_slots += p->assignment_count;
+            p = NULL;
+            if (t->type != TOKEN_PIPE) {
+                j->foreground = t->type == TOKEN_SEMI;
+                cl->jobs[cl->job_count++] = j;
+                j = NULL;
+            }
+            break;
+        default:
+            /* Redirection, the next word is the file or fd */
+            if (i + 1 == tl->count || tl->tokens[i + 1].type != TOKEN_WORD)
+                return parse_error(cl, j, i + 1 < tl->count ? &tl->tokens[i + 1] : NULL);
+            i++;
+            if (parse_redirection(a, t, &tl->tokens[i],
+                        &p->redirects[p->redirect_count++]) < 0)
+                return parse_error(cl, j, &tl->tokens[i]);
+            break;
+        }
+    }
+
+    if (j != NULL) {
+        if (bad_command(j, p, argc, TOKEN_SEMI)) {
+            /* Ended on "|" or just redirections */
+            return parse_error(cl, j, NULL);
+        }
+        p->argv[argc] = NULL;
+        cl->jobs[cl->job_count++] = j;
+    }
+    return 0;
+}
+
+int parse_command_line(token_list *tl, command_line *cl) {
+    return parse_tokens(tl, cl, 1);
+}
+
+/* Parse without matching patterns and throw the jobs away */
+int check_command_line(token_list *tl) {
+    command_line cl;
+
+    if (parse_tokens(tl, &cl, 0) < 0)
+        return -1;
+    free_command_line(&cl);
+    return 0;
+}
+
+/* Drop the command line's own hold on its arena */
+void release_command_line(command_line *cl) {
+    if (cl->arena != NULL)
+        arena_release(cl->arena);
+    cl->arena = NULL;
+}
+
+/* Free every job in the command line and the arena */
+void free_command_line(command_line *cl) {
+    discard_jobs(cl, NULL);
+}
@@ -0,0 +1,198 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "pathcache.h"
+
+#define INITIAL_CAPACITY 64
+
+/* Open addressing table with linear probing. capacity is
+ * always a power of two so we can mask instead of mod.
+ */
+static command_location *table = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+
+/* PATH the cached entries were found with. If PATH is
+ * different on lookup the whole cache is thrown away.
+ */
+static char *cached_path_var = NULL;
+
+/* FNV-1a, good enough for short command names */
+static uint64_t hash_name(const char *name) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Find the slot name lives in or the empty slot it would go in */
+static size_t find_slot(const char *name) {
+    size_t mask = capacity - 1;
+    size_t i = hash_name(name) & mask;
+    while (table[i].name != NULL && strcmp(table[i].name, name) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void grow_table() {
+    command_location *old = table;
+    size_t old_capacity = capacity;
+
+    capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+    table = calloc(capacity, sizeof(command_location));
+    if (table == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL)
+            table[find_slot(old[i].name)] = old[i];
+    }
+    free(old);
+}
+
+/* Remove the entry at slot i. Later entries in the same probe
+ * run are shifted back so lookups never hit a hole early.
+ */
+static void remove_slot(size_t i) {
+    size_t mask = capacity - 1;
+    size_t j = i;
+
+    free(table[i].name);
+    free(table[i].path);
+    table[i].name = NULL;
+    count--;
+    while (1) {
+        j = (j + 1) & mask;
+        if (table[j].name == NULL)
+            return;
+        size_t home = hash_name(table[j].name) & mask;
+        /* Move j into the hole if its home isn't between the hole and j */
+        if ((j > i && (home <= i || home > j)) ||
+                (j < i && (home <= i && home > j))) {
+            table[i] = table[j];
+            table[j].name = NULL;
+            i = j;
+        }
+    }
+}
+
+/* Check that path is a regular file we can execute */
+static int is_executable(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+/* Walk PATH looking for name. Only absolute directories are
+ * cached since relative ones depend on the working directory.
+ */
+static char *search_path(const char *name, const char *path_var) {
+    size_t name_len = strlen(name);
+    const char *dir = path_var;
+
+    while (1) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+        if (dir_len > 0 && dir[0] == '/') {
+            char *candidate = malloc(dir_len + name_len + 2);
+            if (candidate == NULL) {
+                perror("malloc");
+                exit(1);
+            }
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            memcpy(candidate + dir_len + 1, name, name_len + 1);
+            if (is_executable(candidate))
+                return candidate;
+            free(candidate);
+        }
+        if (end == NULL)
+            return NULL;
+        dir = end + 1;
+    }
+}
+
+/* Find the absolute path for the command name */
+const char *lookup_command(const char *name) {
+    const char *path_var = getenv("PATH");
+
+    if (strchr(name, '/') != NULL || path_var == NULL)
+        return NULL;
+    /* Entries found with an old PATH may be wrong now */
+    if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0) {
+        clear_command_cache();
+        if ((cached_path_var = strdup(path_var)) == NULL) {
+            perror("strdup");
+            exit(1);
+        }
+    }
+    if (capacity == 0)
+        grow_table();
+
+    size_t i = find_slot(name);
+    if (table[i].name != NULL) {
+        /* One access() is still much cheaper than walking PATH */
+        if (access(table[i].path, X_OK) == 0) {
+            table[i].hits++;
+            return table[i].path;
+        }
+        /* The file went away, look for it again */
+        remove_slot(i);
+    }
+
+    char *path = search_path(name, path_var);
+    if (path == NULL)
+        return NULL;
+    if ((count + 1) * 4 > capacity * 3)
+        grow_table();
+    i = find_slot(name);
+    if ((table[i].name = strdup(name)) == NULL) {
+        perror("strdup");
+        exit(1);
+    }
+    table[i].path = path;
+    table[i].hits = 1;
+    count++;
+    return path;
+}
+
+/* Drop a single command from the cache */
+void forget_command(const char *name) {
+    if (capacity == 0)
+        return;
+    size_t i = find_slot(name);
+    if (table[i].name != NULL)
+        remove_slot(i);
+}
+
+/* Drop every cached command */
+void clear_command_cache() {
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].name != NULL) {
+            free(table[i].name);
+            free(table[i].path);
+            table[i].name = NULL;
+        }
+    }
+    count = 0;
+    free(cached_path_var);
+    cached_path_var = NULL;
+}
+
+/* Print the cached commands */
+void print_command_cache() {
+    if (count == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < capacity; i++) {
+        if (table[i].name != NULL)
+            printf("%4lu\t%s\n", table[i].hits, table[i].path);
+    }
+}
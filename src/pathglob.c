@@ -0,0 +1,635 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "pathglob.h"
+#include "arena.h"
+#include "lexer.h"
+#include "stats.h"
+
+#define INITIAL_CAPACITY 64
+
+/* A directory changed this recently may change again with the
+ * same mtime, the clock only moves a tick at a time.
+ */
+#define RACY_NS 20000000
+
+/* What getdents64() fills its buffer with */
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} linux_dirent64;
+
+/* An entry of a directory listing */
+typedef struct {
+    uint32_t name;          /* offset in the listing's names */
+    unsigned char len;
+    unsigned char type;     /* d_type, DT_UNKNOWN if the fs won't say */
+} entry;
+
+/* A directory as it was read and what tells if it changed since */
+typedef struct {
+    char *path;             /* NULL for an empty slot */
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct timespec ctime;
+    int racy;               /* changed right before it was read */
+    char *names;
+    entry *entries;
+    size_t count;
+} listing;
+
+/* Listings by path, open addressing with linear probing like
+ * the command cache. Only ever emptied as a whole.
+ */
+static listing *table = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+
+/* Bytes one position of a pattern matches */
+typedef struct {
+    uint64_t bits[4];
+} byte_set;
+
+/* The part of a component between two stars, a byte set per byte */
+typedef struct {
+    byte_set *sets;
+    size_t len;
+    char *literal;          /* the bytes if every set is one byte */
+} run;
+
+typedef enum {
+    COMPONENT_LITERAL,      /* a plain name */
+    COMPONENT_PATTERN,
+    COMPONENT_ANY_DIRS      /* ** */
+} component_type;
+
+/* One path component of a pattern, compiled */
+typedef struct {
+    component_type type;
+    char *text;             /* name of a literal one */
+    size_t len;
+    run *runs;              /* before the first star ... after the last */
+    int run_count;          /* 1 without stars */
+    size_t min_len;
+    int dot;                /* starts with a real ".", hidden names match */
+} component;
+
+/* State of one glob_word() */
+typedef struct {
+    component *components;
+    int count;
+    int dirs_only;          /* pattern ended in "/" */
+    glob_list *list;
+} walk;
+
+/* Where paths are built up while walking */
+static char *path = NULL;
+static size_t path_capacity = 0;
+
+/* FNV-1a */
+static uint64_t hash_path(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static size_t find_slot(const char *s) {
+    size_t mask = capacity - 1;
+    size_t i = hash_path(s) & mask;
+    while (table[i].path != NULL && strcmp(table[i].path, s) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void grow_table() {
+    listing *old = table;
+    size_t old_capacity = capacity;
+
+    capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+    table = calloc(capacity, sizeof(listing));
+    if (table == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].path != NULL)
+            table[find_slot(old[i].path)] = old[i];
+    }
+    free(old);
+}
+
+static void *grow(void *array, size_t *cap, size_t size, size_t need) {
+    if (need <= *cap)
+        return array;
+    while (*cap < need)
+        *cap = *cap ? *cap * 2 : 256;
+    if ((array = realloc(array, *cap * size)) == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    return array;
+}
+
+/* Read every entry of the directory into l, GLOB_GETDENTS_SIZE
+ * bytes of them per system call.
+ */
+static void read_directory(const char *dir, listing *l) {
+    static char *buf = NULL;
+    size_t names_len = 0, names_capacity = 0, entry_capacity = 0;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    long n;
+
+    l->names = NULL;
+    l->entries = NULL;
+    l->count = 0;
+    if (fd < 0)
+        return;
+    if (buf == NULL && (buf = malloc(GLOB_GETDENTS_SIZE)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    while ((n = syscall(SYS_getdents64, fd, buf, GLOB_GETDENTS_SIZE)) > 0) {
+        for (long off = 0; off < n; ) {
+            linux_dirent64 *d = (linux_dirent64 *)(buf + off);
+            off += d->d_reclen;
+            if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+                        (d->d_name[1] == '.' && d->d_name[2] == '\0')))
+                continue;
+            size_t len = strlen(d->d_name);
+            l->names = grow(l->names, &names_capacity, 1, names_len + len + 1);
+            l->entries = grow(l->entries, &entry_capacity, sizeof(entry), l->count + 1);
+            memcpy(l->names + names_len, d->d_name, len + 1);
+            l->entries[l->count++] = (entry){ names_len, len, d->d_type };
+            names_len += len + 1;
+        }
+    }
+    close(fd);
+}
+
+/* The listing of the directory at dir, read again only if the
+ * directory changed since. NULL if it isn't a directory.
+ */
+static listing *get_listing(const char *dir) {
+    struct timespec now;
+    struct stat st;
+
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+        return NULL;
+    if ((count + 1) * 2 > capacity)
+        grow_table();
+    listing *l = &table[find_slot(dir)];
+    if (l->path != NULL) {
+        if (!l->racy && l->dev == st.st_dev && l->ino == st.st_ino &&
+                l->mtime.tv_sec == st.st_mtim.tv_sec &&
+                l->mtime.tv_nsec == st.st_mtim.tv_nsec &&
+                l->ctime.tv_sec == st.st_ctim.tv_sec &&
+                l->ctime.tv_nsec == st.st_ctim.tv_nsec) {
+            STAT_INC(glob_cache_hits);
+            return l;
+        }
+        free(l->names);
+        free(l->entries);
+    } else if ((l->path = strdup(dir)) == NULL) {
+        perror("strdup");
+        exit(1);
+    } else {
+        count++;
+    }
+    /* Stat from before the read, a change while reading shows next time */
+    clock_gettime(CLOCK_REALTIME, &now);
+    l->dev = st.st_dev;
+    l->ino = st.st_ino;
+    l->mtime = st.st_mtim;
+    l->ctime = st.st_ctim;
+    l->racy = (int64_t)(timespec_ns(&now) - timespec_ns(&st.st_mtim)) < RACY_NS ||
+        (int64_t)(timespec_ns(&now) - timespec_ns(&st.st_ctim)) < RACY_NS;
+    read_directory(dir, l);
+    STAT_INC(glob_dir_reads);
+    return l;
+}
+
+/* Forget the directory listings */
+void clear_directory_cache() {
+    for (size_t i = 0; i < capacity && count > 0; i++) {
+        if (table[i].path == NULL)
+            continue;
+        free(table[i].path);
+        free(table[i].names);
+        free(table[i].entries);
+        table[i].path = NULL;
+        count--;
+    }
+}
+
+static void add_byte(byte_set *set, unsigned char c) {
+    set->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static int has_byte(const byte_set *set, unsigned char c) {
+    return set->bits[c >> 6] >> (c & 63) & 1;
+}
+
+/* The character a mark stands for inside [...] */
+static unsigned char unmark(char c) {
+    switch (c) {
+    case GLOB_STAR:
+        return '*';
+    case GLOB_ANY:
+        return '?';
+    case GLOB_CLASS:
+        return '[';
+    default:
+        return c;
+    }
+}
+
+/* Add a [:name:] class, 0 if there is no such class */
+static int add_named_class(byte_set *set, const char *name, size_t len) {
+    static const struct {
+        const char *name;
+        int (*test)(int c);
+    } classes[] = {
+        { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+        { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+        { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+        { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len || memcmp(classes[i].name, name, len) != 0)
+            continue;
+        for (int c = 1; c < 256; c++) {
+            if (classes[i].test(c))
+                add_byte(set, c);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* Parse the [...] starting at the GLOB_CLASS at s into set.
+ * Returns the bytes it takes or 0 if it isn't closed.
+ */
+static size_t parse_class(const char *s, const char *end, byte_set *set) {
+    const char *p = s + 1, *first;
+    int negate = 0;
+
+    memset(set, 0, sizeof(byte_set));
+    if (p < end && (*p == '!' || *p == '^')) {
+        negate = 1;
+        p++;
+    }
+    /* A ] right at the start is a member */
+    for (first = p; p < end && (*p != ']' || p == first); ) {
+        if (unmark(*p) == '[' && p + 1 < end && p[1] == ':') {
+            const char *close = memmem(p + 2, end - p - 2, ":]", 2);
+            if (close != NULL && add_named_class(set, p + 2, close - p - 2)) {
+                p = close + 2;
+                continue;
+            }
+        }
+        unsigned char lo = unmark(*p), hi = lo;
+        if (p + 2 < end && p[1] == '-' && p[2] != ']') {
+            hi = unmark(p[2]);
+            p += 3;
+        } else {
+            p++;
+        }
+        for (unsigned c = lo; c <= hi; c++)
+            add_byte(set, c);
+    }
+    if (p >= end)
+        return 0;
+    if (negate) {
+        for (int i = 0; i < 4; i++)
+            set->bits[i] = ~set->bits[i];
+    }
+    set->bits[0] &= ~1ULL;
+    set->bits['/' >> 6] &= ~(1ULL << ('/' & 63));
+    return p + 1 - s;
+}
+
+/* Close the run of count sets, noting if they're all single bytes */
+static void end_run(arena *a, component *c, byte_set *sets, size_t len) {
+    run *r = &c->runs[c->run_count++];
+    r->sets = sets;
+    r->len = len;
+    r->literal = arena_alloc(a, len + 1);
+    for (size_t i = 0; i < len && r->literal != NULL; i++) {
+        int n = 0;
+        for (int b = 0; b < 256 && n < 2; b++) {
+            if (has_byte(&sets[i], b)) {
+                r->literal[i] = b;
+                n++;
+            }
+        }
+        if (n != 1)
+            r->literal = NULL;
+    }
+    c->min_len += len;
+}
+
+/* Compile the n marked bytes at s */
+static void compile_component(arena *a, const char *s, size_t n, component *c) {
+    const char *end = s + n;
+    byte_set *sets = arena_alloc(a, (n + 1) * sizeof(byte_set));
+    size_t len = 0, stars = 0;
+
+    memset(c, 0, sizeof(component));
+    c->dot = n > 0 && s[0] == '.';
+    if (n == 2 && s[0] == GLOB_STAR && s[1] == GLOB_STAR) {
+        c->type = COMPONENT_ANY_DIRS;
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+        stars += s[i] == GLOB_STAR;
+    c->runs = arena_alloc(a, (stars + 1) * sizeof(run));
+
+    c->type = COMPONENT_LITERAL;
+    for (const char *p = s; p < end; ) {
+        byte_set *set = &sets[len];
+        size_t used;
+        memset(set, 0, sizeof(byte_set));
+        if (*p == GLOB_STAR) {
+            c->type = COMPONENT_PATTERN;
+            end_run(a, c, sets, len);
+            sets += len;
+            len = 0;
+            while (p < end && *p == GLOB_STAR)
+                p++;
+            continue;
+        }
+        if (*p == GLOB_ANY) {
+            c->type = COMPONENT_PATTERN;
+            for (int i = 0; i < 4; i++)
+                set->bits[i] = ~0ULL;
+            set->bits[0] &= ~1ULL;
+            set->bits['/' >> 6] &= ~(1ULL << ('/' & 63));
+            used = 1;
+        } else if (*p == GLOB_CLASS && (used = parse_class(p, end, set)) > 0) {
+            c->type = COMPONENT_PATTERN;
+        } else {
+            add_byte(set, unmark(*p));
+            used = 1;
+        }
+        p += used;
+        len++;
+    }
+    end_run(a, c, sets, len);
+    /* Only the name is needed if nothing was a pattern */
+    if (c->type == COMPONENT_PATTERN)
+        return;
+    c->text = arena_alloc(a, n + 1);
+    for (const char *p = s; p < end; p++)
+        c->text[c->len++] = unmark(*p);
+    c->text[c->len] = '\0';
+}
+
+static int run_at(const run *r, const char *name) {
+    if (r->literal != NULL)
+        return memcmp(name, r->literal, r->len) == 0;
+    for (size_t i = 0; i < r->len; i++) {
+        if (!has_byte(&r->sets[i], name[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/* Leftmost start in [from, to] where r matches, -1 if none */
+static long find_run(const run *r, const char *name, size_t from, size_t to) {
+    if (r->literal != NULL) {
+        const char *hit = memmem(name + from, to - from + r->len, r->literal, r->len);
+        return hit != NULL ? hit - name : -1;
+    }
+    for (size_t i = from; i <= to; i++) {
+        if (run_at(r, name + i))
+            return i;
+    }
+    return -1;
+}
+
+/* The first and last runs are pinned to the ends of the name and
+ * each one between goes at its leftmost match after the one before.
+ * Taking the leftmost never rules out a match later on, so nothing
+ * is ever tried again.
+ */
+static int match_component(const component *c, const char *name, size_t len) {
+    const run *first = &c->runs[0], *last = &c->runs[c->run_count - 1];
+
+    if (len < c->min_len || (name[0] == '.' && !c->dot))
+        return 0;
+    if (c->run_count == 1)
+        return len == first->len && run_at(first, name);
+    if (!run_at(first, name) || !run_at(last, name + len - last->len))
+        return 0;
+    size_t pos = first->len, limit = len - last->len;
+    for (int i = 1; i < c->run_count - 1; i++) {
+        const run *r = &c->runs[i];
+        if (pos + r->len > limit)
+            return 0;
+        long at = find_run(r, name, pos, limit - r->len);
+        if (at < 0)
+            return 0;
+        pos = at + r->len;
+    }
+    return 1;
+}
+
+/* Put name after the first len bytes of path, returns the new length */
+static size_t append_name(size_t len, const char *name, size_t name_len) {
+    path = grow(path, &path_capacity, 1, len + name_len + 3);
+    if (len > 0 && path[len - 1] != '/')
+        path[len++] = '/';
+    memcpy(path + len, name, name_len);
+    len += name_len;
+    path[len] = '\0';
+    return len;
+}
+
+static void push_path(glob_list *l, size_t len) {
+    l->text = grow(l->text, &l->text_capacity, 1, l->text_len + len + 1);
+    l->offsets = grow(l->offsets, &l->capacity, sizeof(size_t), l->count + 1);
+    memcpy(l->text + l->text_len, path, len + 1);
+    l->offsets[l->count++] = l->text_len;
+    l->text_len += len + 1;
+}
+
+/* True if the entry at path is a directory, following symlinks
+ * unless nofollow.
+ */
+static int is_directory(unsigned char type, int nofollow) {
+    struct stat st;
+
+    if (type == DT_DIR)
+        return 1;
+    if (type != DT_UNKNOWN && (type != DT_LNK || nofollow))
+        return 0;
+    if ((nofollow ? lstat(path, &st) : stat(path, &st)) < 0)
+        return 0;
+    return S_ISDIR(st.st_mode);
+}
+
+static void add_match(walk *w, size_t len, unsigned char type) {
+    if (w->dirs_only) {
+        if (!is_directory(type, 0))
+            return;
+        path[len++] = '/';
+        path[len] = '\0';
+    }
+    push_path(w->list, len);
+}
+
+static void expand_from(walk *w, int i, size_t len);
+
+/* Every entry of the directory so far that matches component i */
+static void expand_entries(walk *w, int i, size_t len) {
+    const component *c = &w->components[i];
+    listing *l = get_listing(len > 0 ? path : ".");
+
+    if (l == NULL)
+        return;
+    /* The table may grow further down, its buffers stay put */
+    const char *names = l->names;
+    const entry *entries = l->entries;
+    size_t n = l->count;
+    for (size_t e = 0; e < n; e++) {
+        const char *name = names + entries[e].name;
+        if (!match_component(c, name, entries[e].len))
+            continue;
+        size_t next = append_name(len, name, entries[e].len);
+        if (i + 1 == w->count)
+            add_match(w, next, entries[e].type);
+        else
+            expand_from(w, i + 1, next);
+        path[len] = '\0';
+    }
+}
+
+/* ** is no directory at all, then every directory under this one
+ * that isn't hidden, without following symlinks.
+ */
+static void expand_any_dirs(walk *w, int i, size_t len) {
+    expand_from(w, i + 1, len);
+    listing *l = get_listing(len > 0 ? path : ".");
+    if (l == NULL)
+        return;
+    const char *names = l->names;
+    const entry *entries = l->entries;
+    size_t n = l->count;
+    for (size_t e = 0; e < n; e++) {
+        const char *name = names + entries[e].name;
+        if (name[0] == '.')
+            continue;
+        size_t next = append_name(len, name, entries[e].len);
+        if (is_directory(entries[e].type, 1))
+            expand_any_dirs(w, i, next);
+        path[len] = '\0';
+    }
+}
+
+/* Match components i onwards after the first len bytes of path */
+static void expand_from(walk *w, int i, size_t len) {
+    const component *c = &w->components[i];
+
+    switch (c->type) {
+    case COMPONENT_PATTERN:
+        expand_entries(w, i, len);
+        break;
+    case COMPONENT_ANY_DIRS:
+        expand_any_dirs(w, i, len);
+        break;
+    case COMPONENT_LITERAL: {
+        size_t next = append_name(len, c->text, c->len);
+        struct stat st;
+        if (i + 1 < w->count)
+            expand_from(w, i + 1, next);
+        else if (lstat(path, &st) == 0)
+            add_match(w, next, S_ISDIR(st.st_mode) ? DT_DIR : DT_UNKNOWN);
+        path[len] = '\0';
+        break;
+    }
+    }
+}
+
+static int compare_paths(const void *a, const void *b, void *text) {
+    return strcmp((char *)text + *(const size_t *)a, (char *)text + *(const size_t *)b);
+}
+
+/* Add the sorted paths matching pattern */
+size_t glob_word(const char *pattern, size_t len, glob_list *list) {
+    const char *p = pattern, *end = pattern + len;
+    arena *a = new_arena(len * (2 * sizeof(byte_set) + sizeof(component)) + 256);
+    walk w = { NULL, 0, 0, list };
+    size_t before = list->count;
+    int is_pattern = 0;
+
+    /* Components are what's between slashes, empty ones dropped */
+    size_t slashes = 0;
+    for (size_t i = 0; i < len; i++)
+        slashes += pattern[i] == '/';
+    w.components = arena_alloc(a, (slashes + 2) * sizeof(component));
+    while (p < end) {
+        const char *slash = memchr(p, '/', end - p);
+        const char *stop = slash != NULL ? slash : end;
+        if (stop > p) {
+            component *c = &w.components[w.count++];
+            compile_component(a, p, stop - p, c);
+            is_pattern |= c->type != COMPONENT_LITERAL;
+        }
+        p = stop + (slash != NULL);
+    }
+    w.dirs_only = len > 0 && pattern[len - 1] == '/';
+    if (!is_pattern) {
+        arena_release(a);
+        return 0;
+    }
+    /* A trailing ** is everything under the directory, like a ** / * */
+    if (w.count > 0 && w.components[w.count - 1].type == COMPONENT_ANY_DIRS) {
+        static const char star = GLOB_STAR;
+        compile_component(a, &star, 1, &w.components[w.count++]);
+    }
+
+    STAT_INC(globs);
+    path = grow(path, &path_capacity, 1, 2);
+    path[0] = '\0';
+    size_t start = 0;
+    if (pattern[0] == '/') {
+        path[0] = '/';
+        path[1] = '\0';
+        start = 1;
+    }
+    expand_from(&w, 0, start);
+    arena_release(a);
+    qsort_r(list->offsets + before, list->count - before, sizeof(size_t),
+            compare_paths, list->text);
+    return list->count - before;
+}
+
+/* Empty the list, keeping its memory */
+void clear_glob_list(glob_list *list) {
+    list->text_len = 0;
+    list->count = 0;
+}
+
+/* Free the memory held by the list */
+void free_glob_list(glob_list *list) {
+    free(list->text);
+    free(list->offsets);
+    memset(list, 0, sizeof(glob_list));
+}
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "placement.h"
+
+typedef enum {
+    PLACE_OFF,  /* leave it to the kernel */
+    PLACE_CPU,  /* next CPU for every job */
+    PLACE_NODE, /* next NUMA node for every job */
+    PLACE_SET   /* the same CPUs for every job */
+} place_mode;
+
+static place_mode mode = PLACE_OFF;
+static cpu_set_t fixed_cpus;
+static int next_slot = 0;
+
+/* Applied to every background job whatever the mode */
+static char set_nice = 0;
+static int nice_value = 0;
+static int rlimit_count = 0;
+static struct {
+    int resource;
+    rlim_t value;
+} rlimits[MAX_PLACEMENT_RLIMITS];
+
+/* CPUs the shell may run on, jobs are spread over these */
+static cpu_set_t allowed;
+static int allowed_count = -1;
+
+/* Each node's CPUs that are also allowed, only nodes with some */
+static cpu_set_t nodes[MAX_NUMA_NODES];
+static int node_ids[MAX_NUMA_NODES]; /* the node number of each */
+static int node_count = -1;
+
+/* Limits "place -l" knows, named like ulimit's long options */
+static const struct {
+    const char *name;
+    int resource;
+} rlimit_names[] = {
+    { "as", RLIMIT_AS },
+    { "core", RLIMIT_CORE },
+    { "cpu", RLIMIT_CPU },
+    { "data", RLIMIT_DATA },
+    { "fsize", RLIMIT_FSIZE },
+    { "nofile", RLIMIT_NOFILE },
+    { "nproc", RLIMIT_NPROC },
+    { "stack", RLIMIT_STACK },
+};
+#define RLIMIT_NAME_COUNT (sizeof(rlimit_names) / sizeof(rlimit_names[0]))
+
+static const char *rlimit_name(int resource) {
+    for (size_t i = 0; i < RLIMIT_NAME_COUNT; i++) {
+        if (rlimit_names[i].resource == resource)
+            return rlimit_names[i].name;
+    }
+    return "?";
+}
+
+/* Parse a CPU list like "0-3,8,10-11" into set. Returns -1 if
+ * it isn't one.
+ */
+static int parse_cpu_list(const char *s, cpu_set_t *set) {
+    char *end;
+
+    CPU_ZERO(set);
+    while (*s != '\0' && *s != '\n') {
+        long first = strtol(s, &end, 10), last = first;
+        if (end == s || first < 0)
+            return -1;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first)
+                return -1;
+        }
+        if (last >= CPU_SETSIZE)
+            return -1;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, set);
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s != '\0' && *s != '\n')
+            return -1;
+    }
+    return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+/* The opposite, "0-3,8" */
+static void format_cpu_list(const cpu_set_t *set, char *buf, size_t size) {
+    size_t len = 0;
+
+    buf[0] = '\0';
+    for (int cpu = 0; cpu < CPU_SETSIZE && len < size; cpu++) {
+        if (!CPU_ISSET(cpu, set))
+            continue;
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+            last++;
+        if (last == cpu)
+            len += snprintf(buf + len, size - len, "%s%d", len ? "," : "", cpu);
+        else
+            len += snprintf(buf + len, size - len, "%s%d-%d", len ? "," : "", cpu, last);
+        cpu = last;
+    }
+}
+
+/* Find the CPUs and NUMA nodes the first time they are needed.
+ * Without NUMA information the machine is one node.
+ */
+static void load_topology() {
+    char path[64], list[4096];
+
+    if (allowed_count >= 0)
+        return;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+        CPU_ZERO(&allowed);
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_ONLN) && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &allowed);
+    }
+    allowed_count = CPU_COUNT(&allowed);
+
+    node_count = 0;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *f = fopen(path, "re");
+        if (f == NULL)
+            continue;
+        cpu_set_t cpus;
+        if (fgets(list, sizeof(list), f) != NULL && parse_cpu_list(list, &cpus) == 0) {
+            CPU_AND(&nodes[node_count], &cpus, &allowed);
+            node_ids[node_count] = node;
+            if (CPU_COUNT(&nodes[node_count]) > 0)
+                node_count++;
+        }
+        fclose(f);
+    }
+    if (node_count == 0) {
+        nodes[0] = allowed;
+        node_ids[0] = 0;
+        node_count = 1;
+    }
+}
+
+/* The n-th allowed CPU */
+static int nth_cpu(int n) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0)
+            return cpu;
+    }
+    return 0;
+}
+
+/* Fill in the placement for the next background job */
+int next_placement(placement *pl) {
+    size_t len = 0;
+    char cpus[64];
+
+    if (mode == PLACE_OFF && !set_nice && rlimit_count == 0)
+        return 0;
+    memset(pl, 0, sizeof(*pl));
+    load_topology();
+    switch (mode) {
+    case PLACE_CPU: {
+        int cpu = nth_cpu(next_slot++ % allowed_count);
+        CPU_SET(cpu, &pl->cpus);
+        pl->pinned = 1;
+        len += snprintf(pl->label, sizeof(pl->label), "cpu %d", cpu);
+        break;
+    }
+    case PLACE_NODE: {
+        int node = next_slot++ % node_count;
+        pl->cpus = nodes[node];
+        pl->pinned = 1;
+        len += snprintf(pl->label, sizeof(pl->label), "node %d", node_ids[node]);
+        break;
+    }
+    case PLACE_SET:
+        pl->cpus = fixed_cpus;
+        pl->pinned = 1;
+        format_cpu_list(&fixed_cpus, cpus, sizeof(cpus));
+        len += snprintf(pl->label, sizeof(pl->label), "cpus %s", cpus);
+        break;
+    default:
+        break;
+    }
+    if (set_nice) {
+        pl->reniced = 1;
+        pl->nice = nice_value;
+        len += snprintf(pl->label + len, sizeof(pl->label) - len, "%snice %d",
+                len ? ", " : "", nice_value);
+    }
+    pl->rlimit_count = rlimit_count;
+    for (int i = 0; i < rlimit_count && len < sizeof(pl->label); i++) {
+        pl->rlimits[i].resource = rlimits[i].resource;
+        pl->rlimits[i].value = rlimits[i].value;
+        len += snprintf(pl->label + len, sizeof(pl->label) - len, "%s%s=%llu",
+                len ? ", " : "", rlimit_name(rlimits[i].resource),
+                (unsigned long long)rlimits[i].value);
+    }
+    return 1;
+}
+
+/* Apply pl to pid. Failures (like lowering nice without the
+ * privilege) leave that part as it was.
+ */
+void apply_placement(const placement *pl, pid_t pid) {
+    if (pl->pinned)
+        sched_setaffinity(pid, sizeof(pl->cpus), &pl->cpus);
+    if (pl->reniced)
+        setpriority(PRIO_PROCESS, pid, pl->nice);
+    for (int i = 0; i < pl->rlimit_count; i++) {
+        struct rlimit limit = { pl->rlimits[i].value, pl->rlimits[i].value };
+        prlimit(pid, pl->rlimits[i].resource, &limit, NULL);
+    }
+}
+
+/* "name=value" for "place -l", replacing an earlier limit on the
+ * same resource.
+ */
+static int add_rlimit(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    char *end;
+    size_t i;
+
+    if (eq == NULL)
+        return -1;
+    for (i = 0; i < RLIMIT_NAME_COUNT; i++) {
+        if (strlen(rlimit_names[i].name) == (size_t)(eq - arg) &&
+                strncmp(rlimit_names[i].name, arg, eq - arg) == 0)
+            break;
+    }
+    unsigned long long value = strtoull(eq + 1, &end, 10);
+    if (i == RLIMIT_NAME_COUNT || end == eq + 1 || *end != '\0')
+        return -1;
+    int n = 0;
+    while (n < rlimit_count && rlimits[n].resource != rlimit_names[i].resource)
+        n++;
+    if (n == MAX_PLACEMENT_RLIMITS)
+        return -1;
+    rlimits[n].resource = rlimit_names[i].resource;
+    rlimits[n].value = value;
+    if (n == rlimit_count)
+        rlimit_count++;
+    return 0;
+}
+
+/* Print the policy */
+static void print_policy() {
+    char cpus[256];
+
+    load_topology();
+    switch (mode) {
+    case PLACE_CPU:
+        format_cpu_list(&allowed, cpus, sizeof(cpus));
+        printf("place: one cpu per job, round-robin over %s\n", cpus);
+        break;
+    case PLACE_NODE:
+        printf("place: one node per job, round-robin over %d node%s\n",
+                node_count, node_count == 1 ? "" : "s");
+        break;
+    case PLACE_SET:
+        format_cpu_list(&fixed_cpus, cpus, sizeof(cpus));
+        printf("place: every job on cpus %s\n", cpus);
+        break;
+    default:
+        printf("place: off\n");
+        break;
+    }
+    if (set_nice)
+        printf("place: nice %d\n", nice_value);
+    for (int i = 0; i < rlimit_count; i++)
+        printf("place: limit %s=%llu\n", rlimit_name(rlimits[i].resource),
+                (unsigned long long)rlimits[i].value);
+}
+
+static int usage() {
+    fprintf(stderr, "place: usage: place [-n nice] [-l name=value] [off|cpu|node|cpu list]\n");
+    return 2;
+}
+
+/* "place [-n nice] [-l name=value] [off|cpu|node|cpu list]" */
+int run_place(int argc, char **argv) {
+    int i = 1;
+
+    if (argc == 1) {
+        print_policy();
+        return 0;
+    }
+    /* Options take their value as the next argument or stuck on (-n10) */
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        char opt = argv[i][1];
+        char *value = argv[i][2] != '\0' ? argv[i] + 2 : argv[i + 1];
+        if ((opt != 'n' && opt != 'l') || value == NULL)
+            return usage();
+        if (value == argv[i + 1])
+            i++;
+        if (opt == 'n') {
+            set_nice = 1;
+            nice_value = atoi(value);
+        } else if (add_rlimit(value) < 0) {
+            fprintf(stderr, "place: bad limit %s\n", value);
+            return 1;
+        }
+    }
+    if (i == argc)
+        return 0;
+    if (i + 1 != argc)
+        return usage();
+
+    if (strcmp(argv[i], "off") == 0) {
+        mode = PLACE_OFF;
+        set_nice = 0;
+        rlimit_count = 0;
+    } else if (strcmp(argv[i], "cpu") == 0) {
+        mode = PLACE_CPU;
+    } else if (strcmp(argv[i], "node") == 0) {
+        mode = PLACE_NODE;
+    } else if (parse_cpu_list(argv[i], &fixed_cpus) == 0) {
+        mode = PLACE_SET;
+    } else {
+        return usage();
+    }
+    next_slot = 0;
+    return 0;
+}
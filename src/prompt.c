@@ -0,0 +1,338 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "prompt.h"
+#include "event.h"
+
+#define MAX_SEGMENTS 8
+
+/* Output of a segment command is cut off after this */
+#define SEGMENT_OUTPUT_SIZE 4096
+
+/* A segment in the prompt and, for expensive ones, its cache */
+typedef struct {
+    const segment_type *type;
+    char value[SEGMENT_SIZE];   /* last value, shown until a fresh one comes */
+    char key[PATH_MAX];         /* what value was worked out for */
+    char stale;                 /* value needs working out again */
+    pid_t pid;                  /* child working it out, 0 if none */
+    int fd;                     /* read end of its output, -1 if none */
+    char *output;
+    size_t output_len;
+} segment;
+
+static segment segments[MAX_SEGMENTS];
+static int segment_count = 0;
+
+/* The last prompt built, its info line and what it was built from */
+static char prompt[PATH_MAX + MAX_SEGMENTS * SEGMENT_SIZE + sizeof(PROMPT_STRING) + 8];
+static size_t info_len = 0;
+static prompt_info last_info;
+
+/* inotify watches on the cwd and its git directory */
+static int inotify_fd = -1;
+static int watches[2] = { -1, -1 };
+static char watched_cwd[PATH_MAX];
+
+/* cwd with $HOME shortened to ~ */
+static void render_cwd(const prompt_info *info, char *buf, size_t size) {
+    const char *home = getenv("HOME");
+    size_t home_len = home ? strlen(home) : 0;
+
+    if (home_len > 1 && strncmp(info->cwd, home, home_len) == 0 &&
+            (info->cwd[home_len] == '/' || info->cwd[home_len] == '\0'))
+        snprintf(buf, size, "~%s", info->cwd + home_len);
+    else
+        snprintf(buf, size, "%s", info->cwd);
+}
+
+/* Exit status of the last job if it failed */
+static void render_status(const prompt_info *info, char *buf, size_t size) {
+    if (info->last_status != 0)
+        snprintf(buf, size, "[%d]", info->last_status);
+    else
+        buf[0] = '\0';
+}
+
+/* Number of background and stopped jobs if there are any */
+static void render_jobs(const prompt_info *info, char *buf, size_t size) {
+    if (info->job_count > 0)
+        snprintf(buf, size, "{%d job%s}", info->job_count, info->job_count == 1 ? "" : "s");
+    else
+        buf[0] = '\0';
+}
+
+/* The directory holding .git above cwd, the repository a git
+ * segment is for.
+ */
+static const char *git_key(const char *cwd, char *buf, size_t size) {
+    struct stat st;
+    char path[PATH_MAX + 8];
+
+    snprintf(buf, size, "%s", cwd);
+    while (1) {
+        snprintf(path, sizeof(path), "%s/.git", buf);
+        if (stat(path, &st) == 0)
+            return buf;
+        char *slash = strrchr(buf, '/');
+        if (slash == NULL || slash == buf)
+            return NULL;
+        *slash = '\0';
+    }
+}
+
+/* "(branch)" or "(branch*)" if tracked files were changed, from
+ * "git status --porcelain=v2 --branch".
+ */
+static void parse_git(char *output, size_t len, char *buf, size_t size) {
+    const char *branch = NULL;
+    size_t branch_len = 0;
+    int dirty = 0;
+
+    for (char *line = output; line < output + len; ) {
+        char *nl = memchr(line, '\n', output + len - line);
+        size_t line_len = nl ? (size_t)(nl - line) : (size_t)(output + len - line);
+        if (line_len > 14 && strncmp(line, "# branch.head ", 14) == 0) {
+            branch = line + 14;
+            branch_len = line_len - 14;
+        } else if (line_len > 0 && line[0] != '#') {
+            dirty = 1;
+        }
+        line += line_len + 1;
+    }
+    if (branch == NULL)
+        buf[0] = '\0';
+    else
+        snprintf(buf, size, "(%.*s%s)", (int)branch_len, branch, dirty ? "*" : "");
+}
+
+static char *const git_argv[] = {
+    "git", "status", "--porcelain=v2", "--branch", "--untracked-files=no", NULL
+};
+
+/* Don't let git rewrite the index, inotify would see it and we'd
+ * refresh forever.
+ */
+static const char *const git_env[] = { "GIT_OPTIONAL_LOCKS=0", NULL };
+
+static const segment_type segment_types[] = {
+    { "cwd", render_cwd, NULL, NULL, NULL, NULL },
+    { "git", NULL, git_argv, git_env, parse_git, git_key },
+    { "status", render_status, NULL, NULL, NULL, NULL },
+    { "jobs", render_jobs, NULL, NULL, NULL, NULL },
+};
+#define SEGMENT_TYPE_COUNT (sizeof(segment_types) / sizeof(segment_types[0]))
+
+/* Read CWSH_PROMPT and set up inotify */
+void init_prompt() {
+    const char *names = getenv("CWSH_PROMPT");
+    char list[256];
+
+    snprintf(list, sizeof(list), "%s", names ? names : DEFAULT_PROMPT_SEGMENTS);
+    for (char *name = strtok(list, ","); name && segment_count < MAX_SEGMENTS;
+            name = strtok(NULL, ",")) {
+        for (size_t i = 0; i < SEGMENT_TYPE_COUNT; i++) {
+            if (strcmp(name, segment_types[i].name) != 0)
+                continue;
+            segment *s = &segments[segment_count++];
+            s->type = &segment_types[i];
+            s->value[0] = s->key[0] = '\0';
+            s->stale = 1;
+            s->pid = 0;
+            s->fd = -1;
+            s->output = NULL;
+            s->output_len = 0;
+        }
+    }
+    strcpy(prompt, PROMPT_STRING);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0)
+        add_event_fd(inotify_fd, EVENT_PROMPT);
+}
+
+/* Watch cwd and the git directory of the repository at key for
+ * anything that could change what the segments say.
+ */
+static void watch_directories(const char *cwd, const char *key) {
+    char path[PATH_MAX + 8];
+    uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+        IN_MOVED_FROM | IN_MOVED_TO;
+
+    if (inotify_fd < 0 || strcmp(cwd, watched_cwd) == 0)
+        return;
+    snprintf(watched_cwd, sizeof(watched_cwd), "%s", cwd);
+    for (int i = 0; i < 2; i++) {
+        if (watches[i] >= 0)
+            inotify_rm_watch(inotify_fd, watches[i]);
+        watches[i] = -1;
+    }
+    watches[0] = inotify_add_watch(inotify_fd, cwd, mask | IN_ONLYDIR);
+    if (key != NULL) {
+        snprintf(path, sizeof(path), "%s/.git", key);
+        watches[1] = inotify_add_watch(inotify_fd, path, mask | IN_ONLYDIR);
+    }
+}
+
+/* Run the segment's command in the background with its output
+ * going to a pipe the event loop watches.
+ */
+static void start_refresh(segment *s, const char *dir) {
+    int pipefd[2];
+
+    if (pipe2(pipefd, O_CLOEXEC | O_NONBLOCK) < 0)
+        return;
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return;
+    }
+    if (pid == 0) {
+        int devnull = open("/dev/null", O_RDWR);
+        /* Don't let it touch the terminal or get our job control */
+        setpgid(0, 0);
+        dup2(devnull, STDIN_FILENO);
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        fcntl(STDOUT_FILENO, F_SETFL, 0);
+        restore_signal_mask();
+        for (const char *const *e = s->type->env; e && *e; e++)
+            putenv((char *)*e);
+        if (chdir(dir) == 0)
+            execvp(s->type->argv[0], s->type->argv);
+        _exit(127);
+    }
+    close(pipefd[1]);
+    s->pid = pid;
+    s->fd = pipefd[0];
+    s->stale = 0;
+    s->output_len = 0;
+    if (s->output == NULL && (s->output = malloc(SEGMENT_OUTPUT_SIZE)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    add_event_fd(s->fd, EVENT_PROMPT);
+}
+
+/* Build the prompt, the info line and "sh> " below it */
+char *render_prompt(const prompt_info *info) {
+    char value[SEGMENT_SIZE], key[PATH_MAX];
+    size_t len = 0;
+
+    if (info == NULL || segment_count == 0)
+        return prompt;
+    if (info != &last_info)
+        last_info = *info;
+    for (int i = 0; i < segment_count; i++) {
+        segment *s = &segments[i];
+        const char *v = value;
+        if (s->type->render != NULL) {
+            s->type->render(info, value, sizeof(value));
+        } else {
+            const char *k = s->type->key(info->cwd, key, sizeof(key));
+            if (k == NULL) {
+                s->key[0] = '\0';
+                s->value[0] = '\0';
+            } else {
+                if (strcmp(k, s->key) != 0) {
+                    /* Somewhere else, show the old value until we know */
+                    snprintf(s->key, sizeof(s->key), "%s", k);
+                    s->stale = 1;
+                }
+                watch_directories(info->cwd, k);
+                if (s->stale && s->pid == 0)
+                    start_refresh(s, s->key);
+            }
+            v = s->value;
+        }
+        if (v[0] == '\0')
+            continue;
+        len += snprintf(prompt + len, sizeof(prompt) - len, "%s%s", len ? " " : "", v);
+    }
+    watch_directories(info->cwd, NULL);
+    /* Always there, even if empty, so redrawing it in place is safe */
+    info_len = len;
+    snprintf(prompt + len, sizeof(prompt) - len, "\n%s", PROMPT_STRING);
+    return prompt;
+}
+
+/* Put the fresh value in place once the command is done */
+static int finish_refresh(segment *s) {
+    char value[SEGMENT_SIZE];
+    int changed;
+
+    remove_event_fd(s->fd, EVENT_PROMPT);
+    close(s->fd);
+    s->fd = -1;
+    s->pid = 0; /* Reaped with everything else by the main loop */
+    s->type->parse(s->output, s->output_len, value, sizeof(value));
+    changed = strcmp(value, s->value) != 0;
+    strcpy(s->value, value);
+    if (s->stale)
+        start_refresh(s, s->key); /* Changed again meanwhile */
+    return changed;
+}
+
+/* Refresh the expensive segments when the prompt is next built */
+void mark_prompt_stale() {
+    for (int i = 0; i < segment_count; i++) {
+        if (segments[i].type->render == NULL)
+            segments[i].stale = 1;
+    }
+}
+
+/* Handle segment output and inotify events */
+int prompt_events() {
+    char events[4096];
+    int changed = 0;
+    ssize_t n;
+
+    if (inotify_fd >= 0 && read(inotify_fd, events, sizeof(events)) > 0) {
+        while (read(inotify_fd, events, sizeof(events)) > 0)
+            ;
+        for (int i = 0; i < segment_count; i++) {
+            segment *s = &segments[i];
+            if (s->type->render != NULL || s->key[0] == '\0')
+                continue;
+            s->stale = 1;
+            if (s->pid == 0)
+                start_refresh(s, s->key);
+        }
+    }
+    for (int i = 0; i < segment_count; i++) {
+        segment *s = &segments[i];
+        if (s->fd < 0)
+            continue;
+        while ((n = read(s->fd, s->output + s->output_len,
+                        SEGMENT_OUTPUT_SIZE - s->output_len)) > 0)
+            s->output_len += n;
+        /* EOF, or full and we don't care about the rest */
+        if (n == 0 || s->output_len == SEGMENT_OUTPUT_SIZE)
+            changed |= finish_refresh(s);
+    }
+    if (changed)
+        render_prompt(&last_info);
+    return changed;
+}
+
+/* Save the cursor, go up to the info line, rewrite it and go
+ * back. One write() so it can't be split up by other output.
+ */
+void redraw_prompt_info(int rows) {
+    char buf[sizeof(prompt) + 32];
+    int len = snprintf(buf, sizeof(buf), "\0337\033[%dA\r%.*s\033[K\0338",
+            rows + 1, (int)info_len, prompt);
+
+    fflush(stdout);
+    if (write(STDOUT_FILENO, buf, len) < 0)
+        perror("write");
+}
@@ -0,0 +1,878 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "script.h"
+#include "arena.h"
+#include "builtin.h"
+#include "launch.h"
+#include "parse.h"
+#include "pathglob.h"
+#include "stats.h"
+#include "vars.h"
+
+typedef enum {
+    OP_RUN,           /* run command a */
+    OP_JUMP,          /* go to a */
+    OP_JUMP_IF_FALSE, /* go to a if last_status isn't 0 */
+    OP_JUMP_IF_TRUE,  /* go to a if it is */
+    OP_STATUS,        /* set last_status to a */
+    OP_FOR_INIT,      /* start loop b */
+    OP_FOR_NEXT,      /* next word of command c into its variable, or go to a */
+    OP_KEEP_STATUS,   /* keep last_status in loop b */
+    OP_LOOP_STATUS,   /* set last_status to what loop b kept */
+    OP_DEFINE,        /* define the function command a names, starting at b */
+    OP_RETURN         /* back to the caller */
+} opcode;
+
+typedef struct {
+    opcode op;
+    int a, b, c;
+} instruction;
+
+typedef struct function function;
+
+/* A command in a program. Simple ones (just words, the first
+ * one a plain name) keep an argv of their words and run a builtin
+ * or function straight from it, with only the words that have
+ * variables expanded each time. Anything else is parsed from its
+ * tokens each time it runs, it gets fresh jobs to launch. for
+ * loops and function names keep their words here too.
+ */
+typedef struct {
+    size_t start;           /* first token */
+    size_t count;
+    char **argv;            /* NULL unless simple, words as lexed */
+    char **expanded;        /* argv with the variables filled in */
+    char *buffer;           /* expanded words */
+    size_t buffer_size;
+    char expand;            /* some words have variables */
+    char glob;              /* some for words are patterns */
+    builtin_fn fn;          /* what argv[0] was last found to be */
+    function *fun;
+    unsigned long generation; /* function_generation when looked up */
+} command;
+
+struct program {
+    arena *arena;           /* token text and argvs */
+    token_list tokens;      /* of every line so far */
+    instruction *code;
+    size_t code_count;
+    size_t code_capacity;
+    command *commands;
+    size_t command_count;
+    size_t command_capacity;
+    int loop_slots;         /* for and while loops, each needs a loop_state */
+    int keep;               /* has functions, never freed */
+};
+
+struct function {
+    char *name;
+    program *program;
+    int entry;              /* first instruction of the body */
+};
+
+static function *functions = NULL;
+static size_t function_count = 0;
+static size_t function_capacity = 0;
+
+/* Moves on whenever a function is defined, so commands know to
+ * look their name up again.
+ */
+static unsigned long function_generation = 1;
+
+static void (*launch)(job **jobs, int job_count) = NULL;
+
+/* Lines of a construct that isn't closed yet */
+static program *pending = NULL;
+
+static volatile sig_atomic_t interrupted = 0;
+static int depth = 0;
+
+/* Enclosing loop while compiling, for break and continue */
+typedef struct loop {
+    struct loop *outer;
+    int next;               /* where continue goes */
+    int breaks;             /* last break jump, each links to the one before */
+} loop;
+
+typedef struct {
+    program *p;
+    size_t pos;             /* next token */
+    int incomplete;         /* ran out of tokens */
+    loop *loop;
+    int in_function;
+} compiler;
+
+static const char *const keywords[] = {
+    "if", "then", "elif", "else", "fi", "while", "until", "do", "done",
+    "for", "function", "{", "}", "break", "continue", "return", NULL
+};
+
+static void *grow(void *array, size_t *capacity, size_t size) {
+    *capacity = *capacity ? *capacity * 2 : 16;
+    array = realloc(array, *capacity * size);
+    if (array == NULL) {
+        perror("realloc");
+        exit(1);
+    }
+    return array;
+}
+
+static int is_one_of(const token *t, const char *const *words) {
+    for (; *words != NULL; words++) {
+        if (token_is(t, *words))
+            return 1;
+    }
+    return 0;
+}
+
+/* "name()" or "name ()" at tokens[i] */
+static int defines_function(const token *tokens, size_t count, size_t i) {
+    const token *t = &tokens[i];
+    if (t->type != TOKEN_WORD)
+        return 0;
+    if (t->len > 2 && memcmp(t->start + t->len - 2, "()", 2) == 0)
+        return 1;
+    return i + 1 < count && token_is(&tokens[i + 1], "()");
+}
+
+/* True if the tokens need the compiler */
+int needs_compiler(const token_list *tl) {
+    int separated = 0;
+
+    if (pending != NULL)
+        return 1;
+    for (size_t i = 0; i < tl->count; i++) {
+        /* The parser expands a whole line at once, "A=1; echo $A"
+         * and "touch a.c; echo *.c" need the commands expanded as
+         * they run.
+         */
+        separated |= tl->tokens[i].type == TOKEN_SEMI || tl->tokens[i].type == TOKEN_AMP;
+        if (separated && (tl->tokens[i].expand || tl->tokens[i].glob))
+            return 1;
+        /* Only words in command position count, "echo if" is fine */
+        if (i > 0 && tl->tokens[i - 1].type != TOKEN_SEMI &&
+                tl->tokens[i - 1].type != TOKEN_AMP &&
+                tl->tokens[i - 1].type != TOKEN_PIPE)
+            continue;
+        if (is_one_of(&tl->tokens[i], keywords) ||
+                defines_function(tl->tokens, tl->count, i))
+            return 1;
+    }
+    return 0;
+}
+
+int compile_pending() {
+    return pending != NULL;
+}
+
+static void free_program(program *p) {
+    for (size_t i = 0; i < p->command_count; i++)
+        free(p->commands[i].buffer);
+    arena_release(p->arena);
+    free(p->tokens.tokens);
+    free(p->code);
+    free(p->commands);
+    free(p);
+}
+
+static token *peek(compiler *c) {
+    if (c->pos < c->p->tokens.count)
+        return &c->p->tokens.tokens[c->pos];
+    return NULL;
+}
+
+/* Complain about the next token. Running out of tokens isn't an
+ * error, more lines can finish the construct.
+ */
+static int syntax_error(compiler *c) {
+    token *t = peek(c);
+    if (t == NULL)
+        c->incomplete = 1;
+    else
+        printf("Syntax error near %.*s\n", (int)t->len, t->start);
+    return -1;
+}
+
+static int emit(compiler *c, opcode op, int a, int b, int cc) {
+    program *p = c->p;
+    if (p->code_count == p->code_capacity)
+        p->code = grow(p->code, &p->code_capacity, sizeof(instruction));
+    p->code[p->code_count] = (instruction){ op, a, b, cc };
+    return p->code_count++;
+}
+
+/* Point a chain of break jumps at to */
+static void patch_breaks(compiler *c, int jump, int to) {
+    while (jump >= 0) {
+        int next = c->p->code[jump].a;
+        c->p->code[jump].a = to;
+        jump = next;
+    }
+}
+
+static int add_command(compiler *c, size_t start, size_t count, char **argv, int expand) {
+    program *p = c->p;
+    command *cmd;
+
+    if (p->command_count == p->command_capacity)
+        p->commands = grow(p->commands, &p->command_capacity, sizeof(command));
+    cmd = &p->commands[p->command_count];
+    memset(cmd, 0, sizeof(command));
+    cmd->start = start;
+    cmd->count = count;
+    cmd->argv = argv;
+    cmd->expand = expand;
+    if (expand && argv != NULL) {
+        size_t argc = 0;
+        while (argv[argc] != NULL)
+            argc++;
+        cmd->expanded = arena_alloc(p->arena, (argc + 1) * sizeof(char *));
+    }
+    return p->command_count++;
+}
+
+/* A small number word like "2", or -1 */
+static int token_number(const token *t) {
+    int n = 0;
+    if (t->type != TOKEN_WORD || t->len == 0 || t->len > 6)
+        return -1;
+    for (size_t i = 0; i < t->len; i++) {
+        if (t->start[i] < '0' || t->start[i] > '9')
+            return -1;
+        n = n * 10 + t->start[i] - '0';
+    }
+    return n;
+}
+
+/* Nothing but ";" or the end may follow a construct */
+static int end_command(compiler *c) {
+    token *t = peek(c);
+    if (t != NULL && t->type != TOKEN_SEMI)
+        return syntax_error(c);
+    return 0;
+}
+
+static void skip_separators(compiler *c) {
+    while (c->pos < c->p->tokens.count && c->p->tokens.tokens[c->pos].type == TOKEN_SEMI)
+        c->pos++;
+}
+
+/* The next token has to be the keyword s */
+static int expect(compiler *c, const char *s) {
+    token *t = peek(c);
+    if (t == NULL || !token_is(t, s))
+        return syntax_error(c);
+    c->pos++;
+    return 0;
+}
+
+static int compile_list(compiler *c, const char *const *ends);
+
+/* Everything up to ";" or "&" (which is kept, it makes the job a
+ * background one). The parser checks it now, so a syntax error
+ * shows up before anything runs.
+ */
+static int compile_simple(compiler *c) {
+    program *p = c->p;
+    size_t start = c->pos;
+    char **argv = NULL;
+    int expand = 0;
+    token *t;
+
+    while ((t = peek(c)) != NULL && t->type != TOKEN_SEMI) {
+        c->pos++;
+        if (t->type == TOKEN_AMP)
+            break;
+    }
+    token_list view = { p->tokens.tokens + start, c->pos - start, c->pos - start };
+    if (check_command_line(&view) < 0)
+        return -1;
+
+    /* Words only and a name to look up first, "time",
+     * assignments and patterns are left to the parser.
+     */
+    t = &view.tokens[0];
+    int simple = !t->expand && !is_assignment(t->start, t->len) && !token_is(t, "time");
+    for (size_t i = 0; i < view.count && simple; i++) {
+        simple = view.tokens[i].type == TOKEN_WORD && !view.tokens[i].glob;
+        expand |= view.tokens[i].expand;
+    }
+    if (simple) {
+        /* The copied tokens are NUL terminated already */
+        argv = arena_alloc(p->arena, (view.count + 1) * sizeof(char *));
+        for (size_t i = 0; i < view.count; i++)
+            argv[i] = view.tokens[i].start;
+        argv[view.count] = NULL;
+    }
+    emit(c, OP_RUN, add_command(c, start, view.count, argv, expand), 0, 0);
+    return 0;
+}
+
+/* if list; then list; [elif list; then list;]... [else list;] fi */
+static int compile_if(compiler *c) {
+    static const char *const cond_ends[] = { "then", NULL };
+    static const char *const body_ends[] = { "elif", "else", "fi", NULL };
+    static const char *const else_ends[] = { "fi", NULL };
+    int done = -1;
+
+    c->pos++;
+    while (1) {
+        if (compile_list(c, cond_ends) < 0)
+            return -1;
+        c->pos++;
+        int skip = emit(c, OP_JUMP_IF_FALSE, -1, 0, 0);
+        if (compile_list(c, body_ends) < 0)
+            return -1;
+        token *t = &c->p->tokens.tokens[c->pos++];
+        if (token_is(t, "fi")) {
+            /* No branch taken is a success, the body jumps over that */
+            done = emit(c, OP_JUMP, done, 0, 0);
+            c->p->code[skip].a = emit(c, OP_STATUS, 0, 0, 0);
+            break;
+        }
+        done = emit(c, OP_JUMP, done, 0, 0);
+        c->p->code[skip].a = c->p->code_count;
+        if (token_is(t, "else")) {
+            if (compile_list(c, else_ends) < 0)
+                return -1;
+            c->pos++;
+            break;
+        }
+        /* elif, around again */
+    }
+    patch_breaks(c, done, c->p->code_count);
+    return end_command(c);
+}
+
+/* while list; do list; done, or until */
+static int compile_while(compiler *c) {
+    static const char *const cond_ends[] = { "do", NULL };
+    static const char *const body_ends[] = { "done", NULL };
+    int until = token_is(peek(c), "until");
+    int slot = c->p->loop_slots++;
+
+    /* The condition replaces last_status, so the last body's
+     * (0 before the first) is kept aside to be the loop's.
+     */
+    c->pos++;
+    emit(c, OP_STATUS, 0, 0, 0);
+    int top = emit(c, OP_KEEP_STATUS, 0, slot, 0);
+    if (compile_list(c, cond_ends) < 0)
+        return -1;
+    c->pos++;
+    int leave = emit(c, until ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, -1, 0, 0);
+    loop l = { c->loop, top, -1 };
+    c->loop = &l;
+    int compiled = compile_list(c, body_ends);
+    c->loop = l.outer;
+    if (compiled < 0)
+        return -1;
+    c->pos++;
+    emit(c, OP_JUMP, top, 0, 0);
+    c->p->code[leave].a = emit(c, OP_LOOP_STATUS, 0, slot, 0);
+    if (l.breaks >= 0) {
+        /* Leaving with break is a success */
+        int done = emit(c, OP_JUMP, -1, 0, 0);
+        patch_breaks(c, l.breaks, emit(c, OP_STATUS, 0, 0, 0));
+        c->p->code[done].a = c->p->code_count;
+    }
+    return end_command(c);
+}
+
+/* for name in words; do list; done */
+static int compile_for(compiler *c) {
+    static const char *const body_ends[] = { "done", NULL };
+    program *p = c->p;
+    token *t;
+
+    c->pos++;
+    size_t name = c->pos;
+    t = peek(c);
+    if (t == NULL || t->type != TOKEN_WORD || is_one_of(t, keywords))
+        return syntax_error(c);
+    c->pos++;
+    if (expect(c, "in") < 0)
+        return -1;
+    size_t first = c->pos;
+    while ((t = peek(c)) != NULL && t->type == TOKEN_WORD)
+        c->pos++;
+    if (t == NULL || t->type != TOKEN_SEMI)
+        return syntax_error(c);
+
+    /* The variable's name, then the words */
+    size_t count = c->pos - first;
+    char **words = arena_alloc(p->arena, (count + 2) * sizeof(char *));
+    int expand = 0, glob = 0;
+    words[0] = p->tokens.tokens[name].start;
+    for (size_t i = 0; i < count; i++) {
+        words[i + 1] = p->tokens.tokens[first + i].start;
+        expand |= p->tokens.tokens[first + i].expand;
+        glob |= p->tokens.tokens[first + i].glob;
+    }
+    words[count + 1] = NULL;
+    int list = add_command(c, name, 1, NULL, expand);
+    p->commands[list].argv = words;
+    p->commands[list].glob = glob;
+
+    skip_separators(c);
+    if (expect(c, "do") < 0)
+        return -1;
+    int slot = p->loop_slots++;
+    emit(c, OP_FOR_INIT, 0, slot, 0);
+    int top = emit(c, OP_FOR_NEXT, -1, slot, list);
+    loop l = { c->loop, top, -1 };
+    c->loop = &l;
+    int compiled = compile_list(c, body_ends);
+    c->loop = l.outer;
+    if (compiled < 0)
+        return -1;
+    c->pos++;
+    emit(c, OP_JUMP, top, 0, 0);
+    p->code[top].a = p->code_count;
+    patch_breaks(c, l.breaks, p->code_count);
+    return end_command(c);
+}
+
+/* name() { list; } or function name [()] { list; }. The body is
+ * compiled in place behind a jump, the function runs it from
+ * this program.
+ */
+static int compile_function(compiler *c) {
+    static const char *const body_ends[] = { "}", NULL };
+    program *p = c->p;
+    token *t = peek(c);
+
+    if (token_is(t, "function")) {
+        c->pos++;
+        t = peek(c);
+        if (t == NULL || t->type != TOKEN_WORD || is_one_of(t, keywords))
+            return syntax_error(c);
+    }
+    size_t name = c->pos++;
+    size_t len = t->len;
+    if (len > 2 && memcmp(t->start + len - 2, "()", 2) == 0)
+        len -= 2;
+    else if ((t = peek(c)) != NULL && token_is(t, "()"))
+        c->pos++;
+    skip_separators(c);
+    if (expect(c, "{") < 0)
+        return -1;
+
+    char **argv = arena_alloc(p->arena, 2 * sizeof(char *));
+    argv[0] = arena_strndup(p->arena, p->tokens.tokens[name].start, len);
+    argv[1] = NULL;
+    int define = emit(c, OP_DEFINE, add_command(c, name, 1, argv, 0), -1, 0);
+    int skip = emit(c, OP_JUMP, -1, 0, 0);
+    p->code[define].b = p->code_count;
+
+    /* Loops around the definition aren't the body's */
+    loop *outer = c->loop;
+    int in_function = c->in_function;
+    c->loop = NULL;
+    c->in_function = 1;
+    int compiled = compile_list(c, body_ends);
+    c->loop = outer;
+    c->in_function = in_function;
+    if (compiled < 0)
+        return -1;
+    c->pos++;
+    emit(c, OP_RETURN, 0, 0, 0);
+    p->code[skip].a = p->code_count;
+    return end_command(c);
+}
+
+/* break [n] and continue [n] */
+static int compile_jump(compiler *c) {
+    int is_break = token_is(peek(c), "break");
+    int n = 1;
+    token *t;
+
+    c->pos++;
+    if ((t = peek(c)) != NULL && t->type == TOKEN_WORD) {
+        if ((n = token_number(t)) < 1)
+            return syntax_error(c);
+        c->pos++;
+    }
+    loop *l = c->loop;
+    if (l == NULL) {
+        printf("Syntax error near %s outside a loop\n", is_break ? "break" : "continue");
+        return -1;
+    }
+    /* More levels than there are loops means the outermost */
+    while (--n > 0 && l->outer != NULL)
+        l = l->outer;
+    if (is_break)
+        l->breaks = emit(c, OP_JUMP, l->breaks, 0, 0);
+    else
+        emit(c, OP_JUMP, l->next, 0, 0);
+    return end_command(c);
+}
+
+/* return [n] */
+static int compile_return(compiler *c) {
+    token *t;
+
+    if (!c->in_function) {
+        printf("Syntax error near return outside a function\n");
+        return -1;
+    }
+    c->pos++;
+    if ((t = peek(c)) != NULL && t->type == TOKEN_WORD) {
+        int n = token_number(t);
+        if (n < 0)
+            return syntax_error(c);
+        emit(c, OP_STATUS, n & 0xff, 0, 0);
+        c->pos++;
+    }
+    emit(c, OP_RETURN, 0, 0, 0);
+    return end_command(c);
+}
+
+static int compile_command(compiler *c) {
+    static const char *const group_ends[] = { "}", NULL };
+    token *t = peek(c);
+
+    if (token_is(t, "if"))
+        return compile_if(c);
+    if (token_is(t, "while") || token_is(t, "until"))
+        return compile_while(c);
+    if (token_is(t, "for"))
+        return compile_for(c);
+    if (token_is(t, "function") || defines_function(c->p->tokens.tokens, c->p->tokens.count, c->pos))
+        return compile_function(c);
+    if (token_is(t, "break") || token_is(t, "continue"))
+        return compile_jump(c);
+    if (token_is(t, "return"))
+        return compile_return(c);
+    if (token_is(t, "{")) {
+        c->pos++;
+        if (compile_list(c, group_ends) < 0)
+            return -1;
+        c->pos++;
+        return end_command(c);
+    }
+    if (is_one_of(t, keywords)) {
+        /* A "fi" or "done" without its start */
+        return syntax_error(c);
+    }
+    return compile_simple(c);
+}
+
+/* Commands up to one of the keywords in ends, which is left as
+ * the next token. At the top level ends is NULL and the list goes
+ * on to the last token.
+ */
+static int compile_list(compiler *c, const char *const *ends) {
+    int commands = 0;
+
+    while (1) {
+        skip_separators(c);
+        token *t = peek(c);
+        if (t == NULL) {
+            if (ends == NULL)
+                return 0;
+            c->incomplete = 1;
+            return -1;
+        }
+        if (ends != NULL && is_one_of(t, ends)) {
+            /* "then fi" and such, there has to be something */
+            if (commands == 0)
+                return syntax_error(c);
+            return 0;
+        }
+        if (compile_command(c) < 0)
+            return -1;
+        commands++;
+    }
+}
+
+/* Add the line to the pending program and compile everything */
+program *compile_line(const token_list *tl) {
+    program *p = pending;
+
+    if (p == NULL) {
+        p = calloc(1, sizeof(program));
+        if (p == NULL) {
+            perror("calloc");
+            exit(1);
+        }
+        p->arena = new_arena(4096);
+    }
+    /* A line break ends a command like ";" */
+    size_t needed = p->tokens.count + tl->count + 1;
+    if (needed > p->tokens.capacity) {
+        p->tokens.capacity = needed * 2;
+        p->tokens.tokens = realloc(p->tokens.tokens, p->tokens.capacity * sizeof(token));
+        if (p->tokens.tokens == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    if (p->tokens.count > 0)
+        p->tokens.tokens[p->tokens.count++] = (token){ TOKEN_SEMI, ";", 1, -1 };
+    for (size_t i = 0; i < tl->count; i++) {
+        token t = tl->tokens[i];
+        /* Copied NUL terminated, for loops use the words as they are */
+        t.start = arena_strndup(p->arena, t.start, t.len);
+        p->tokens.tokens[p->tokens.count++] = t;
+    }
+
+    /* Start over on every line, constructs are a few lines long */
+    compiler c = { p, 0, 0, NULL, 0 };
+    p->code_count = 0;
+    p->command_count = 0;
+    p->loop_slots = 0;
+    if (compile_list(&c, NULL) == 0) {
+        emit(&c, OP_RETURN, 0, 0, 0);
+        pending = NULL;
+        return p;
+    }
+    if (c.incomplete) {
+        pending = p;
+    } else {
+        free_program(p);
+        pending = NULL;
+    }
+    return NULL;
+}
+
+static function *find_function(const char *name) {
+    for (size_t i = 0; i < function_count; i++) {
+        if (strcmp(functions[i].name, name) == 0)
+            return &functions[i];
+    }
+    return NULL;
+}
+
+int is_function(const char *name) {
+    return function_count > 0 && find_function(name) != NULL;
+}
+
+/* (Re)define a function. The program it is in stays around for
+ * good, older definitions' programs too since a running function
+ * may be in one.
+ */
+static void define_function(const char *name, program *p, int entry) {
+    function *f = find_function(name);
+
+    if (f == NULL) {
+        if (function_count == function_capacity)
+            functions = grow(functions, &function_capacity, sizeof(function));
+        f = &functions[function_count++];
+        if ((f->name = strdup(name)) == NULL) {
+            perror("strdup");
+            exit(1);
+        }
+    }
+    f->program = p;
+    f->entry = entry;
+    p->keep = 1;
+    function_generation++;
+}
+
+static void run_code(program *p, int pc);
+
+static void run_function(function *f, char **argv) {
+    /* Definitions can move f meanwhile */
+    program *p = f->program;
+    int entry = f->entry;
+
+    if (depth >= MAX_FUNCTION_DEPTH) {
+        fprintf(stderr, "%s: functions nested too deep\n", argv[0]);
+        last_status = 1;
+        interrupted = 1;
+        return;
+    }
+    /* Its arguments are $1 onwards while it runs */
+    positional *caller = set_positional(argv + 1);
+    depth++;
+    last_status = 0;
+    run_code(p, entry);
+    depth--;
+    restore_positional(caller);
+}
+
+/* Run the function argv[0] */
+void call_function(char **argv) {
+    if (depth == 0)
+        interrupted = 0;
+    run_function(find_function(argv[0]), argv);
+}
+
+/* Room for size bytes in the command's buffer */
+static char *command_buffer(command *cmd, size_t size) {
+    if (size > cmd->buffer_size) {
+        free(cmd->buffer);
+        cmd->buffer_size = size * 2;
+        if ((cmd->buffer = malloc(cmd->buffer_size)) == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    return cmd->buffer;
+}
+
+/* Expand the words of a simple command that have variables */
+static char **expand_argv(command *cmd) {
+    size_t size = 0;
+    int argc;
+
+    for (argc = 0; cmd->argv[argc] != NULL; argc++) {
+        if (strchr(cmd->argv[argc], VAR_MARK) != NULL)
+            size += expanded_length(cmd->argv[argc], strlen(cmd->argv[argc])) + 1;
+    }
+    char *w = command_buffer(cmd, size);
+    for (int i = 0; i < argc; i++) {
+        cmd->expanded[i] = cmd->argv[i];
+        if (strchr(cmd->argv[i], VAR_MARK) != NULL) {
+            cmd->expanded[i] = expand_into(cmd->argv[i], strlen(cmd->argv[i]), w);
+            w += strlen(w) + 1;
+        }
+    }
+    cmd->expanded[argc] = NULL;
+    return cmd->expanded;
+}
+
+static void run_command(program *p, command *cmd) {
+    command_line cl;
+
+    if (cmd->argv != NULL) {
+        char **argv = cmd->expand ? expand_argv(cmd) : cmd->argv;
+        if (cmd->generation != function_generation) {
+            cmd->fun = find_function(cmd->argv[0]);
+            cmd->fn = cmd->fun ? NULL : find_builtin(cmd->argv[0]);
+            cmd->generation = function_generation;
+        }
+        if (cmd->fun != NULL) {
+            run_function(cmd->fun, argv);
+            return;
+        }
+        if (cmd->fn != NULL && !builtin_forks(cmd->fn)) {
+            last_status = run_builtin(cmd->fn, argv);
+            STAT_INC(builtins);
+            return;
+        }
+    }
+    /* Fresh jobs from the tokens, launching uses them up */
+    token_list view = { p->tokens.tokens + cmd->start, cmd->count, cmd->count };
+    if (parse_command_line(&view, &cl) < 0) {
+        last_status = 2;
+        return;
+    }
+    launch(cl.jobs, cl.job_count);
+    release_command_line(&cl);
+    /* Ctrl-C killed it, stop the whole thing like the user meant */
+    if (shell_is_interactive && last_status == 128 + SIGINT)
+        interrupted = 1;
+}
+
+/* A loop while it runs */
+typedef struct {
+    int next;               /* next word */
+    glob_list matches;      /* what the pattern word before it matched */
+    size_t match;           /* next one of those */
+    int status;             /* of a while loop's last body */
+} loop_state;
+
+/* The next value of a for loop's variable, NULL at the end */
+static const char *next_word(command *cmd, loop_state *l) {
+    static const char glob_marks[] = { GLOB_STAR, GLOB_ANY, GLOB_CLASS, '\0' };
+    const char *word;
+    size_t len;
+
+    if (l->match < l->matches.count)
+        return glob_path(&l->matches, l->match++);
+    if ((word = cmd->argv[l->next]) == NULL)
+        return NULL;
+    l->next++;
+    if (!cmd->expand && !cmd->glob)
+        return word;
+    len = strlen(word);
+    char *buffer = command_buffer(cmd, expanded_length(word, len) + 1);
+    if (cmd->glob && strpbrk(word, glob_marks) != NULL) {
+        expand_pattern(word, len, buffer);
+        clear_glob_list(&l->matches);
+        l->match = 0;
+        if (glob_word(buffer, strlen(buffer), &l->matches) > 0)
+            return glob_path(&l->matches, l->match++);
+    }
+    return expand_into(word, len, buffer);
+}
+
+static void run_loop(program *p, int pc, loop_state *loops) {
+    while (!interrupted) {
+        const instruction *in = &p->code[pc++];
+        switch (in->op) {
+        case OP_RUN:
+            run_command(p, &p->commands[in->a]);
+            break;
+        case OP_JUMP:
+            pc = in->a;
+            break;
+        case OP_JUMP_IF_FALSE:
+            if (last_status != 0)
+                pc = in->a;
+            break;
+        case OP_JUMP_IF_TRUE:
+            if (last_status == 0)
+                pc = in->a;
+            break;
+        case OP_STATUS:
+            last_status = in->a;
+            break;
+        case OP_FOR_INIT:
+            loops[in->b].next = 1;
+            loops[in->b].match = 0;
+            clear_glob_list(&loops[in->b].matches);
+            last_status = 0;
+            break;
+        case OP_FOR_NEXT: {
+            command *cmd = &p->commands[in->c];
+            const char *word = next_word(cmd, &loops[in->b]);
+            if (word == NULL)
+                pc = in->a;
+            else
+                set_var(cmd->argv[0], word, 0);
+            break;
+        }
+        case OP_KEEP_STATUS:
+            loops[in->b].status = last_status;
+            break;
+        case OP_LOOP_STATUS:
+            last_status = loops[in->b].status;
+            break;
+        case OP_DEFINE:
+            define_function(p->commands[in->a].argv[0], p, in->b);
+            break;
+        case OP_RETURN:
+            return;
+        }
+    }
+}
+
+static void run_code(program *p, int pc) {
+    /* Per call, functions can recurse */
+    loop_state loops[p->loop_slots + 1];
+
+    memset(loops, 0, sizeof(loops));
+    run_loop(p, pc, loops);
+    for (int i = 0; i < p->loop_slots; i++)
+        free_glob_list(&loops[i].matches);
+}
+
+void run_program(program *p) {
+    interrupted = 0;
+    run_code(p, 0);
+    if (!p->keep)
+        free_program(p);
+}
+
+void init_interpreter(void (*launch_jobs)(job **jobs, int job_count)) {
+    launch = launch_jobs;
+}
+
+void interrupt_programs() {
+    interrupted = 1;
+}
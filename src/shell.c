@@ -1,5 +1,7 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stddef.h>
+#include <fcntl.h>
 #include <string.h>
 #include <signal.h>
 #include <stdio.h>
@@ -12,30 +14,78 @@
 #include "job.h"
 #include "io.h"
 #include "history.h"
+#include "event.h"
+#include "launch.h"
+#include "pathcache.h"
+#include "arena.h"
+#include "lexer.h"
+#include "parse.h"
+#include "pathglob.h"
+#include "builtin.h"
+#include "account.h"
+#include "stats.h"
+#include "notify.h"
+#include "prompt.h"
+#include "editor.h"
+#include "placement.h"
+#include "spawnserver.h"
+#include "script.h"
+#include "vars.h"
 
-/* Constants for input */
-#define INPUT_LENGTH 1024
-#define MAX_TOKENS 100
-#define MAX_COMMAND_COUNT 10
+/* Lines come from here, stdin or the script */
+static line_reader input;
 
-static pid_t shell_pgid;
-static struct termios shell_tmodes;
-static int shell_terminal; /* File descriptor for the terminal */
-static int shell_is_interactive;
+/* Or from here at a terminal */
+static line_editor editor;
 
-/* Head of process linked list */
-static process *head = NULL;
+/* Copy of a command fetched from the history */
+static char *recalled = NULL;
+static size_t recalled_capacity = 0;
+
+/* Background and stopped jobs */
+static job_table job_list;
+
+/* Prompt for the lines that finish an if, loop or function */
+#define CONTINUATION_PROMPT "> "
+
+/* Set by Ctrl-C, the main loop prints the history */
+static volatile sig_atomic_t history_wanted = 0;
+
+/* Ctrl-C at the shell itself stops a running loop and asks for
+ * the history.
+ */
+static void interrupt(int sig) {
+    (void)sig;
+    interrupt_programs();
+    history_wanted = 1;
+}
+
+/* Print the history if Ctrl-C asked for it. Returns whether it
+ * did.
+ */
+static int show_history() {
+    if (!history_wanted)
+        return 0;
+    history_wanted = 0;
+    print_history(0);
+    return 1;
+}
 
 /* Initializes the shell by ensuring the shell is the
  * foreground process group of terminal. If so, it puts shell
  * in its own process group and grabs control of the terminal.
+ * Scripts (input_fd isn't stdin) and input that isn't a terminal
+ * get no job control, commands stay in the shell's process group
+ * like in any other non-interactive shell.
  */
-void init_shell() {
+void init_shell(int input_fd) {
     /* Get the shell's terminal file descriptor */
     shell_terminal = STDIN_FILENO;
     /* Check if the file descriptor is associated with a terminal */
-    shell_is_interactive = isatty (shell_terminal);
-    if (shell_is_interactive) {
+    shell_is_interactive = input_fd == STDIN_FILENO && isatty(shell_terminal);
+    if (!shell_is_interactive) {
+        shell_pgid = getpgrp();
+    } else {
         /* Loop until shell is in the foreground.
          * This checks if the current process group leader's
          * id is the same as the terminal's controling process
@@ -49,7 +99,7 @@ void init_shell() {
             kill(shell_pgid, SIGTTIN); 
         }
         /* Ignore interactive and job-control signals. */
-        signal(SIGINT, print_history); /* Later change this to show history */
+        signal(SIGINT, interrupt);
         signal(SIGQUIT, SIG_IGN);
         signal(SIGTSTP, SIG_IGN);
         signal(SIGTTIN, SIG_IGN);
@@ -72,331 +122,520 @@ void init_shell() {
     }
 }
 
-/* Executes the process by replacing the current process
- * with the process to be executed. Child calls this function.
+/* Mark the process as completed or stopped using the status
+ * and usage wait4() gave us and return 1 if completed, 2 if
+ * stopped, 0 if neither, -1 if abnormal termination.
+ */
+int mark_process(process *p, int status, const struct rusage *usage) {
+    p->status = status;
+    if (WIFEXITED(p->status)) {
+        p->completed = 1;
+        account_exit(p, usage);
+        return 1;
+    } else if (WIFSTOPPED(p->status)) {
+        p->stopped = 1;
+        return 2;
+    } else if (WIFCONTINUED(p->status)) {
+        p->stopped = 0;
+        return 0;
+    } else {
+        p->completed = 1;
+        account_exit(p, usage);
+        return -1;
+    }
+}
+
+/* Wait for every process in the foreground job. Only children
+ * in the job's process group are waited on, background jobs
+ * finishing meanwhile are picked up by the main loop later.
+ * Without job control every job shares the shell's process group,
+ * so then we wait for the job's processes one at a time.
  */
-void execute_process(process *p) {
+void wait_for_job(job *j) {
+    struct rusage usage;
+    int status;
     pid_t pid;
+    process *p = j->first_process;
 
-    /* If shell isn't in foreground, then we can't
-     * set the process as foreground.
-     */
-    if (shell_is_interactive) {
-        pid = getpid();
-        if (p->foreground) {
-            /* Set this process as the foreground process group for the terminal. */
-            tcsetpgrp(shell_terminal, pid);
+    while (!job_is_stopped(j)) {
+        if (shell_is_interactive) {
+            pid = wait4(-j->pgid, &status, WUNTRACED, &usage);
+        } else {
+            while (p->completed || p->stopped)
+                p = p->next;
+            pid = wait4(p->pid, &status, WUNTRACED, &usage);
         }
-
-        /* Children inherit the signal handlers of parent which
-         * was ignore, so we need to set them back to default
-         */
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        signal(SIGCHLD, SIG_DFL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != ECHILD)
+                perror("wait4");
+            break;
+        }
+        if ((p = find_process(j->first_process, pid)) != NULL)
+            mark_process(p, status, &usage);
     }
+}
+
+/* Print what a "time"d job used */
+static void print_job_usage(job *j) {
+    job_usage u;
+    char buf[128];
+
+    get_job_usage(j, &u);
+    format_usage(&u, buf, sizeof(buf));
+    fprintf(stderr, "%s\n", buf);
+}
+
+/* Print how a job ended (or that it stopped) */
+void print_job_status(job *j) {
+    char buf[512];
+    format_job_status(j, buf, sizeof(buf));
+    fputs(buf, stdout);
+}
+
+/* Exit status a job's wait status stands for, like $? */
+static int exit_status(int status) {
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    return 128 + WSTOPSIG(status);
+}
 
-    execvp(p->argv[0], p->argv); /* execvp will search PATH for the command. */
-    perror("execvp");
-    exit(1);
+/* Run a builtin, or the function if fn is NULL */
+static void run_in_shell(builtin_fn fn, char **argv) {
+    if (fn != NULL)
+        last_status = run_builtin(fn, argv);
+    else
+        call_function(argv);
 }
 
-/* Launches the processes in the list of processes, adds background
- * processes to the global linked list
+/* Launches the jobs, waits for foreground jobs and adds
+ * background jobs to the job table. Job notices are only
+ * printed for people at a terminal, a script's output is its
+ * commands' output.
  */
-void launch_processes(process **processes, int process_count) {
-    if (process_count == 0)
-        return;
-    process *p = processes[0], *prev = NULL;
-    int i = 0;
-    while (i < process_count && p) {
-        pid_t pid;
-        /* Create a new process */
-        pid = fork();
-        if (pid < 0) {
-            perror("fork");
-            exit(1);
-        } else if (pid > 0) {
-            /* Parent */
-            p->pid = pid;
-            /* Put the child in its own process group */
-            setpgid(pid, pid);
-            if (p->foreground) {
-                /* Wait for the child to finish */
-                waitpid(pid, &(p->status), 0);
-                p->completed = 1;
-                /* Put the shell back in the foreground */
-                tcsetpgrp(shell_terminal, shell_pgid);
-                /* Set these in case process adjusted them */
-                tcsetattr(shell_terminal, TCSANOW, &shell_tmodes);
+void launch_jobs(job **jobs, int job_count) {
+    for (int i = 0; i < job_count; i++) {
+        job *j = jobs[i];
+        process *p = j->first_process;
+        builtin_fn fn = NULL;
+        uint64_t start = now_ns();
+
+        /* Whatever it changes may show in the git segment */
+        if (j->foreground && shell_is_interactive)
+            mark_prompt_stale();
 
-                /* Retrive the exit status of the process */
-                WIFEXITED(p->status) ? 
-                    printf("%s exited with status %d\n", p->argv[0], WEXITSTATUS(p->status)) : 
-                    printf("%s exited abnormally\n", p->argv[0]);
-                free_process(p);
-                free(p);
-                return;
+        if (p->argv[0] == NULL) {
+            /* Just "name=value", set it in the shell */
+            for (int k = 0; k < p->assignment_count; k++)
+                set_assignment(p->assignments[k], 0);
+            last_status = 0;
+            free_job(j);
+            continue;
+        }
+        if (strcmp(p->argv[0], "time") == 0 && p->argv[1] != NULL) {
+            /* "time cmd", bare "time" is the builtin */
+            p->argv++;
+            j->timed = 1;
+        }
+        if (j->foreground && p->next == NULL &&
+                p->infile < 0 && p->outfile < 0 &&
+                (is_function(p->argv[0]) ||
+                 ((fn = find_builtin(p->argv[0])) != NULL && !builtin_forks(fn)))) {
+            /* Run it right here, no fork needed. Redirections are
+             * put in place around it and the shell's fds put back
+             * after, pipelines still go through a fork. Functions
+             * only run this way. Assignments in front of them are
+             * set in the shell, there's no child to put them in.
+             */
+            for (int k = 0; k < p->assignment_count; k++)
+                set_assignment(p->assignments[k], 0);
+            saved_fd *saved = NULL;
+            if (p->redirect_count > 0) {
+                saved = arena_alloc(j->arena, p->redirect_count * sizeof(saved_fd));
+                fflush(stdout);
+                if (apply_redirections(p, saved) < 0) {
+                    last_status = 1;
+                    free_job(j);
+                    continue;
+                }
+            }
+            if (j->timed) {
+                struct rusage before;
+                getrusage(RUSAGE_SELF, &before);
+                clock_now(&p->spawn_time);
+                run_in_shell(fn, p->argv);
+                fflush(stdout);
+                account_builtin(p, &before);
+                print_job_usage(j);
             } else {
-                /* Print pid of background process */
-                printf("%s [%d]\n", p->argv[0], pid);
-                /* Add the process to the list of processes */
-                prev = p;
-                p = processes[++i];
-                add_process(&head, prev);
+                run_in_shell(fn, p->argv);
             }
-        } else {
-            /* Child */
-            execute_process(p);
+            if (saved != NULL) {
+                fflush(stdout);
+                restore_redirections(p, saved);
+            }
+            STAT_INC(builtins);
+            TRACE("builtin", p->argv[0], start, now_ns(), 0);
+            free_job(j);
+            continue;
         }
-    }
-}
-
-/* Parses command into processes and launches them */
-void handle_input(char **tokens, int token_count) {
-    int process_count = 0;
-    process *processes[MAX_COMMAND_COUNT];
-
-    /* Initialize first process */
-    process *p = malloc(sizeof(process));
-    init_process(p);
-    p->argv = malloc(sizeof(char *) * (token_count + 1));
-
-    /* If we end parse on symbol, we need to add last
-     * process to the list of processes. We use this
-     * variable to keep track of that and to handle
-     * checking for next process in the loop.
-     */
-    char ended_on_symbol = 0;
-    int i = 0, j = 0;
-    do {
-        /* strtok does not alloc memory, so we need to do it ourselves
-         * to make sure the memory is still valid after the next main
-         * loop iteration.
+        /* Builtin output is buffered, get it out before anything
+         * the children print.
          */
-        if (strcmp("&", tokens[i]) == 0) {
-            *p->argv = realloc(*p->argv, sizeof(char *) * (j + 1));
-            p->argv[j] = NULL;
-            p->foreground = 0;
+        fflush(stdout);
+        placement pl;
+        if (!j->foreground && next_placement(&pl)) {
+            j->placement = arena_alloc(j->arena, sizeof(placement));
+            *j->placement = pl;
+        }
+        int started = launch_job(j);
+        TRACE("spawn", job_name(j), start, now_ns(), 0);
+        if (started == 0) {
+            /* Nothing started, spawn_process() said why */
+            if (j->foreground)
+                last_status = 127;
+            free_job(j);
+            continue;
+        }
+        if (j->foreground) {
+            start = now_ns();
+            wait_for_job(j);
+            TRACE("wait", job_name(j), start, now_ns(), 0);
+            start = now_ns();
+            last_status = exit_status(job_status(j));
+            if (j->timed && job_is_completed(j))
+                print_job_usage(j);
+            if (shell_is_interactive) {
+                /* Put the shell back in the foreground */
+                tcsetpgrp(shell_terminal, shell_pgid);
+                /* Set these in case process adjusted them */
+                tcsetattr(shell_terminal, TCSANOW, &shell_tmodes);
 
-            /* Second bit indicates that we need to check
-             * for next process in the loop.
-             */
-            ended_on_symbol |= 2;
-        }   
-
-        if (ended_on_symbol & 2) {
-            ended_on_symbol = 0;
-            processes[process_count++] = p;
-            if (i + 1 < token_count) {
-                p = malloc(sizeof(process));
-                init_process(p);
-                p->argv = malloc(sizeof(char *) * (token_count + 1));
-                j = 0;
-                i++;
+                /* Retrive the exit status of the job */
+                print_job_status(j);
+            }
+            TRACE("report", job_name(j), start, now_ns(), 0);
+            if (job_is_completed(j)) {
+                free_job(j);
                 continue;
-            } else {
-                ended_on_symbol = 1;
-                break;
             }
+            /* Stopped, keep track of it like a background job */
+            j->foreground = 0;
+        } else if (shell_is_interactive) {
+            /* Print pgid of background job */
+            if (j->placement != NULL)
+                printf("%s [%d] on %s\n", job_name(j), j->pgid, j->placement->label);
+            else
+                printf("%s [%d]\n", job_name(j), j->pgid);
         }
-
-        p->argv[j] = malloc((strlen(tokens[i]) + 1));
-        strcpy(p->argv[j], tokens[i]);
-        i++;
-        j++;
-    } while (i < token_count);
-
-    /* If we didn't end on a symbol, we need to add the last process */
-    if (!ended_on_symbol) {
-        p->argv = realloc(p->argv, sizeof(char *) * (j + 1));
-        p->argv[j] = NULL;
-        processes[process_count++] = p;
+        /* Add the job to the job table, it keeps the
+         * command line's arena alive until it is reaped.
+         */
+        insert_job(&job_list, j);
     }
-
-    launch_processes(processes, process_count);
 }
 
-/* Mark the process as completed or stopped and return
- * 1 if completed, 2 if stopped, 0 if neither, -1 if abnormal
- * termination.
+/* Reap every child that changed state and queue notices for
+ * background jobs that completed or stopped. This is only
+ * called from the main loop once the SIGCHLD signalfd is
+ * readable, so we never modify the job list from a signal
+ * handler. One wait4(-1) drain handles all children instead
+ * of one waitpid() per tracked process. Returns how many
+ * notices were queued.
  */
-int mark_process(process *p) {
-    pid_t wait_result = waitpid(p->pid, &(p->status), WNOHANG);
-    if (wait_result == 0) {
-        return 0;
-    } else if (wait_result == -1) {
-        perror("waitpid");
-        exit(1);
-    } else {
-        if (WIFEXITED(p->status)) {
-            p->completed = 1;
-            return 1;
-        } else if (WIFSTOPPED(p->status)) {
-            p->stopped = 1;
-            return 2;
-        } else if (WIFCONTINUED(p->status)) {
-            p->stopped = 0;
-            return 0;
-        } else {
-            p->completed = 1;
-            return -1;
+int check_background_processes() {
+    int queued = 0;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+    process *p;
+    job *j;
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        j = find_job_by_pid(&job_list, pid, &p);
+        if (j == NULL)
+            continue; /* Not one of ours (or already waited on) */
+        int process_state = mark_process(p, status, &usage);
+        /* Only report once the whole pipeline finished or stopped */
+        if (process_state == 0 || !job_is_stopped(j))
+            continue;
+        /* Background jobs get a row of their own in the trace */
+        uint64_t start = now_ns();
+        if (trace_fd >= 0 && job_is_completed(j)) {
+            TRACE("wait", job_name(j), timespec_ns(&j->first_process->spawn_time),
+                    start, j->pgid);
+        }
+        if (shell_is_interactive) {
+            queue_job_notice(j);
+            queued++;
+        } else if (j->timed && job_is_completed(j)) {
+            print_job_usage(j);
+        }
+        TRACE("report", job_name(j), start, now_ns(), j->pgid);
+        if (job_is_completed(j)) {
+            delete_job(&job_list, j);
+            free_job(j);
         }
     }
+    if (pid < 0 && errno != ECHILD) {
+        perror("wait4");
+        exit(1);
+    }
+    return queued;
 }
 
-/* Check the status of background processes and print
- * their status if they have completed. This strategy
- * used over SIGCHLD handling because it avoids cases
- * where we would remove a process from the list of
- * while we are iterating over it.
+/* Copy a command from the history so it can be lexed in place,
+ * the history itself is read-only.
  */
-int check_background_processes() {
-    int should_print = 0; /* Used to determine if we should print prompt again */
-    if (head == NULL)
-        return should_print;
-    process *p = head, *tmp = NULL;
-    while (p) {
-        int process_state = mark_process(p);
-        if (process_state != 0 && should_print == 0) {
-            printf("\n");
-            should_print = 1;
-        }
-        if (process_state == 0) {
-            p = p->next;
-            continue;
-        } else if (process_state < 0) {
-            printf("%s [%d] exited abnormally\n", p->argv[0], p->pid);
-        } else if (process_state == 1) {
-            printf("%s [%d] exited with status %d\n", p->argv[0], p->pid, WEXITSTATUS(p->status));
-        } else if (process_state == 2) {
-            printf("%s [%d] suspended. Send SIGCONT to continue job\n", p->argv[0], p->pid);
-        }
-        if (p->completed) {
-            tmp = p;
-            remove_process(&head, p->pid);
-        }
-        p = p->next;
-        if (tmp != NULL) {
-            free_process(tmp);
-            free(tmp);
-            tmp = NULL;
+static char *recall_input(const char *cmd, size_t *len) {
+    *len = strlen(cmd);
+    if (*len + 1 > recalled_capacity) {
+        recalled_capacity = *len + 1;
+        recalled = realloc(recalled, recalled_capacity);
+        if (recalled == NULL) {
+            perror("realloc");
+            exit(1);
         }
     }
-    return should_print; 
+    memcpy(recalled, cmd, *len + 1);
+    return recalled;
+}
+
+/* True if the line is an "r" command. The history has to be
+ * saved before lexing since the lexer modifies the line.
+ */
+static int is_history_recall(const char *line) {
+    while (*line == ' ' || *line == '\t')
+        line++;
+    return line[0] == 'r' && (line[1] == '\0' || line[1] == ' ' ||
+            line[1] == '\t' || line[1] == '\n');
 }
 
 /* Main loop of the shell */
 int main(int argc, char **argv, char **envp) {
-    char input_line[INPUT_LENGTH];
-    char *tokens[MAX_TOKENS];
-    int token_count;
-    struct timeval timeout;
-    fd_set readfds;
+    prompt_info pinfo;
+    token_list tokens = { NULL, 0, 0 };
+    command_line cl;
+    const char *error;
+    char *line;
+    size_t len;
+    int input_fd = STDIN_FILENO;
+    int opt;
+
+    /* The spawn server is this binary exec'd again */
+    if (strcmp(argv[0], SPAWN_SERVER_NAME) == 0)
+        run_spawn_server(argv);
+    while ((opt = getopt(argc, argv, "s:p:t:")) != -1) {
+        switch (opt) {
+        case 's':
+            /* How to create children: fork, vfork, posix_spawn or server */
+            if (set_spawn_backend(optarg) < 0) {
+                fprintf(stderr, "Unknown spawn backend %s\n", optarg);
+                exit(2);
+            }
+            break;
+        case 'p':
+            /* Pipe capacity in bytes for pipelines */
+            if (set_pipe_size(atoi(optarg)) < 0) {
+                fprintf(stderr, "Bad pipe size %s\n", optarg);
+                exit(2);
+            }
+            break;
+        case 't':
+            /* Trace every command's life to a file */
+            if (open_trace(optarg) < 0) {
+                perror(optarg);
+                exit(2);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s fork|vfork|posix_spawn|server] [-p pipe_size] [-t trace_file] [script]\n", argv[0]);
+            exit(2);
+        }
+    }
+    if (optind < argc) {
+        /* Run a script instead of reading stdin, the rest of the
+         * arguments are its $1 onwards.
+         */
+        input_fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+        if (input_fd < 0) {
+            perror(argv[optind]);
+            exit(127);
+        }
+        init_variables(envp, argv[optind]);
+        set_positional(argv + optind + 1);
+    } else {
+        init_variables(envp, argv[0]);
+    }
 
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 50000; /* 50 ms */
-    init_shell();
+    init_shell(input_fd);
+    init_job_table(&job_list);
+    init_builtins(&job_list);
+    init_interpreter(launch_jobs);
+    init_history();
+    init_events();
+    init_line_reader(&input, input_fd);
+    add_event_fd(input_fd, EVENT_INPUT);
+    if (shell_is_interactive) {
+        init_prompt();
+        init_line_editor(&editor, shell_terminal);
+    }
 
     /* Main shell loop */
     while (1) {
-        /* Zero out memory to be safe */
-        memset(input_line, 0, INPUT_LENGTH);
-        memset(tokens, 0, MAX_TOKENS * sizeof(char *));
-        printf("%s", get_prompt_string(NULL));
-        fflush(NULL); /* Flush since we didn't print a newline */
-        int n;
-
-        /* Wait for input */
-        while (1) {
-            FD_ZERO(&readfds);
-            FD_SET(STDIN_FILENO, &readfds);
-            /* Probably could have used aio_read() here, but
-             * I am more familiar with select().
-             * This allows us to check for background processes
-             * every 50 ms while waiting for input. May not be most
-             * efficient, but it is simple and avoids cases where
-             * signal handling messes with process linked list state
-             * while modifying/reading it.
+        if (shell_is_interactive) {
+            /* Ctrl-C while the last command ran in the shell */
+            show_history();
+            /* Whatever finished while the last command ran */
+            flush_notices(1, NULL);
+            if (getcwd(pinfo.cwd, sizeof(pinfo.cwd)) == NULL)
+                strcpy(pinfo.cwd, "?");
+            pinfo.last_status = last_status;
+            pinfo.job_count = job_list.job_count;
+            const char *prompt = compile_pending() ? CONTINUATION_PROMPT :
+                get_prompt_string(&pinfo);
+            printf("%s", prompt);
+            fflush(NULL); /* Flush since we didn't print a newline */
+            start_line(&editor, prompt);
+        }
+        int edited = 0;
+
+        if (line_buffered(&input)) {
+            /* Scripts mostly run from the buffer, don't let their
+             * background jobs pile up as zombies meanwhile.
              */
-            n = select(1, &readfds, NULL, NULL, &timeout);
-            if (n == -1) {
-                if (errno == EINTR) { /* Interrupted by signal */
-                    errno = 0;
-                    continue;
+            if (job_list.job_count > 0 && (wait_for_events(0) & EVENT_CHILD))
+                check_background_processes();
+        } else if (shell_is_interactive && edit_pending(&editor) &&
+                (edited = edit_input(&editor, &line, &len)) != 0) {
+            /* A line typed ahead while the last one ran */
+        } else {
+            /* Wait for input. We only wake up when stdin is readable
+             * or a child changed state, so an idle shell with lots of
+             * background jobs doesn't burn any CPU. Notices from one
+             * wakeup go out together with one prompt redraw, and
+             * batches are spaced out so bursts get summarized.
+             */
+            fflush(stdout);
+            while (1) {
+                int events = wait_for_events(notice_delay());
+                if (events & EVENT_CHILD)
+                    check_background_processes();
+                if ((events & EVENT_SIGNAL) && shell_is_interactive &&
+                        show_history()) {
+                    /* Then the prompt and the line again */
+                    printf("%s", editor.prompt);
+                    fflush(stdout);
+                    redraw_line(&editor);
                 }
-                perror("select");
-                exit(1);
-            } else if (n == 0) {
-                if (check_background_processes() != 0)
-                    printf("%s", get_prompt_string(NULL));
-                fflush(NULL);
-                continue;
+                /* Fresh values for the prompt that is already drawn */
+                if ((events & EVENT_PROMPT) && prompt_events() && !compile_pending())
+                    redraw_prompt_info(shell_is_interactive ? cursor_row(&editor) : 0);
+                if (events & EVENT_INPUT) {
+                    if (!shell_is_interactive)
+                        break;
+                    /* Keys are handled as they come, until Enter */
+                    edited = edit_input(&editor, &line, &len);
+                    if (edited != 0)
+                        break;
+                }
+                if (notice_delay() == 0) {
+                    /* The jobs that finished change the prompt too */
+                    if (!compile_pending()) {
+                        pinfo.last_status = last_status;
+                        pinfo.job_count = job_list.job_count;
+                        editor.prompt = get_prompt_string(&pinfo);
+                    }
+                    suspend_line(&editor);
+                    flush_notices(0, editor.prompt);
+                    redraw_line(&editor);
+                }
+            }
+        }
+        uint64_t start = now_ns();
+        if (shell_is_interactive) {
+            if (edited < 0)
+                exit(last_status); /* Ctrl-D */
+        } else if (!read_line(&input, &line, &len)) {
+            /* End of input */
+            if (compile_pending()) {
+                printf("Syntax error near end of file\n");
+                exit(2);
             }
-            do {
-                errno = 0;
-                if (read(STDIN_FILENO, input_line, INPUT_LENGTH) >= 0) {
-                    goto input_found;
-                } 
-            } while (errno == EINTR); /* Interrupted by signal, restart read */
+            exit(last_status);
         }
+        STAT_INC(lines);
+        TRACE("read", line, start, now_ns(), 0);
 input_found:
-        add_to_history(input_line); /* If this is r x, it will be overwritten */
-        tokens[0] = strtok(input_line, " \t\n");
-        if (tokens[0] == NULL) {
+        /* "r" itself isn't saved, the command it fetches is. Scripts
+         * don't go in the history at all.
+         */
+        if (shell_is_interactive && !is_history_recall(line))
+            add_to_history(line);
+        /* Directory listings are only trusted for a line */
+        clear_directory_cache();
+        start = now_ns();
+        if (lex_line(line, len, &tokens, &error) < 0) {
+            printf("Error parsing input: %s\n", error);
+            continue;
+        }
+        if (tokens.count == 0) {
             /* No input */
             continue;
         }
-        if (strcmp(tokens[0], "exit") == 0) {
-            /* Exit the shell */
-            exit(0);
-        } else if (strcmp(tokens[0], "r") == 0) {
-            /* Fetch a command from the history */
-            token_count = 1;
-            while(token_count < MAX_TOKENS &&
-                    (tokens[token_count] = strtok(NULL, " \t\n")) != NULL) {
-                token_count++;
-            }
-            char *cmd = fetch_command(tokens, token_count);
-            if (cmd == NULL) {
-                printf("Error retrieving command.\n");
+        if (needs_compiler(&tokens)) {
+            /* Control flow, compiled once the constructs are closed */
+            program *prog = compile_line(&tokens);
+            if (prog == NULL)
                 continue;
-            }
-            memset(input_line, 0, INPUT_LENGTH);
-            strcpy(input_line, cmd);
-            goto input_found; /* Execute fetched command */
+            if (input_fd == STDIN_FILENO)
+                sync_line_reader(&input);
+            run_program(prog);
+            if (input_fd == STDIN_FILENO)
+                resume_line_reader(&input);
+            continue;
         }
-        token_count = 1;
-        while (token_count < MAX_TOKENS &&
-                (tokens[token_count] = strtok(NULL, " \t\n")) != NULL) {
-            if (tokens[token_count][0] == '\"') {
-                /* Handle quoted strings */
-                int start_len = strlen(tokens[token_count]);
-                char *tmp = strtok(NULL, "\"");
-                if (tmp == NULL) {
-                    /* One word in quotes */
-                    if (tokens[token_count][start_len - 1] == '\"') {
-                        tokens[token_count][start_len - 1] = '\0';
-                        tokens[token_count]++;
-                        token_count++;
-                        continue;
-                    }
-                    /* No closing quote */
-                    printf("Error parsing input.\n");
-                    break;
+        int parsed = parse_command_line(&tokens, &cl);
+        uint64_t end = now_ns();
+        STAT_INC(parses);
+        STAT_TIME(parse, end - start);
+        TRACE("parse", "", start, end, 0);
+        if (parsed < 0)
+            continue;
+
+        /* Reserved commands, only on their own */
+        process *first = cl.jobs[0]->first_process;
+        char **args = first->argv;
+        if (cl.job_count == 1 && first->next == NULL && cl.jobs[0]->foreground &&
+                args[0] != NULL) {
+            int nargs = 0;
+            while (args[nargs] != NULL)
+                nargs++;
+            if (strcmp(args[0], "r") == 0) {
+                /* Fetch a command from the history */
+                char *cmd = fetch_command(args, nargs);
+                if (cmd == NULL) {
+                    printf("Error retrieving command.\n");
+                    free_command_line(&cl);
+                    continue;
                 }
-                /* Multiple words in quotes */
-                tokens[token_count]++;
-                tokens[token_count][start_len - 1] = ' ';
+                line = recall_input(cmd, &len);
+                free_command_line(&cl);
+                goto input_found; /* Execute fetched command */
             }
-            token_count++;
         }
 
-        /* Parse and execute the command */
-        handle_input(tokens, token_count);
+        /* Execute the command. Commands reading a script on stdin
+         * have to start where we are in it, not past our read-ahead.
+         */
+        if (input_fd == STDIN_FILENO)
+            sync_line_reader(&input);
+        launch_jobs(cl.jobs, cl.job_count);
+        if (input_fd == STDIN_FILENO)
+            resume_line_reader(&input);
+        release_command_line(&cl);
     }
 
     return 0;
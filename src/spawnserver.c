@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "spawnserver.h"
+#include "launch.h"
+#include "placement.h"
+
+extern char **environ;
+
+/* Fixed part of a request. The redirections follow it, then
+ * the strings: path (empty to search PATH), cwd, argv, the
+ * environment and the redirections' file names, each NUL
+ * terminated.
+ */
+typedef struct {
+    pid_t pgid;
+    char foreground;
+    char interactive;
+    char has_infile;        /* fd 3 of the ones passed is stdin */
+    char has_outfile;       /* next one is stdout */
+    char has_placement;
+    int argc;
+    int envc;
+    int redirect_count;
+    placement placement;
+} spawn_request;
+
+/* Socket to the helper, -1 if there isn't one */
+static int server_fd = -1;
+
+/* Where requests are put together */
+static char *request = NULL;
+static size_t request_len = 0;
+
+/* Stack for the helper's vfork-style children */
+#define SERVER_STACK_SIZE (256 * 1024)
+
+static void put(const void *data, size_t len) {
+    if (request == NULL && (request = malloc(SPAWN_REQUEST_MAX)) == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    if (request_len + len > SPAWN_REQUEST_MAX) {
+        request_len = SPAWN_REQUEST_MAX + 1; /* Too big, checked by the caller */
+        return;
+    }
+    memcpy(request + request_len, data, len);
+    request_len += len;
+}
+
+static void put_string(const char *s) {
+    put(s, strlen(s) + 1);
+}
+
+/* Start the helper */
+int start_spawn_server() {
+    int sv[2];
+    char fd_arg[16];
+    pid_t pid;
+
+    if (server_fd >= 0)
+        return 0;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        /* Our end stays open across exec, the shell's doesn't */
+        fcntl(sv[1], F_SETFD, 0);
+        snprintf(fd_arg, sizeof(fd_arg), "%d", sv[1]);
+        execl("/proc/self/exe", SPAWN_SERVER_NAME, fd_arg, (char *)NULL);
+        _exit(127);
+    }
+    close(sv[1]);
+    server_fd = sv[0];
+    return 0;
+}
+
+/* True while the helper is there */
+int spawn_server_running() {
+    return server_fd >= 0;
+}
+
+/* The helper went away, everything goes back to fork() */
+static void stop_spawn_server(const char *why) {
+    fprintf(stderr, "spawn server: %s, using fork from now on\n", why);
+    close(server_fd);
+    server_fd = -1;
+}
+
+/* Have the helper start p */
+pid_t spawn_with_server(process *p) {
+    spawn_request req;
+    char cwd[PATH_MAX];
+    int fds[5] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int fd_count = 3;
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov;
+    struct msghdr msg;
+    char **envp = p->envp != NULL ? p->envp : environ;
+    pid_t pid;
+
+    memset(&req, 0, sizeof(req));
+    req.pgid = p->pgid;
+    req.foreground = p->foreground;
+    req.interactive = shell_is_interactive;
+    req.argc = 0;
+    while (p->argv[req.argc] != NULL)
+        req.argc++;
+    req.envc = 0;
+    while (envp[req.envc] != NULL)
+        req.envc++;
+    req.redirect_count = p->redirect_count;
+    if (p->placement != NULL) {
+        req.has_placement = 1;
+        req.placement = *p->placement;
+    }
+    if (p->infile >= 0) {
+        req.has_infile = 1;
+        fds[fd_count++] = p->infile;
+    }
+    if (p->outfile >= 0) {
+        req.has_outfile = 1;
+        fds[fd_count++] = p->outfile;
+    }
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+        strcpy(cwd, "/");
+
+    request_len = 0;
+    put(&req, sizeof(req));
+    put(p->redirects, p->redirect_count * sizeof(redirection));
+    put_string(p->path ? p->path : "");
+    put_string(cwd);
+    for (int i = 0; i < req.argc; i++)
+        put_string(p->argv[i]);
+    for (int i = 0; i < req.envc; i++)
+        put_string(envp[i]);
+    for (int i = 0; i < p->redirect_count; i++) {
+        if (p->redirects[i].file != NULL)
+            put_string(p->redirects[i].file);
+    }
+    if (request_len > SPAWN_REQUEST_MAX) {
+        fprintf(stderr, "%s: arguments and environment too long for the spawn server\n",
+                p->argv[0]);
+        return -1;
+    }
+
+    iov.iov_base = request;
+    iov.iov_len = request_len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(fd_count * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fd_count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, fd_count * sizeof(int));
+
+    ssize_t n;
+    while ((n = sendmsg(server_fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    if (n < 0) {
+        stop_spawn_server(strerror(errno));
+        return -1;
+    }
+    while ((n = recv(server_fd, &pid, sizeof(pid), 0)) < 0 && errno == EINTR)
+        ;
+    if (n != sizeof(pid)) {
+        stop_spawn_server(n < 0 ? strerror(errno) : "helper exited");
+        return -1;
+    }
+    if (pid < 0) {
+        fprintf(stderr, "%s: %s\n", p->argv[0], strerror(-pid));
+        return -1;
+    }
+    return pid;
+}
+
+/* Entry point of the helper's children, running on the helper's
+ * memory until exec like the vfork backend.
+ */
+static int server_child(void *arg) {
+    execute_process((process *)arg);
+    return 1;
+}
+
+/* Grow a pointer array to hold count + 1 entries */
+static char **reserve_pointers(char **array, size_t *capacity, size_t count) {
+    if (count + 1 <= *capacity)
+        return array;
+    while (*capacity < count + 1)
+        *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, *capacity * sizeof(char *));
+    if (array == NULL)
+        _exit(1);
+    return array;
+}
+
+/* Start the process in a request. Returns its pid or -errno. */
+static pid_t serve_request(char *buf, size_t len, int *fds, int fd_count, char *stack) {
+    static char **argv = NULL, **envp = NULL;
+    static size_t argv_capacity = 0, envp_capacity = 0;
+    static redirection *redirects = NULL;
+    static char cwd[PATH_MAX] = "";
+    spawn_request req;
+    process p;
+
+    if (len < sizeof(req))
+        return -EINVAL;
+    memcpy(&req, buf, sizeof(req));
+    size_t redirect_size = req.redirect_count * sizeof(redirection);
+    if (fd_count < 3 + req.has_infile + req.has_outfile || len < sizeof(req) + redirect_size)
+        return -EINVAL;
+    redirects = realloc(redirects, redirect_size + sizeof(redirection));
+    memcpy(redirects, buf + sizeof(req), redirect_size);
+
+    /* Walk the strings */
+    char *s = buf + sizeof(req) + redirect_size, *end = buf + len;
+    char *path = s;
+    s += strlen(s) + 1;
+    if (s < end && strcmp(s, cwd) != 0) {
+        /* Children get a copy of our cwd when they're cloned */
+        if (chdir(s) == 0)
+            snprintf(cwd, sizeof(cwd), "%s", s);
+    }
+    s += strlen(s) + 1;
+    argv = reserve_pointers(argv, &argv_capacity, req.argc);
+    for (int i = 0; i < req.argc && s < end; i++, s += strlen(s) + 1)
+        argv[i] = s;
+    argv[req.argc] = NULL;
+    envp = reserve_pointers(envp, &envp_capacity, req.envc);
+    for (int i = 0; i < req.envc && s < end; i++, s += strlen(s) + 1)
+        envp[i] = s;
+    envp[req.envc] = NULL;
+    for (int i = 0; i < req.redirect_count; i++) {
+        if (redirects[i].file != NULL) {
+            redirects[i].file = s;
+            s += strlen(s) + 1;
+        }
+    }
+    if (s > end || req.argc == 0)
+        return -EINVAL;
+
+    /* The shell's stdio is ours while starting this one */
+    for (int i = 0; i < 3; i++)
+        dup2(fds[i], i);
+    init_process(&p);
+    p.argv = argv;
+    p.path = path[0] ? path : NULL;
+    p.pgid = req.pgid;
+    p.foreground = req.foreground;
+    p.infile = req.has_infile ? fds[3] : -1;
+    p.outfile = req.has_outfile ? fds[3 + req.has_infile] : -1;
+    p.redirects = redirects;
+    p.redirect_count = req.redirect_count;
+    p.placement = req.has_placement ? &req.placement : NULL;
+    shell_is_interactive = req.interactive;
+    shell_terminal = STDIN_FILENO;
+    environ = envp;
+    /* Handing a foreground child the terminal needs SIGTTOU
+     * ignored, execute_process() sets it back to default.
+     */
+    signal(SIGTTOU, req.interactive ? SIG_IGN : SIG_DFL);
+
+    pid_t pid = clone(server_child, stack + SERVER_STACK_SIZE,
+            CLONE_PARENT | CLONE_VM | CLONE_VFORK | SIGCHLD, &p);
+    return pid < 0 ? -errno : pid;
+}
+
+/* main() of the helper */
+void run_spawn_server(char **argv) {
+    int sock = argv[1] ? atoi(argv[1]) : -1;
+    char *buf = malloc(SPAWN_REQUEST_MAX);
+    char *stack = mmap(NULL, SERVER_STACK_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    char control[CMSG_SPACE(5 * sizeof(int))];
+    sigset_t none;
+
+    if (sock < 0 || buf == NULL || stack == MAP_FAILED)
+        _exit(1);
+    /* Out of the shell's process group so Ctrl-C and friends at
+     * the prompt never reach us. Nothing blocked, children start
+     * from a clean mask.
+     */
+    setpgid(0, 0);
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    for (int sig = 1; sig < NSIG; sig++)
+        signal(sig, SIG_DFL);
+
+    while (1) {
+        struct iovec iov = { buf, SPAWN_REQUEST_MAX };
+        struct msghdr msg;
+        int fds[5], fd_count = 0;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            _exit(0); /* The shell is gone */
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+                continue;
+            fd_count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(c), fd_count * sizeof(int));
+        }
+
+        pid_t pid = serve_request(buf, n, fds, fd_count, stack);
+        for (int i = 0; i < fd_count; i++)
+            close(fds[i]);
+        if (send(sock, &pid, sizeof(pid), MSG_NOSIGNAL) < 0)
+            _exit(0);
+    }
+}
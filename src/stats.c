@@ -0,0 +1,148 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "stats.h"
+#include "arena.h"
+
+shell_stats stats;
+
+int trace_fd = -1;
+
+/* Events are batched here and written with one write(). Not a
+ * FILE so children that exit() after fork don't flush our copy.
+ */
+#define TRACE_BUFFER_SIZE 65536
+
+/* Longest detail kept, and the most an event can take: the fixed
+ * fields and every byte of the detail escaped as \u00XX
+ */
+#define TRACE_DETAIL_SIZE 256
+#define TRACE_EVENT_MAX (256 + 6 * (TRACE_DETAIL_SIZE - 1))
+static char *trace_buf = NULL;
+static size_t trace_used = 0;
+static pid_t trace_owner = 0;
+static uint64_t trace_start = 0;
+
+/* Monotonic time in nanoseconds */
+uint64_t now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return timespec_ns(&t);
+}
+
+/* A timespec from clock_now() in nanoseconds */
+uint64_t timespec_ns(const struct timespec *t) {
+    return (uint64_t)t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+static double ms(uint64_t ns) {
+    return ns / 1e6;
+}
+
+/* Print every counter */
+void print_stats(FILE *f) {
+    fprintf(f, "lines             %lu\n", stats.lines);
+    fprintf(f, "parses            %lu\n", stats.parses);
+    fprintf(f, "parse time        %.3f ms total, %.3f ms mean, %.3f ms max\n",
+            ms(stats.parse_ns), stats.parses ? ms(stats.parse_ns) / stats.parses : 0.0,
+            ms(stats.parse_max_ns));
+    fprintf(f, "forks             %lu\n", stats.forks);
+    fprintf(f, "execs             %lu\n", stats.execs);
+    fprintf(f, "spawn failures    %lu\n", stats.spawn_failures);
+    fprintf(f, "builtins          %lu\n", stats.builtins);
+    fprintf(f, "reaped            %lu\n", stats.reaped);
+    fprintf(f, "reap latency      %.3f ms mean, %.3f ms max\n",
+            stats.reaped ? ms(stats.reap_ns) / stats.reaped : 0.0,
+            ms(stats.reap_max_ns));
+    fprintf(f, "arena mallocs     %lu\n", arena_malloc_count());
+    fprintf(f, "history adds      %lu\n", stats.history_adds);
+    fprintf(f, "history fetches   %lu\n", stats.history_fetches);
+    fprintf(f, "history searches  %lu\n", stats.history_searches);
+    fprintf(f, "globs             %lu\n", stats.globs);
+    fprintf(f, "glob dir reads    %lu\n", stats.glob_dir_reads);
+    fprintf(f, "glob cache hits   %lu\n", stats.glob_cache_hits);
+    fprintf(f, "jobs inserted     %lu\n", stats.jobs_inserted);
+    fprintf(f, "jobs deleted      %lu\n", stats.jobs_deleted);
+    fprintf(f, "jobs peak         %lu\n", stats.jobs_peak);
+}
+
+/* Write out buffered trace events */
+void flush_trace() {
+    size_t done = 0;
+    if (trace_fd < 0)
+        return;
+    while (done < trace_used) {
+        ssize_t n = write(trace_fd, trace_buf + done, trace_used - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    trace_used = 0;
+}
+
+/* Only the shell writes out what it buffered, not children */
+static void close_trace() {
+    if (trace_fd >= 0 && getpid() == trace_owner)
+        flush_trace();
+}
+
+/* Start tracing to path. The file is a JSON array of events,
+ * the closing ] is optional in the format so events can be
+ * appended as they happen.
+ */
+int open_trace(const char *path) {
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0)
+        return -1;
+    trace_buf = malloc(TRACE_BUFFER_SIZE);
+    if (trace_buf == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    trace_owner = getpid();
+    trace_start = now_ns();
+    memcpy(trace_buf, "[\n", 2);
+    trace_used = 2;
+    atexit(close_trace);
+    return 0;
+}
+
+/* Copy s into the buffer as a JSON string body. trace_event()
+ * made room for it.
+ */
+static void append_escaped(const char *s) {
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            trace_buf[trace_used++] = '\\';
+            trace_buf[trace_used++] = c;
+        } else if (c < 0x20) {
+            trace_used += sprintf(trace_buf + trace_used, "\\u%04x", c);
+        } else {
+            trace_buf[trace_used++] = c;
+        }
+    }
+}
+
+/* Record one complete ("X") event. Times are microseconds since
+ * tracing started.
+ */
+void trace_event(const char *name, const char *detail, uint64_t start,
+        uint64_t end, int track) {
+    /* Room for the longest detail we keep plus the fixed fields */
+    if (trace_used > TRACE_BUFFER_SIZE - TRACE_EVENT_MAX)
+        flush_trace();
+    trace_used += snprintf(trace_buf + trace_used, TRACE_BUFFER_SIZE - trace_used,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"detail\":\"",
+            name, trace_owner, track, (start - trace_start) / 1e3, (end - start) / 1e3);
+    /* Long command lines are cut short */
+    char cut[TRACE_DETAIL_SIZE];
+    snprintf(cut, sizeof(cut), "%s", detail ? detail : "");
+    append_escaped(cut);
+    trace_used += snprintf(trace_buf + trace_used, TRACE_BUFFER_SIZE - trace_used,
+            "\"}},\n");
+}
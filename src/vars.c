@@ -0,0 +1,477 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "vars.h"
+#include "builtin.h"
+#include "lexer.h"
+
+extern char **environ;
+
+#define INITIAL_CAPACITY 256
+
+/* Smallest allocation for a value, so a loop variable going
+ * through short values keeps reusing its string.
+ */
+#define MIN_ENTRY_SIZE 32
+
+typedef struct {
+    char *entry;        /* "name=value", NULL for an empty slot */
+    size_t name_len;
+    size_t size;        /* bytes allocated, 0 if entry is from the startup envp */
+    long env_index;     /* where entry is in env, -1 if not exported */
+} variable;
+
+/* Open addressing table with linear probing, capacity is a power
+ * of two and kept at least twice count.
+ */
+static variable *table = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+
+/* The exported entries, NULL terminated. environ points here. */
+static char **env = NULL;
+static size_t env_count = 0;
+static size_t env_capacity = 0;
+
+struct positional {
+    int count;
+    char **args;        /* in the same allocation */
+    char *all;          /* $*, the args joined by spaces */
+};
+
+static positional *params = NULL;
+static const char *shell_name = "shell";
+
+/* FNV-1a, like the command cache */
+static uint64_t hash_name(const char *name, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/* Find the slot name lives in or the empty slot it would go in */
+static size_t find_slot(const char *name, size_t len) {
+    size_t mask = capacity - 1;
+    size_t i = hash_name(name, len) & mask;
+    while (table[i].entry != NULL && (table[i].name_len != len ||
+                memcmp(table[i].entry, name, len) != 0))
+        i = (i + 1) & mask;
+    return i;
+}
+
+static variable *lookup(const char *name, size_t len) {
+    if (count == 0)
+        return NULL;
+    variable *v = &table[find_slot(name, len)];
+    return v->entry != NULL ? v : NULL;
+}
+
+static void grow_table() {
+    variable *old = table;
+    size_t old_capacity = capacity;
+
+    capacity = capacity ? capacity * 2 : INITIAL_CAPACITY;
+    table = calloc(capacity, sizeof(variable));
+    if (table == NULL) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].entry != NULL)
+            table[find_slot(old[i].entry, old[i].name_len)] = old[i];
+    }
+    free(old);
+}
+
+/* Remove the entry at slot i, shifting later entries of the
+ * probe run back like the command cache does.
+ */
+static void remove_slot(size_t i) {
+    size_t mask = capacity - 1;
+    size_t j = i;
+
+    table[i].entry = NULL;
+    count--;
+    while (1) {
+        j = (j + 1) & mask;
+        if (table[j].entry == NULL)
+            return;
+        size_t home = hash_name(table[j].entry, table[j].name_len) & mask;
+        if ((j > i && (home <= i || home > j)) ||
+                (j < i && (home <= i && home > j))) {
+            table[i] = table[j];
+            table[j].entry = NULL;
+            i = j;
+        }
+    }
+}
+
+static void env_append(variable *v) {
+    if (env_count + 1 >= env_capacity) {
+        env_capacity = env_capacity ? env_capacity * 2 : 64;
+        env = realloc(env, env_capacity * sizeof(char *));
+        if (env == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    v->env_index = env_count;
+    env[env_count++] = v->entry;
+    env[env_count] = NULL;
+    environ = env;
+}
+
+/* Take v out of env, the last entry fills the hole */
+static void env_remove(variable *v) {
+    size_t i = v->env_index;
+
+    env_count--;
+    if (i != env_count) {
+        env[i] = env[env_count];
+        lookup(env[i], strchr(env[i], '=') - env[i])->env_index = i;
+    }
+    env[env_count] = NULL;
+    v->env_index = -1;
+}
+
+static void set_var_len(const char *name, size_t name_len, const char *value, int export) {
+    size_t value_len = strlen(value);
+    size_t need = name_len + value_len + 2;
+
+    if ((count + 1) * 2 > capacity)
+        grow_table();
+    variable *v = &table[find_slot(name, name_len)];
+    if (v->entry == NULL) {
+        v->size = need < MIN_ENTRY_SIZE ? MIN_ENTRY_SIZE : need;
+        if ((v->entry = malloc(v->size)) == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(v->entry, name, name_len);
+        v->entry[name_len] = '=';
+        v->name_len = name_len;
+        v->env_index = -1;
+        count++;
+    } else if (v->size < need) {
+        /* value may be the old value, copy it before freeing that */
+        char *entry = malloc(need);
+        if (entry == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(entry, v->entry, name_len + 1);
+        memcpy(entry + name_len + 1, value, value_len + 1);
+        if (v->size > 0)
+            free(v->entry);
+        v->entry = entry;
+        v->size = need;
+        if (v->env_index >= 0)
+            env[v->env_index] = entry;
+        if (export && v->env_index < 0)
+            env_append(v);
+        return;
+    }
+    /* Fits, the environment already points at it */
+    memmove(v->entry + name_len + 1, value, value_len + 1);
+    if (export && v->env_index < 0)
+        env_append(v);
+}
+
+void set_var(const char *name, const char *value, int export) {
+    set_var_len(name, strlen(name), value, export);
+}
+
+void set_assignment(const char *assignment, int export) {
+    const char *eq = strchr(assignment, '=');
+    set_var_len(assignment, eq - assignment, eq + 1, export);
+}
+
+const char *get_var(const char *name) {
+    size_t len = strlen(name);
+    variable *v = lookup(name, len);
+    return v ? v->entry + len + 1 : NULL;
+}
+
+void export_var(const char *name) {
+    variable *v = lookup(name, strlen(name));
+    if (v == NULL)
+        set_var(name, "", 1);
+    else if (v->env_index < 0)
+        env_append(v);
+}
+
+void unset_var(const char *name) {
+    size_t len = strlen(name);
+    variable *v = lookup(name, len);
+
+    if (v == NULL)
+        return;
+    if (v->env_index >= 0)
+        env_remove(v);
+    if (v->size > 0)
+        free(v->entry);
+    remove_slot(v - table);
+}
+
+/* Import the startup environment */
+void init_variables(char **envp, const char *name) {
+    shell_name = name;
+    for (; *envp != NULL; envp++) {
+        char *eq = strchr(*envp, '=');
+        if (eq == NULL || lookup(*envp, eq - *envp) != NULL)
+            continue;
+        if ((count + 1) * 2 > capacity)
+            grow_table();
+        /* Used as is until it's set */
+        variable *v = &table[find_slot(*envp, eq - *envp)];
+        v->entry = *envp;
+        v->name_len = eq - *envp;
+        v->size = 0;
+        count++;
+        env_append(v);
+    }
+    if (env == NULL) {
+        /* Nothing exported, still give environ an array of ours */
+        env_capacity = 64;
+        env = calloc(env_capacity, sizeof(char *));
+        environ = env;
+    }
+}
+
+static int is_name_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_name_char(char c) {
+    return is_name_start(c) || (c >= '0' && c <= '9');
+}
+
+int is_assignment(const char *s, size_t len) {
+    size_t i = 0;
+    if (len == 0 || !is_name_start(s[0]))
+        return 0;
+    while (i < len && is_name_char(s[i]))
+        i++;
+    return i < len && s[i] == '=';
+}
+
+int is_name(const char *s) {
+    if (!is_name_start(*s))
+        return 0;
+    while (is_name_char(*s))
+        s++;
+    return *s == '\0';
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* "export" without arguments */
+void print_exports() {
+    char **sorted = malloc((env_count + 1) * sizeof(char *));
+
+    if (sorted == NULL)
+        return;
+    memcpy(sorted, env, env_count * sizeof(char *));
+    qsort(sorted, env_count, sizeof(char *), compare_strings);
+    for (size_t i = 0; i < env_count; i++) {
+        const char *eq = strchr(sorted[i], '=');
+        printf("export %.*s='", (int)(eq - sorted[i]), sorted[i]);
+        for (const char *c = eq + 1; *c; c++) {
+            if (*c == '\'')
+                fputs("'\\''", stdout);
+            else
+                putchar(*c);
+        }
+        printf("'\n");
+    }
+    free(sorted);
+}
+
+/* The environment with the assignments on top */
+char **environment_with(arena *a, char **assignments, int n) {
+    char **e = arena_alloc(a, (env_count + n + 1) * sizeof(char *));
+    size_t used = env_count;
+
+    memcpy(e, env, env_count * sizeof(char *));
+    for (int i = 0; i < n; i++) {
+        size_t len = strchr(assignments[i], '=') - assignments[i];
+        variable *v = lookup(assignments[i], len);
+        size_t at = v != NULL && v->env_index >= 0 ? (size_t)v->env_index : used;
+        /* "A=1 A=2 cmd", the last one wins */
+        for (size_t j = env_count; j < used && at == used; j++) {
+            if (strncmp(e[j], assignments[i], len + 1) == 0)
+                at = j;
+        }
+        e[at] = assignments[i];
+        if (at == used)
+            used++;
+    }
+    e[used] = NULL;
+    return e;
+}
+
+/* The value of the parameter called name: a variable, a
+ * positional parameter or one of $?, $$, $# and $@ (or $*),
+ * "" if it isn't set.
+ */
+static const char *parameter_value(const char *name, size_t len) {
+    static char number[24];
+
+    if (len > 0 && name[0] >= '0' && name[0] <= '9') {
+        int n = 0;
+        for (size_t i = 0; i < len && n < 100000; i++)
+            n = n * 10 + name[i] - '0';
+        if (n == 0)
+            return shell_name;
+        return params != NULL && n <= params->count ? params->args[n - 1] : "";
+    }
+    if (len == 1 && !is_name_start(name[0])) {
+        switch (name[0]) {
+        case '?':
+            snprintf(number, sizeof(number), "%d", last_status);
+            return number;
+        case '$':
+            snprintf(number, sizeof(number), "%d", (int)getpid());
+            return number;
+        case '#':
+            snprintf(number, sizeof(number), "%d", params ? params->count : 0);
+            return number;
+        default: /* @ and * */
+            return params ? params->all : "";
+        }
+    }
+    variable *v = lookup(name, len);
+    return v ? v->entry + len + 1 : "";
+}
+
+/* The parameter after a mark at *p, moving *p past its name. A
+ * mark that isn't followed by one is a plain $.
+ */
+static const char *parameter(const char **p, const char *end) {
+    const char *s = *p;
+    size_t len = 0;
+
+    if (s < end && *s == '{') {
+        const char *close = memchr(s, '}', end - s);
+        if (close == NULL)
+            return "$";
+        *p = close + 1;
+        return parameter_value(s + 1, close - s - 1);
+    }
+    if (s < end && is_name_start(*s)) {
+        while (s + len < end && is_name_char(s[len]))
+            len++;
+    } else if (s < end && ((*s >= '0' && *s <= '9') || strchr("?$#@*", *s) != NULL)) {
+        len = 1;
+    } else {
+        return "$";
+    }
+    *p = s + len;
+    return parameter_value(s, len);
+}
+
+size_t expanded_length(const char *s, size_t len) {
+    const char *end = s + len, *mark;
+    size_t total = 0;
+
+    while ((mark = memchr(s, VAR_MARK, end - s)) != NULL) {
+        total += mark - s;
+        s = mark + 1;
+        total += strlen(parameter(&s, end));
+    }
+    return total + (end - s);
+}
+
+/* Copy n bytes of the word itself, giving *, ? and [ back */
+static char *copy_unmarked(char *w, const char *s, size_t n) {
+    static const char glob_chars[] = { [GLOB_STAR] = '*', [GLOB_ANY] = '?', [GLOB_CLASS] = '[' };
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = s[i];
+        w[i] = c >= GLOB_STAR && c <= GLOB_CLASS ? glob_chars[c] : c;
+    }
+    return w + n;
+}
+
+static char *copy_marked(char *w, const char *s, size_t n) {
+    memcpy(w, s, n);
+    return w + n;
+}
+
+/* Values go in as they are, only the word's own bytes can be marks */
+static char *expand_word(const char *s, size_t len, char *out,
+        char *(*copy)(char *w, const char *s, size_t n)) {
+    const char *end = s + len, *mark;
+    char *w = out;
+
+    while ((mark = memchr(s, VAR_MARK, end - s)) != NULL) {
+        w = copy(w, s, mark - s);
+        s = mark + 1;
+        const char *value = parameter(&s, end);
+        size_t value_len = strlen(value);
+        memcpy(w, value, value_len);
+        w += value_len;
+    }
+    w = copy(w, s, end - s);
+    *w = '\0';
+    return out;
+}
+
+char *expand_into(const char *s, size_t len, char *out) {
+    return expand_word(s, len, out, copy_unmarked);
+}
+
+char *expand_pattern(const char *s, size_t len, char *out) {
+    return expand_word(s, len, out, copy_marked);
+}
+
+char *arena_expand(arena *a, const char *s, size_t len) {
+    return expand_into(s, len, arena_alloc(a, expanded_length(s, len) + 1));
+}
+
+/* New $1 onwards, copied into one allocation */
+positional *set_positional(char **args) {
+    positional *old = params;
+    size_t bytes = 0;
+    int n = 0;
+
+    while (args[n] != NULL)
+        bytes += strlen(args[n++]) + 1;
+    positional *p = malloc(sizeof(positional) + (n + 1) * sizeof(char *) + 2 * bytes + 1);
+    if (p == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    p->count = n;
+    p->args = (char **)(p + 1);
+    char *s = (char *)(p->args + n + 1);
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(args[i]);
+        p->args[i] = memcpy(s, args[i], len + 1);
+        s += len + 1;
+    }
+    p->args[n] = NULL;
+    p->all = s;
+    for (int i = 0; i < n; i++) {
+        size_t len = strlen(p->args[i]);
+        memcpy(s, p->args[i], len);
+        s += len;
+        if (i + 1 < n)
+            *s++ = ' ';
+    }
+    *s = '\0';
+    params = p;
+    return old;
+}
+
+void restore_positional(positional *old) {
+    free(params);
+    params = old;
+}